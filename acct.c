@@ -0,0 +1,408 @@
+/*
+ * acct.c - Allocation and syscall accounting for the shell, loaded
+ *          with LD_PRELOAD (runtrace -A)
+ *
+ * Counts, for each prompt cycle of the shell, the heap allocations it
+ * makes and the system calls it makes, and writes per-command
+ * distributions to $ACCT_LOG when the shell exits. A cycle runs from
+ * the moment fgets hands the shell a command line to the moment it
+ * calls fgets for the next one, so it covers eval, the job, and any
+ * signal handlers that run meanwhile, but not the wait for input.
+ * Cycles are grouped by the first word of their command line.
+ *
+ * Allocations are counted by interposing on malloc, calloc, realloc
+ * and free, which glibc calls through the PLT even from inside stdio.
+ * System calls are counted two ways. read and write come from the
+ * kernel's own counts for the shell's thread in /proc/self/task/<pid>/io
+ * (/proc/self/io adds in the children it has reaped), so they include
+ * the ones that stdio makes internally. The other calls (fork, kill,
+ * waitpid, the signal mask and handler calls, setpgid, open, close,
+ * dup, dup2 and sleeps) are counted by interposing on their libc
+ * wrappers, which sees every call that the shell makes itself.
+ *
+ * If $ACCT_BUDGET is "<allocs>,<syscalls>", each cycle that exceeds
+ * either number (-1 for no limit) gets a line starting with BUDGET in
+ * the log, which runtrace turns into a failure.
+ *
+ * Only the first process to load the library counts. It marks itself
+ * in $ACCT_OWNER, so that the jobs it runs, which inherit LD_PRELOAD,
+ * stay quiet, and a forked child stops counting at the fork.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define MAXKEYS 64              /* Distinct commands */
+#define MAXCYCLES 1024          /* Cycles kept per command */
+#define MAXKEY 32               /* Max length of a command name */
+#define MAXVIOLATIONS 64        /* BUDGET lines in the log */
+
+/* The calls we count; read and write come from /proc/self/task/<pid>/io */
+enum { S_READ, S_WRITE, S_FORK, S_KILL, S_WAITPID, S_SIGPROCMASK,
+       S_SIGSUSPEND, S_SIGACTION, S_SETPGID, S_OPEN, S_CLOSE, S_DUP,
+       S_DUP2, S_SLEEP, NSYS };
+static char *sysnames[] = { "read", "write", "fork", "kill", "waitpid",
+			    "sigprocmask", "sigsuspend", "sigaction",
+			    "setpgid", "open", "close", "dup", "dup2",
+			    "sleep" };
+
+/* Per-command statistics */
+struct key_t {
+    char name[MAXKEY];
+    int n;                      /* Cycles */
+    int allocs[MAXCYCLES];      /* Allocations in each cycle */
+    int syscalls[MAXCYCLES];    /* Syscalls in each cycle */
+    long frees;                 /* Total frees */
+    long sys[NSYS];             /* Total calls of each kind */
+};
+
+static struct key_t keys[MAXKEYS];
+static int num_keys = 0;
+static char violations[MAXVIOLATIONS][128];
+static int num_violations = 0;
+
+static int active = 0;          /* True in the process that counts */
+static int iofd = -1;           /* /proc/self/task/<pid>/io */
+static int budget_allocs = -1;
+static int budget_syscalls = -1;
+
+/* The cycle in progress */
+static struct key_t *cur = NULL;
+static int cycle_allocs, cycle_frees, cycle_sys[NSYS];
+static long io_base[2];
+
+/* The real functions */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+static pid_t (*real_fork)(void);
+static int (*real_kill)(pid_t, int);
+static pid_t (*real_waitpid)(pid_t, int *, int);
+static int (*real_sigprocmask)(int, const sigset_t *, sigset_t *);
+static int (*real_sigsuspend)(const sigset_t *);
+static int (*real_sigaction)(int, const struct sigaction *, struct sigaction *);
+static int (*real_setpgid)(pid_t, pid_t);
+static int (*real_open)(const char *, int, ...);
+static int (*real_close)(int);
+static int (*real_dup)(int);
+static int (*real_dup2)(int, int);
+static int (*real_usleep)(useconds_t);
+static int (*real_nanosleep)(const struct timespec *, struct timespec *);
+static char *(*real_fgets)(char *, int, FILE *);
+
+#define COUNT(s) do { if (active) __atomic_add_fetch(&cycle_sys[s], 1, \
+					__ATOMIC_RELAXED); } while (0)
+
+static void acct_report(void);
+
+/*
+ * acct_child - Children don't count
+ */
+static void acct_child(void)
+{
+    active = 0;
+}
+
+/*
+ * acct_init - Find the real functions, and start counting if we are
+ *     the first process to load the library
+ */
+static void __attribute__((constructor)) acct_init(void)
+{
+    char *owner, *budget, pid[16], path[64];
+
+    real_fork = dlsym(RTLD_NEXT, "fork");
+    real_kill = dlsym(RTLD_NEXT, "kill");
+    real_waitpid = dlsym(RTLD_NEXT, "waitpid");
+    real_sigprocmask = dlsym(RTLD_NEXT, "sigprocmask");
+    real_sigsuspend = dlsym(RTLD_NEXT, "sigsuspend");
+    real_sigaction = dlsym(RTLD_NEXT, "sigaction");
+    real_setpgid = dlsym(RTLD_NEXT, "setpgid");
+    real_open = dlsym(RTLD_NEXT, "open");
+    real_close = dlsym(RTLD_NEXT, "close");
+    real_dup = dlsym(RTLD_NEXT, "dup");
+    real_dup2 = dlsym(RTLD_NEXT, "dup2");
+    real_usleep = dlsym(RTLD_NEXT, "usleep");
+    real_nanosleep = dlsym(RTLD_NEXT, "nanosleep");
+    real_fgets = dlsym(RTLD_NEXT, "fgets");
+
+    if ((owner = getenv("ACCT_OWNER")) != NULL || !getenv("ACCT_LOG"))
+	return;
+    sprintf(pid, "%d", getpid());
+    setenv("ACCT_OWNER", pid, 1);
+    if ((budget = getenv("ACCT_BUDGET")) != NULL)
+	sscanf(budget, "%d,%d", &budget_allocs, &budget_syscalls);
+    /* The thread's own counts; the process's include reaped children */
+    sprintf(path, "/proc/self/task/%d/io", getpid());
+    iofd = real_open(path, O_RDONLY | O_CLOEXEC);
+    pthread_atfork(NULL, NULL, acct_child);
+    atexit(acct_report);
+    active = 1;
+}
+
+/*
+ * io_counts - Read the shell's read and write syscall counts
+ */
+static void io_counts(long counts[2])
+{
+    char buf[512], *p;
+
+    counts[0] = counts[1] = 0;
+    if (iofd < 0 || pread(iofd, buf, sizeof(buf) - 1, 0) <= 0)
+	return;
+    buf[sizeof(buf) - 1] = '\0';
+    if ((p = strstr(buf, "syscr:")) != NULL)
+	counts[0] = atol(p + 6);
+    if ((p = strstr(buf, "syscw:")) != NULL)
+	counts[1] = atol(p + 6);
+}
+
+/*
+ * end_cycle - Charge the cycle in progress to its command
+ */
+static void end_cycle(void)
+{
+    long io[2];
+    int i, total = 0, k;
+
+    if (!cur)
+	return;
+    io_counts(io);
+    cycle_sys[S_READ] += io[0] - io_base[0] - 1;  /* Minus our own pread */
+    cycle_sys[S_WRITE] += io[1] - io_base[1];
+    for (i = 0; i < NSYS; i++) {
+	cur->sys[i] += cycle_sys[i];
+	total += cycle_sys[i];
+    }
+    k = cur->n < MAXCYCLES ? cur->n : MAXCYCLES - 1;
+    cur->allocs[k] = cycle_allocs;
+    cur->syscalls[k] = total;
+    cur->frees += cycle_frees;
+    cur->n++;
+
+    if (((budget_allocs >= 0 && cycle_allocs > budget_allocs) ||
+	 (budget_syscalls >= 0 && total > budget_syscalls)) &&
+	num_violations < MAXVIOLATIONS)
+	snprintf(violations[num_violations++], 128,
+		 "BUDGET %s cycle %d: %d allocs (budget %d), "
+		 "%d syscalls (budget %d)\n", cur->name, cur->n,
+		 cycle_allocs, budget_allocs, total, budget_syscalls);
+    cur = NULL;
+}
+
+/*
+ * start_cycle - Start counting a cycle for command line cmdline
+ */
+static void start_cycle(char *cmdline)
+{
+    char name[MAXKEY];
+    int i;
+
+    name[0] = '\0';
+    sscanf(cmdline, "%31s", name);
+    for (i = 0; i < num_keys && strcmp(keys[i].name, name); i++)
+	;
+    if (i == num_keys) {
+	if (num_keys == MAXKEYS)
+	    return;
+	strcpy(keys[num_keys++].name, name);
+    }
+    cur = &keys[i];
+    cycle_allocs = cycle_frees = 0;
+    memset(cycle_sys, 0, sizeof(cycle_sys));
+    io_counts(io_base);
+}
+
+/*
+ * The shell's read of its next command line bounds the cycles
+ */
+char *fgets(char *s, int size, FILE *stream)
+{
+    char *ret;
+
+    if (!active)
+	return real_fgets(s, size, stream);
+    end_cycle();
+    ret = real_fgets(s, size, stream);
+    if (ret)
+	start_cycle(s);
+    return ret;
+}
+
+/*
+ * Heap allocation
+ */
+void *malloc(size_t size)
+{
+    if (cur)
+	cycle_allocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    if (cur)
+	cycle_allocs++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (cur)
+	cycle_allocs++;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    if (cur && ptr)
+	cycle_frees++;
+    __libc_free(ptr);
+}
+
+/*
+ * System calls
+ */
+pid_t fork(void)
+{
+    COUNT(S_FORK);
+    return real_fork();
+}
+
+int kill(pid_t pid, int sig)
+{
+    COUNT(S_KILL);
+    return real_kill(pid, sig);
+}
+
+pid_t waitpid(pid_t pid, int *status, int options)
+{
+    COUNT(S_WAITPID);
+    return real_waitpid(pid, status, options);
+}
+
+int sigprocmask(int how, const sigset_t *set, sigset_t *oldset)
+{
+    COUNT(S_SIGPROCMASK);
+    return real_sigprocmask(how, set, oldset);
+}
+
+int sigsuspend(const sigset_t *mask)
+{
+    COUNT(S_SIGSUSPEND);
+    return real_sigsuspend(mask);
+}
+
+int sigaction(int sig, const struct sigaction *act, struct sigaction *oldact)
+{
+    COUNT(S_SIGACTION);
+    return real_sigaction(sig, act, oldact);
+}
+
+int setpgid(pid_t pid, pid_t pgid)
+{
+    COUNT(S_SETPGID);
+    return real_setpgid(pid, pgid);
+}
+
+int open(const char *path, int flags, ...)
+{
+    va_list ap;
+    mode_t mode = 0;
+
+    if (flags & O_CREAT) {
+	va_start(ap, flags);
+	mode = va_arg(ap, mode_t);
+	va_end(ap);
+    }
+    COUNT(S_OPEN);
+    return real_open(path, flags, mode);
+}
+
+int close(int fd)
+{
+    COUNT(S_CLOSE);
+    return real_close(fd);
+}
+
+int dup(int fd)
+{
+    COUNT(S_DUP);
+    return real_dup(fd);
+}
+
+int dup2(int fd, int fd2)
+{
+    COUNT(S_DUP2);
+    return real_dup2(fd, fd2);
+}
+
+int usleep(useconds_t usecs)
+{
+    COUNT(S_SLEEP);
+    return real_usleep(usecs);
+}
+
+int nanosleep(const struct timespec *req, struct timespec *rem)
+{
+    COUNT(S_SLEEP);
+    return real_nanosleep(req, rem);
+}
+
+/*
+ * cmpint - Compare two ints for qsort
+ */
+static int cmpint(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * acct_report - Write the per-command distributions to $ACCT_LOG
+ */
+static void acct_report(void)
+{
+    FILE *fp;
+    struct key_t *k;
+    int i, j, n;
+
+    if (!active)
+	return;
+    end_cycle();
+    active = 0;
+    if ((fp = fopen(getenv("ACCT_LOG"), "w")) == NULL)
+	return;
+
+    fprintf(fp, "%-20s %6s %20s %8s %20s  %s\n", "command", "cycles",
+	    "allocs min/med/max", "frees", "syscalls min/med/max",
+	    "syscalls per cycle");
+    for (k = keys; k < keys + num_keys; k++) {
+	n = k->n < MAXCYCLES ? k->n : MAXCYCLES;
+	if (n == 0)
+	    continue;
+	qsort(k->allocs, n, sizeof(int), cmpint);
+	qsort(k->syscalls, n, sizeof(int), cmpint);
+	fprintf(fp, "%-20.20s %6d %6d/%6d/%6d %8ld %6d/%6d/%6d ", k->name,
+		k->n, k->allocs[0], k->allocs[n / 2], k->allocs[n - 1],
+		k->frees, k->syscalls[0], k->syscalls[n / 2],
+		k->syscalls[n - 1]);
+	for (j = 0; j < NSYS; j++)
+	    if (k->sys[j])
+		fprintf(fp, " %s=%.1f", sysnames[j], (double)k->sys[j] / k->n);
+	fprintf(fp, "\n");
+    }
+    for (i = 0; i < num_violations; i++)
+	fputs(violations[i], fp);
+    fclose(fp);
+}
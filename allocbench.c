@@ -0,0 +1,221 @@
+/*
+ * allocbench.c - Allocation benchmark for the csapp arena and pool
+ *
+ * Replays the allocations that a shell makes for each command line,
+ * first with malloc and free, then with an arena that is reset after
+ * every command plus an object pool for the job records, which live
+ * on from one command to the next. For each, it prints the calls to
+ * malloc per command and the time per command (mean and 99th
+ * percentile).
+ *
+ * Per command, the shell copies the command line, builds an argv
+ * array with a copy of each argument, and composes its messages in
+ * an output buffer. Each command that runs a job adds a job record,
+ * and the oldest of more than MAXLIVE jobs is reaped.
+ *
+ * Usage: ./allocbench [-hp] [-n <commands>]
+ */
+#include "csapp.h"
+
+#define MAXARGS 128
+#define MAXLIVE 8              /* Jobs alive at once */
+#define MAXSAMPLES 1000000
+#define OUTBUF 256
+
+/* Roughly what the shell lab traces feed a shell */
+char *cmdlines[] = {
+    "./myspin1 10 &",
+    "/bin/echo -e tsh\\076 jobs",
+    "jobs",
+    "./mysplit 4",
+    "fg %1",
+    "/bin/echo -e tsh\\076 ./mytstpp",
+    "./mycat < myin.txt > myout.txt",
+    "bg %2",
+};
+#define NCMDLINES (sizeof(cmdlines) / sizeof(cmdlines[0]))
+
+struct job_t {
+    pid_t pid;
+    int jid;
+    int state;
+    char cmdline[1024];
+};
+
+/* Modified by command line args */
+long num_cmds = 200000;
+int flags = 0;
+
+long mallocs;                  /* Calls to malloc in the malloc run */
+long samples[MAXSAMPLES];
+
+/* Prototypes */
+void usage(void);
+void run(char *name, int use_arena);
+int cmplong(const void *a, const void *b);
+
+int main(int argc, char **argv)
+{
+    int c;
+
+    while ((c = getopt(argc, argv, "hpn:")) != EOF) {
+	switch (c) {
+	case 'n':             /* Commands per run */
+	    num_cmds = atol(optarg);
+	    if (num_cmds < 1 || num_cmds > MAXSAMPLES) {
+		printf("allocbench: -n must be between 1 and %d\n", MAXSAMPLES);
+		exit(1);
+	    }
+	    break;
+	case 'p':             /* Poison memory as it comes and goes */
+	    flags = ALLOC_POISON;
+	    break;
+	case 'h':
+	default:
+	    usage();
+	}
+    }
+
+    printf("%ld commands%s\n", num_cmds, flags ? ", poisoned" : "");
+    printf("%-14s %12s %10s %10s\n", "allocator", "mallocs/cmd", "mean", "p99");
+    run("malloc", 0);
+    run("arena+objpool", 1);
+    exit(0);
+}
+
+/*
+ * run - Replay num_cmds commands with malloc, or with an arena and an
+ *     object pool, and print the results
+ */
+void run(char *name, int use_arena)
+{
+    arena_t arena;
+    objpool_t jobpool;
+    struct job_t *live[MAXLIVE];
+    struct timespec start, end;
+    char *line, *copy, *tok, *save, **argv, *out;
+    long i, total = 0;
+    int argc, k, nlive = 0, nextjid = 1;
+
+    Arena_init(&arena, 4096, flags);
+    Objpool_init(&jobpool, sizeof(struct job_t), 16, flags);
+    mallocs = 0;
+
+    for (i = 0; i < num_cmds; i++) {
+	line = cmdlines[i % NCMDLINES];
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* Parse the command line into argv */
+	if (use_arena) {
+	    copy = Arena_strdup(&arena, line);
+	    argv = Arena_alloc(&arena, MAXARGS * sizeof(char *));
+	}
+	else {
+	    copy = strdup(line);
+	    argv = Malloc(MAXARGS * sizeof(char *));
+	    mallocs += 2;
+	}
+	argc = 0;
+	for (tok = strtok_r(copy, " ", &save); tok && argc < MAXARGS - 1;
+	     tok = strtok_r(NULL, " ", &save)) {
+	    if (use_arena)
+		argv[argc++] = Arena_strdup(&arena, tok);
+	    else {
+		argv[argc++] = strdup(tok);
+		mallocs++;
+	    }
+	}
+	argv[argc] = NULL;
+
+	/* Start a job, reaping the oldest one if there are too many */
+	if (argv[0][0] == '.' || argv[0][0] == '/') {
+	    if (nlive == MAXLIVE) {
+		if (use_arena)
+		    Objpool_free(&jobpool, live[0]);
+		else
+		    Free(live[0]);
+		memmove(live, live + 1, (MAXLIVE - 1) * sizeof(live[0]));
+		nlive--;
+	    }
+	    if (use_arena)
+		live[nlive] = Objpool_alloc(&jobpool);
+	    else {
+		live[nlive] = Malloc(sizeof(struct job_t));
+		mallocs++;
+	    }
+	    live[nlive]->pid = 1000 + i;
+	    live[nlive]->jid = nextjid++;
+	    strcpy(live[nlive]->cmdline, line);
+	    nlive++;
+	}
+
+	/* Compose a message */
+	if (use_arena)
+	    out = Arena_alloc(&arena, OUTBUF);
+	else {
+	    out = Malloc(OUTBUF);
+	    mallocs++;
+	}
+	snprintf(out, OUTBUF, "[%d] (%d) %s\n", nextjid, 1000 + (int)i, line);
+
+	/* Done with the command */
+	if (use_arena)
+	    Arena_reset(&arena);
+	else {
+	    for (k = 0; k < argc; k++)
+		Free(argv[k]);
+	    Free(argv);
+	    Free(copy);
+	    Free(out);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	samples[i] = (end.tv_sec - start.tv_sec) * 1000000000L +
+	    (end.tv_nsec - start.tv_nsec);
+	total += samples[i];
+    }
+
+    qsort(samples, num_cmds, sizeof(long), cmplong);
+    if (use_arena)
+	mallocs = arena.chunk_allocs + jobpool.slab_allocs;
+    printf("%-14s %12.3f %8.1fns %8ldns\n", name, (double)mallocs / num_cmds,
+	   (double)total / num_cmds, samples[(num_cmds * 99) / 100]);
+    if (use_arena) {
+	Arena_stats(&arena, stdout);
+	Objpool_stats(&jobpool, stdout);
+    }
+
+    for (k = 0; k < nlive; k++) {
+	if (use_arena)
+	    Objpool_free(&jobpool, live[k]);
+	else
+	    Free(live[k]);
+    }
+    Arena_destroy(&arena);
+    Objpool_destroy(&jobpool);
+}
+
+/*
+ * cmplong - Compare two longs for qsort
+ */
+int cmplong(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * usage - Print help message and terminate
+ */
+void usage(void)
+{
+    printf("Usage: allocbench [-hp] [-n <commands>]\n");
+    printf("Compares malloc with the csapp arena and object pool on the\n");
+    printf("allocations that a shell makes per command.\n");
+    printf("Options:\n");
+    printf("  -h            Print this message\n");
+    printf("  -n <cmds>     Commands to replay (default 200000)\n");
+    printf("  -p            Poison memory as it is allocated and freed\n");
+    exit(1);
+}
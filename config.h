@@ -39,12 +39,19 @@
   "trace21.txt",\
   "trace22.txt",\
   "trace23.txt",\
-  "trace24.txt"
+  "trace24.txt",\
+  "trace25.txt",\
+  "trace26.txt",\
+  "trace27.txt",\
+  "trace28.txt",\
+  "trace29.txt",\
+  "trace30.txt",\
+  "trace31.txt"
 
 /* Various constants */
 #define ITERS 3
 #define MAXBUF 1024
 #define MAXARGS 1024
-#define MAXTRACES 128
 #define PROMPT "tsh> "
+#define PROMPT2 "> "          /* for the rest of a command */
 
@@ -462,6 +462,201 @@ void Free(void *ptr)
     free(ptr);
 }
 
+/****************************************************************
+ * Arena and object pool allocators, for the short-lived objects
+ * of one command or one trace. An arena hands out memory by bumping
+ * a pointer and takes it all back at once with Arena_reset; it keeps
+ * its chunks for reuse, so a steady state makes no calls to malloc.
+ * An object pool hands out objects of one size from a free list.
+ * With ALLOC_POISON, both fill memory with 0xcd when they hand it
+ * out and with 0xdd when it comes back, and the pool checks that a
+ * free object is still all 0xdd before handing it out again.
+ ****************************************************************/
+#define ALLOC_ALIGN 16
+#define ALLOC_ROUND(n) (((n) + ALLOC_ALIGN - 1) & ~(size_t)(ALLOC_ALIGN - 1))
+#define CHUNK_HDR ALLOC_ROUND(sizeof(arena_chunk_t))
+
+/* $begin arena */
+void Arena_init(arena_t *a, size_t chunk_size, int flags)
+{
+    memset(a, 0, sizeof(arena_t));
+    a->chunk_size = chunk_size;
+    a->flags = flags;
+}
+
+void *Arena_alloc(arena_t *a, size_t size)
+{
+    arena_chunk_t *c, **cp;
+    char *p;
+
+    size = ALLOC_ROUND(size ? size : 1);
+    if (a->next == NULL || (size_t)(a->end - a->next) < size) {
+	/* Reuse a spare chunk that is big enough, or make a new one */
+	for (cp = &a->spare; *cp && (*cp)->size < size; cp = &(*cp)->next)
+	    ;
+	if ((c = *cp) != NULL)
+	    *cp = c->next;
+	else {
+	    c = Malloc(CHUNK_HDR + (size > a->chunk_size ? size : a->chunk_size));
+	    c->size = size > a->chunk_size ? size : a->chunk_size;
+	    a->chunk_allocs++;
+	}
+	c->next = a->chunks;
+	a->chunks = c;
+	a->next = (char *)c + CHUNK_HDR;
+	a->end = a->next + c->size;
+    }
+    p = a->next;
+    a->next += size;
+    a->allocs++;
+    a->used += size;
+    if (a->used > a->peak)
+	a->peak = a->used;
+    if (a->flags & ALLOC_POISON)
+	memset(p, 0xcd, size);
+    return p;
+}
+
+char *Arena_strdup(arena_t *a, const char *s)
+{
+    size_t n = strlen(s) + 1;
+
+    return memcpy(Arena_alloc(a, n), s, n);
+}
+
+/* Take back everything allocated since the last reset */
+void Arena_reset(arena_t *a)
+{
+    arena_chunk_t *c, *next;
+
+    for (c = a->chunks; c; c = next) {
+	next = c->next;
+	if (a->flags & ALLOC_POISON)
+	    memset((char *)c + CHUNK_HDR, 0xdd, c->size);
+	c->next = a->spare;
+	a->spare = c;
+    }
+    a->chunks = NULL;
+    a->next = a->end = NULL;
+    a->used = 0;
+    a->resets++;
+}
+
+void Arena_destroy(arena_t *a)
+{
+    arena_chunk_t *c, *next;
+
+    Arena_reset(a);
+    for (c = a->spare; c; c = next) {
+	next = c->next;
+	Free(c);
+    }
+    a->spare = NULL;
+}
+
+void Arena_stats(arena_t *a, FILE *fp)
+{
+    fprintf(fp, "arena: %ld allocs, %ld resets, %zu bytes in use, "
+	    "%zu peak, %ld mallocs\n", a->allocs, a->resets, a->used,
+	    a->peak, a->chunk_allocs);
+}
+/* $end arena */
+
+/*
+ * Objects are taken from the free list only by the thread that owns
+ * the pool, but Objpool_free pushes onto it with a compare-and-swap,
+ * so objects may be freed from a signal handler (or another thread)
+ * while the owner is in Objpool_alloc. A free object can't be
+ * allocated again while the owner is popping it, so there is no ABA.
+ */
+/* $begin objpool */
+static void objpool_push(objpool_t *op, void *obj)
+{
+    void *head = atomic_load(&op->free);
+
+    do
+	*(void **)obj = head;
+    while (!atomic_compare_exchange_weak(&op->free, &head, obj));
+}
+
+void Objpool_init(objpool_t *op, size_t size, int per_slab, int flags)
+{
+    memset(op, 0, sizeof(objpool_t));
+    atomic_init(&op->free, NULL);
+    atomic_init(&op->frees, 0);
+    op->size = ALLOC_ROUND(size < sizeof(void *) ? sizeof(void *) : size);
+    op->per_slab = per_slab > 0 ? per_slab : 1;
+    op->flags = flags;
+}
+
+void *Objpool_alloc(objpool_t *op)
+{
+    void *obj, *next;
+    char *slab;
+    long inuse;
+    size_t i;
+    int k;
+
+    do {
+	if ((obj = atomic_load(&op->free)) == NULL) {
+	    /* Carve a new slab into objects; the first word links slabs */
+	    slab = Malloc(ALLOC_ALIGN + op->per_slab * op->size);
+	    if (op->flags & ALLOC_POISON)
+		memset(slab + ALLOC_ALIGN, 0xdd, op->per_slab * op->size);
+	    *(void **)slab = op->slabs;
+	    op->slabs = slab;
+	    op->slab_allocs++;
+	    for (k = op->per_slab - 1; k > 0; k--)
+		objpool_push(op, slab + ALLOC_ALIGN + k * op->size);
+	    obj = slab + ALLOC_ALIGN;
+	    break;
+	}
+	next = *(void **)obj;
+    } while (!atomic_compare_exchange_weak(&op->free, &obj, next));
+
+    if (op->flags & ALLOC_POISON) {
+	for (i = sizeof(void *); i < op->size; i++)
+	    if (((unsigned char *)obj)[i] != 0xdd)
+		app_error("Objpool_alloc error: object written after free");
+	memset(obj, 0xcd, op->size);
+    }
+    op->allocs++;
+    inuse = op->allocs - atomic_load(&op->frees);
+    if (inuse > op->peak)
+	op->peak = inuse;
+    return obj;
+}
+
+void Objpool_free(objpool_t *op, void *obj)
+{
+    if (op->flags & ALLOC_POISON)
+	memset(obj, 0xdd, op->size);
+    objpool_push(op, obj);
+    atomic_fetch_add(&op->frees, 1);
+}
+
+void Objpool_destroy(objpool_t *op)
+{
+    void *slab, *next;
+
+    for (slab = op->slabs; slab; slab = next) {
+	next = *(void **)slab;
+	Free(slab);
+    }
+    op->slabs = NULL;
+    atomic_store(&op->free, NULL);
+}
+
+void Objpool_stats(objpool_t *op, FILE *fp)
+{
+    long frees = atomic_load(&op->frees);
+
+    fprintf(fp, "objpool: %zu-byte objects, %ld allocs, %ld frees, "
+	    "%ld in use, %ld peak, %ld mallocs\n", op->size, op->allocs,
+	    frees, op->allocs - frees, op->peak, op->slab_allocs);
+}
+/* $end objpool */
+
 /******************************************
  * Wrappers for the Standard I/O functions.
  ******************************************/
@@ -720,6 +915,476 @@ void V(sem_t *sem)
 	unix_error("V error");
 }
 
+/******************************************************************
+ * The mpmc package - a bounded lock-free queue for any number of
+ * producer and consumer threads (after D. Vyukov). Each cell carries
+ * a sequence number that tells a producer whether the cell is free on
+ * the current lap of the ring, and a consumer whether it is full, so
+ * a push or pop is one compare-and-swap on the tail or head.
+ ******************************************************************/
+
+/*
+ * mpmc_init - Create an empty queue with room for size items, which
+ *     must be a power of 2. Returns 0 if OK, -1 on error.
+ */
+/* $begin mpmc_init */
+int mpmc_init(mpmc_t *q, size_t size)
+{
+    size_t i;
+
+    if (size < 2 || (size & (size - 1))) {
+	errno = EINVAL;
+	return -1;
+    }
+    if ((q->cells = malloc(size * sizeof(mpmc_cell_t))) == NULL)
+	return -1;
+    for (i = 0; i < size; i++)
+	atomic_init(&q->cells[i].seq, i);
+    q->mask = size - 1;
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->head, 0);
+    return 0;
+}
+/* $end mpmc_init */
+
+/*
+ * mpmc_push - Add item to the tail of the queue. Returns 1 if OK, or
+ *     0 if the queue is full.
+ */
+/* $begin mpmc_push */
+int mpmc_push(mpmc_t *q, void *item)
+{
+    mpmc_cell_t *cell;
+    size_t pos, seq;
+    intptr_t dif;
+
+    pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    for (;;) {
+	cell = &q->cells[pos & q->mask];
+	seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+	dif = (intptr_t)seq - (intptr_t)pos;
+	if (dif == 0) {        /* Free on this lap: try to claim it */
+	    if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+		    memory_order_relaxed, memory_order_relaxed))
+		break;
+	}
+	else if (dif < 0)      /* Still full from the last lap */
+	    return 0;
+	else                   /* Another producer got it first */
+	    pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    }
+    cell->item = item;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+    return 1;
+}
+/* $end mpmc_push */
+
+/*
+ * mpmc_pop - Remove the item at the head of the queue into *itemp.
+ *     Returns 1 if OK, or 0 if the queue is empty.
+ */
+/* $begin mpmc_pop */
+int mpmc_pop(mpmc_t *q, void **itemp)
+{
+    mpmc_cell_t *cell;
+    size_t pos, seq;
+    intptr_t dif;
+
+    pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    for (;;) {
+	cell = &q->cells[pos & q->mask];
+	seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+	dif = (intptr_t)seq - (intptr_t)(pos + 1);
+	if (dif == 0) {        /* Full on this lap: try to claim it */
+	    if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,
+		    memory_order_relaxed, memory_order_relaxed))
+		break;
+	}
+	else if (dif < 0)      /* Not pushed yet */
+	    return 0;
+	else                   /* Another consumer got it first */
+	    pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    }
+    *itemp = cell->item;
+    atomic_store_explicit(&cell->seq, pos + q->mask + 1, memory_order_release);
+    return 1;
+}
+/* $end mpmc_pop */
+
+/*
+ * mpmc_deinit - Free the queue's storage
+ */
+void mpmc_deinit(mpmc_t *q)
+{
+    free(q->cells);
+    q->cells = NULL;
+}
+
+/******************************************************************
+ * The thread pool package. Each worker has its own deque of tasks
+ * (after Chase and Lev): it pushes and pops at the bottom without
+ * locking, while idle workers steal from the top. Tasks submitted
+ * from outside the pool go through a shared mpmc queue. Workers with
+ * nothing to run or steal sleep on a condition variable.
+ ******************************************************************/
+#define POOL_DEQUE_SIZE 1024   /* Tasks per worker deque (power of 2) */
+#define POOL_QUEUE_SIZE 4096   /* Tasks submitted from outside the pool */
+
+/* A task, which is also its own future */
+struct pool_task {
+    void *(*fn)(void *);
+    void *arg;
+    void (*done)(void *result, void *cbarg);
+    void *cbarg;
+    void *result;
+    pool_t *pool;
+    int future;                /* Freed by future_get, not by the worker */
+    atomic_int finished;
+    sem_t sem;                 /* Posted when the task has finished */
+};
+
+/* A worker's deque: the owner works the bottom, thieves take the top */
+typedef struct {
+    atomic_long top;
+    char pad0[CACHE_LINE];
+    atomic_long bottom;
+    char pad1[CACHE_LINE];
+    _Atomic(struct pool_task *) tasks[POOL_DEQUE_SIZE];
+} pool_deque_t;
+
+typedef struct {
+    pool_deque_t deque;
+    pool_t *pool;
+    pthread_t tid;
+    unsigned int seed;         /* For picking victims to steal from */
+} pool_worker_t;
+
+struct pool {
+    int nthreads;
+    pool_worker_t *workers;
+    mpmc_t queue;              /* Tasks submitted from outside */
+    atomic_long pending;       /* Tasks queued but not yet taken */
+    atomic_int sleepers;       /* Workers waiting on wake */
+    atomic_int shutdown;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+};
+
+/* The worker that the calling thread is, if any */
+static __thread pool_worker_t *pool_self;
+
+/*
+ * deque_push - Push a task onto the bottom of the calling worker's own
+ *     deque. Returns 0 if the deque is full.
+ */
+static int deque_push(pool_deque_t *d, struct pool_task *t)
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long top = atomic_load_explicit(&d->top, memory_order_acquire);
+
+    if (b - top >= POOL_DEQUE_SIZE)
+	return 0;
+    atomic_store_explicit(&d->tasks[b & (POOL_DEQUE_SIZE - 1)], t,
+			  memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return 1;
+}
+
+/*
+ * deque_take - Pop the task at the bottom of the calling worker's own
+ *     deque, or return NULL if it is empty. Only the last task can be
+ *     contended, and a thief may win it.
+ */
+static struct pool_task *deque_take(pool_deque_t *d)
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    long top;
+    struct pool_task *t = NULL;
+
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    top = atomic_load_explicit(&d->top, memory_order_relaxed);
+    if (top <= b) {
+	t = atomic_load_explicit(&d->tasks[b & (POOL_DEQUE_SIZE - 1)],
+				 memory_order_relaxed);
+	if (top == b) {
+	    if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1,
+		    memory_order_seq_cst, memory_order_relaxed))
+		t = NULL;
+	    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+	}
+    }
+    else
+	atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return t;
+}
+
+/*
+ * deque_steal - Take the task at the top of another worker's deque, or
+ *     return NULL if it is empty or we lost a race for it
+ */
+static struct pool_task *deque_steal(pool_deque_t *d)
+{
+    long top = atomic_load_explicit(&d->top, memory_order_acquire);
+    long b;
+    struct pool_task *t;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if (top >= b)
+	return NULL;
+    t = atomic_load_explicit(&d->tasks[top & (POOL_DEQUE_SIZE - 1)],
+			     memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1,
+	    memory_order_seq_cst, memory_order_relaxed))
+	return NULL;
+    return t;
+}
+
+/*
+ * pool_run - Run a task, and either hand its result to whoever holds
+ *     its future, or free it
+ */
+static void pool_run(struct pool_task *t)
+{
+    void *result = t->fn(t->arg);
+
+    if (t->done)
+	t->done(result, t->cbarg);
+    if (t->future) {
+	t->result = result;
+	atomic_store_explicit(&t->finished, 1, memory_order_release);
+	V(&t->sem);
+    }
+    else
+	free(t);
+}
+
+/*
+ * pool_find - Find a task for worker w: from its own deque, then the
+ *     shared queue, then by stealing from the other workers, starting
+ *     at a random one. Returns NULL if there is none.
+ */
+static struct pool_task *pool_find(pool_worker_t *w)
+{
+    pool_t *p = w->pool;
+    struct pool_task *t;
+    void *item;
+    int i, victim;
+
+    if ((t = deque_take(&w->deque)) == NULL) {
+	if (mpmc_pop(&p->queue, &item))
+	    t = item;
+	else {
+	    victim = rand_r(&w->seed) % p->nthreads;
+	    for (i = 0; i < p->nthreads && !t; i++, victim++) {
+		if (&p->workers[victim % p->nthreads] != w)
+		    t = deque_steal(&p->workers[victim % p->nthreads].deque);
+	    }
+	}
+    }
+    if (t)
+	atomic_fetch_sub(&p->pending, 1);
+    return t;
+}
+
+/*
+ * pool_worker - The thread routine of each worker. On shutdown, it
+ *     keeps going until there are no tasks left to run.
+ */
+static void *pool_worker(void *vargp)
+{
+    pool_worker_t *w = vargp;
+    pool_t *p = w->pool;
+    struct pool_task *t;
+
+    pool_self = w;
+    for (;;) {
+	if ((t = pool_find(w)) != NULL) {
+	    pool_run(t);
+	    continue;
+	}
+	pthread_mutex_lock(&p->lock);
+	atomic_fetch_add(&p->sleepers, 1);
+	while (atomic_load(&p->pending) == 0 && !atomic_load(&p->shutdown))
+	    pthread_cond_wait(&p->wake, &p->lock);
+	atomic_fetch_sub(&p->sleepers, 1);
+	pthread_mutex_unlock(&p->lock);
+	if (atomic_load(&p->pending) == 0 && atomic_load(&p->shutdown))
+	    break;
+    }
+    return NULL;
+}
+
+/*
+ * pool_push - Queue a task: on the calling worker's own deque if it is
+ *     one of ours, else on the shared queue. If both are full, the
+ *     caller runs the task itself, which holds back a runaway producer.
+ */
+static void pool_push(pool_t *p, struct pool_task *t)
+{
+    pool_worker_t *w = pool_self;
+
+    atomic_fetch_add(&p->pending, 1);
+    if (!(w && w->pool == p && deque_push(&w->deque, t)) &&
+	!mpmc_push(&p->queue, t)) {
+	atomic_fetch_sub(&p->pending, 1);
+	pool_run(t);
+	return;
+    }
+    if (atomic_load(&p->sleepers) > 0) {
+	pthread_mutex_lock(&p->lock);
+	pthread_cond_signal(&p->wake);
+	pthread_mutex_unlock(&p->lock);
+    }
+}
+
+/*
+ * pool_create - Start a pool of nthreads workers. Returns NULL on
+ *     error.
+ */
+/* $begin pool_create */
+pool_t *pool_create(int nthreads)
+{
+    pool_t *p;
+    int i;
+
+    if (nthreads < 1) {
+	errno = EINVAL;
+	return NULL;
+    }
+    if ((p = calloc(1, sizeof(pool_t))) == NULL)
+	return NULL;
+    if ((p->workers = calloc(nthreads, sizeof(pool_worker_t))) == NULL ||
+	mpmc_init(&p->queue, POOL_QUEUE_SIZE) < 0) {
+	free(p->workers);
+	free(p);
+	return NULL;
+    }
+    p->nthreads = nthreads;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wake, NULL);
+    for (i = 0; i < nthreads; i++) {
+	p->workers[i].pool = p;
+	p->workers[i].seed = i + 1;
+    }
+    for (i = 0; i < nthreads; i++) {
+	if ((errno = pthread_create(&p->workers[i].tid, NULL, pool_worker,
+				    &p->workers[i])) != 0) {
+	    p->nthreads = i;
+	    pool_destroy(p);
+	    return NULL;
+	}
+    }
+    return p;
+}
+/* $end pool_create */
+
+/*
+ * pool_submit - Run fn(arg) on the pool. Returns a future for its
+ *     result, which the caller must collect with future_get.
+ */
+future_t *pool_submit(pool_t *p, void *(*fn)(void *), void *arg)
+{
+    struct pool_task *t = Malloc(sizeof(struct pool_task));
+
+    t->fn = fn;
+    t->arg = arg;
+    t->done = NULL;
+    t->cbarg = NULL;
+    t->pool = p;
+    t->future = 1;
+    atomic_init(&t->finished, 0);
+    Sem_init(&t->sem, 0, 0);
+    pool_push(p, t);
+    return t;
+}
+
+/*
+ * pool_submit_cb - Run fn(arg) on the pool, then done(result, cbarg)
+ *     on the same thread, unless done is NULL
+ */
+void pool_submit_cb(pool_t *p, void *(*fn)(void *), void *arg,
+		    void (*done)(void *result, void *cbarg), void *cbarg)
+{
+    struct pool_task *t = Malloc(sizeof(struct pool_task));
+
+    t->fn = fn;
+    t->arg = arg;
+    t->done = done;
+    t->cbarg = cbarg;
+    t->pool = p;
+    t->future = 0;
+    pool_push(p, t);
+}
+
+/*
+ * future_get - Wait for a task to finish and return its result. A
+ *     worker of the task's pool runs other tasks while it waits, so
+ *     that tasks can wait on the tasks they submit.
+ */
+void *future_get(future_t *f)
+{
+    pool_worker_t *w = pool_self;
+    struct pool_task *t;
+    void *result;
+
+    if (w && w->pool == f->pool) {
+	while (!atomic_load_explicit(&f->finished, memory_order_acquire)) {
+	    if ((t = pool_find(w)) != NULL)
+		pool_run(t);
+	    else
+		sched_yield();
+	}
+    }
+    P(&f->sem);
+    result = f->result;
+    sem_destroy(&f->sem);
+    free(f);
+    return result;
+}
+
+/*
+ * pool_destroy - Shut the pool down once it has run every task it
+ *     was given, and free it. Tasks may not be submitted from outside
+ *     the pool after this is called.
+ */
+void pool_destroy(pool_t *p)
+{
+    int i;
+
+    pthread_mutex_lock(&p->lock);
+    atomic_store(&p->shutdown, 1);
+    pthread_cond_broadcast(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+    for (i = 0; i < p->nthreads; i++)
+	pthread_join(p->workers[i].tid, NULL);
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->wake);
+    mpmc_deinit(&p->queue);
+    free(p->workers);
+    free(p);
+}
+
+/*****************************************************
+ * Wrappers for the mpmc and thread pool packages
+ *****************************************************/
+void Mpmc_init(mpmc_t *q, size_t size)
+{
+    if (mpmc_init(q, size) < 0)
+	unix_error("Mpmc_init error");
+}
+
+pool_t *Pool_create(int nthreads)
+{
+    pool_t *p;
+
+    if ((p = pool_create(nthreads)) == NULL)
+	unix_error("Pool_create error");
+    return p;
+}
+
 /****************************************
  * The Rio package - Robust I/O functions
  ****************************************/
@@ -821,6 +1486,9 @@ void rio_readinitb(rio_t *rp, int fd)
     rp->rio_fd = fd;  
     rp->rio_cnt = 0;  
     rp->rio_bufptr = rp->rio_buf;
+    rp->rio_line = NULL;
+    rp->rio_linelen = rp->rio_linecap = 0;
+    rp->rio_linedone = 0;
 }
 /* $end rio_readinitb */
 
@@ -875,6 +1543,99 @@ ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
 }
 /* $end rio_readlineb */
 
+/*
+ * rio_readinitb_nonblock - Like rio_readinitb, but also put fd in
+ *     nonblocking mode, for use with rio_readlineb_nonblock from an
+ *     event loop. Returns 0 if OK, -1 on error.
+ */
+/* $begin rio_readinitb_nonblock */
+int rio_readinitb_nonblock(rio_t *rp, int fd)
+{
+    int flags;
+
+    rio_readinitb(rp, fd);
+    if ((flags = fcntl(fd, F_GETFL)) < 0 ||
+	fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+	return -1;
+    return 0;
+}
+/* $end rio_readinitb_nonblock */
+
+/*
+ * rio_readlineb_nonblock - Read a text line without blocking. Returns
+ *     its length and points *linep at it, null-terminated, in a buffer
+ *     that is good until the next call; the line ends with a newline
+ *     unless it was cut short by EOF. Returns 0 on EOF, or -1 with
+ *     errno set to EAGAIN if the descriptor has no more to give before
+ *     the line is complete. What was read of the line so far is kept,
+ *     so the next call, on the next readiness event, carries on where
+ *     this one left off. Lines may be of any length.
+ */
+/* $begin rio_readlineb_nonblock */
+ssize_t rio_readlineb_nonblock(rio_t *rp, char **linep)
+{
+    char *nl, *line;
+    size_t n, cap;
+
+    if (rp->rio_linedone) {    /* Start a new line */
+	rp->rio_linelen = 0;
+	rp->rio_linedone = 0;
+    }
+
+    for (;;) {
+	/* Move all of the line, or all we have of it, out of the buffer */
+	if (rp->rio_cnt > 0) {
+	    nl = memchr(rp->rio_bufptr, '\n', rp->rio_cnt);
+	    n = nl ? nl - rp->rio_bufptr + 1 : rp->rio_cnt;
+	    if (rp->rio_linelen + n + 1 > rp->rio_linecap) {
+		cap = rp->rio_linecap ? rp->rio_linecap : 128;
+		while (cap < rp->rio_linelen + n + 1)
+		    cap *= 2;
+		if ((line = realloc(rp->rio_line, cap)) == NULL)
+		    return -1;
+		rp->rio_line = line;
+		rp->rio_linecap = cap;
+	    }
+	    memcpy(rp->rio_line + rp->rio_linelen, rp->rio_bufptr, n);
+	    rp->rio_linelen += n;
+	    rp->rio_bufptr += n;
+	    rp->rio_cnt -= n;
+	    if (nl)
+		break;
+	}
+
+	/* Refill the buffer */
+	if ((rp->rio_cnt = read(rp->rio_fd, rp->rio_buf,
+				sizeof(rp->rio_buf))) < 0) {
+	    rp->rio_cnt = 0;
+	    if (errno == EINTR)
+		continue;
+	    return -1;         /* Including EAGAIN: keep the partial line */
+	}
+	if (rp->rio_cnt == 0) {
+	    if (rp->rio_linelen == 0)
+		return 0;      /* EOF, no data read */
+	    break;             /* EOF, some data was read */
+	}
+	rp->rio_bufptr = rp->rio_buf;
+    }
+    rp->rio_line[rp->rio_linelen] = '\0';
+    rp->rio_linedone = 1;
+    *linep = rp->rio_line;
+    return rp->rio_linelen;
+}
+/* $end rio_readlineb_nonblock */
+
+/*
+ * rio_freeb - Free the line buffer of a nonblocking rio_t
+ */
+void rio_freeb(rio_t *rp)
+{
+    free(rp->rio_line);
+    rp->rio_line = NULL;
+    rp->rio_linelen = rp->rio_linecap = 0;
+}
+
 /**********************************
  * Wrappers for robust I/O routines
  **********************************/
@@ -916,6 +1677,23 @@ ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
     return rc;
 } 
 
+void Rio_readinitb_nonblock(rio_t *rp, int fd)
+{
+    if (rio_readinitb_nonblock(rp, fd) < 0)
+	unix_error("Rio_readinitb_nonblock error");
+}
+
+/* Returns -1 (with errno EAGAIN) only when it would block */
+ssize_t Rio_readlineb_nonblock(rio_t *rp, char **linep)
+{
+    ssize_t rc;
+
+    if ((rc = rio_readlineb_nonblock(rp, linep)) < 0 && errno != EAGAIN &&
+	errno != EWOULDBLOCK)
+	unix_error("Rio_readlineb_nonblock error");
+    return rc;
+}
+
 /******************************** 
  * Client/server helper functions
  ********************************/
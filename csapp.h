@@ -24,6 +24,7 @@
 #include <math.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <stdatomic.h>
 #include <sys/socket.h>
 #include <netdb.h>
 #include <netinet/in.h>
@@ -47,10 +48,75 @@ typedef struct {
     int rio_fd;                /* Descriptor for this internal buf */
     int rio_cnt;               /* Unread bytes in internal buf */
     char *rio_bufptr;          /* Next unread byte in internal buf */
+    char *rio_line;            /* Line being assembled (nonblocking) */
+    size_t rio_linelen;        /* Bytes in rio_line */
+    size_t rio_linecap;        /* Size of rio_line, which grows */
+    int rio_linedone;          /* rio_line was returned to the caller */
     char rio_buf[RIO_BUFSIZE]; /* Internal buffer */
 } rio_t;
 /* $end rio_t */
 
+/* Bounded lock-free multi-producer/multi-consumer queue (mpmc) */
+/* $begin mpmc_t */
+#define CACHE_LINE 64
+typedef struct {
+    atomic_size_t seq;         /* Which lap of the ring the cell is on */
+    void *item;
+} mpmc_cell_t;
+typedef struct {
+    mpmc_cell_t *cells;        /* Ring of a power-of-2 number of cells */
+    size_t mask;               /* Number of cells minus 1 */
+    char pad0[CACHE_LINE];
+    atomic_size_t tail;        /* Next cell to push into */
+    char pad1[CACHE_LINE];
+    atomic_size_t head;        /* Next cell to pop from */
+    char pad2[CACHE_LINE];
+} mpmc_t;
+/* $end mpmc_t */
+
+/* Arena (bump) allocator, reset as a whole */
+/* $begin arena_t */
+#define ALLOC_POISON 0x1       /* Fill new and freed memory with junk */
+typedef struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;               /* Usable bytes after the header */
+} arena_chunk_t;
+typedef struct {
+    arena_chunk_t *chunks;     /* All chunks, the current one first */
+    arena_chunk_t *spare;      /* Chunks kept from before the last reset */
+    char *next;                /* Next free byte in the current chunk */
+    char *end;                 /* End of the current chunk */
+    size_t chunk_size;
+    int flags;
+    /* Statistics */
+    long allocs;               /* Since init */
+    long resets;
+    size_t used;               /* Bytes handed out since the last reset */
+    size_t peak;               /* Most bytes handed out between resets */
+    long chunk_allocs;         /* Calls to malloc */
+} arena_t;
+/* $end arena_t */
+
+/* Fixed-size object pool with a free list */
+/* $begin objpool_t */
+typedef struct {
+    void *_Atomic free;        /* Free objects, each linked to the next */
+    void *slabs;               /* Slabs of objects, for Objpool_destroy */
+    size_t size;               /* Object size, rounded up */
+    int per_slab;
+    int flags;
+    /* Statistics */
+    long allocs;
+    atomic_long frees;
+    long peak;                 /* Most objects in use at once */
+    long slab_allocs;          /* Calls to malloc */
+} objpool_t;
+/* $end objpool_t */
+
+/* Work-stealing thread pool; the types are private to csapp.c */
+typedef struct pool pool_t;
+typedef struct pool_task future_t;
+
 /* External variables */
 extern int h_errno;    /* Defined by BIND for DNS errors */ 
 extern char **environ; /* Defined by libc */
@@ -136,6 +202,19 @@ void *Realloc(void *ptr, size_t size);
 void *Calloc(size_t nmemb, size_t size);
 void Free(void *ptr);
 
+/* Arena and object pool allocators */
+void Arena_init(arena_t *a, size_t chunk_size, int flags);
+void *Arena_alloc(arena_t *a, size_t size);
+char *Arena_strdup(arena_t *a, const char *s);
+void Arena_reset(arena_t *a);
+void Arena_destroy(arena_t *a);
+void Arena_stats(arena_t *a, FILE *fp);
+void Objpool_init(objpool_t *op, size_t size, int per_slab, int flags);
+void *Objpool_alloc(objpool_t *op);
+void Objpool_free(objpool_t *op, void *obj);
+void Objpool_destroy(objpool_t *op);
+void Objpool_stats(objpool_t *op, FILE *fp);
+
 /* Sockets interface wrappers */
 int Socket(int domain, int type, int protocol);
 void Setsockopt(int s, int level, int optname, const void *optval, int optlen);
@@ -172,12 +251,33 @@ void Sem_init(sem_t *sem, int pshared, unsigned int value);
 void P(sem_t *sem);
 void V(sem_t *sem);
 
+/* Lock-free queue */
+int mpmc_init(mpmc_t *q, size_t size);
+int mpmc_push(mpmc_t *q, void *item);
+int mpmc_pop(mpmc_t *q, void **itemp);
+void mpmc_deinit(mpmc_t *q);
+
+/* Thread pool */
+pool_t *pool_create(int nthreads);
+future_t *pool_submit(pool_t *p, void *(*fn)(void *), void *arg);
+void pool_submit_cb(pool_t *p, void *(*fn)(void *), void *arg,
+		    void (*done)(void *result, void *cbarg), void *cbarg);
+void *future_get(future_t *f);
+void pool_destroy(pool_t *p);
+
+/* Wrappers for the lock-free queue and thread pool */
+void Mpmc_init(mpmc_t *q, size_t size);
+pool_t *Pool_create(int nthreads);
+
 /* Rio (Robust I/O) package */
 ssize_t rio_readn(int fd, void *usrbuf, size_t n);
 ssize_t rio_writen(int fd, void *usrbuf, size_t n);
 void rio_readinitb(rio_t *rp, int fd); 
 ssize_t	rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t	rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+int rio_readinitb_nonblock(rio_t *rp, int fd);
+ssize_t rio_readlineb_nonblock(rio_t *rp, char **linep);
+void rio_freeb(rio_t *rp);
 
 /* Wrappers for Rio package */
 ssize_t Rio_readn(int fd, void *usrbuf, size_t n);
@@ -185,6 +285,8 @@ void Rio_writen(int fd, void *usrbuf, size_t n);
 void Rio_readinitb(rio_t *rp, int fd); 
 ssize_t Rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+void Rio_readinitb_nonblock(rio_t *rp, int fd);
+ssize_t Rio_readlineb_nonblock(rio_t *rp, char **linep);
 
 /* Reentrant protocol-independent client/server helpers */
 int open_clientfd(char *hostname, char *port);
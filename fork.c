@@ -14,6 +14,7 @@
 #define CONVERT(val) (((double)val)/(double)RAND_MAX)
 
 struct timeval time;
+int seeded = 0;
 
 pid_t __real_fork(void);
 
@@ -26,11 +27,23 @@ pid_t __real_fork(void);
  * positioning technique: Given the -Wl,--wrap,fork argument, the linker
  * replaces all references to fork to __wrap_fork(), and all
  * references to __real_fork to fork().
+ *
+ * If FORK_SEED is set, the generator is seeded from it once instead,
+ * so that a given seed always yields the same sequence of delays
+ * (sdriver sets it to run several shells under the same schedule).
  */
 pid_t __wrap_fork(void)
 {
-    gettimeofday(&time, NULL);
-    srand(time.tv_usec);
+    char *seed = getenv("FORK_SEED");
+
+    if (seed == NULL) {
+	gettimeofday(&time, NULL);
+	srand(time.tv_usec);
+    }
+    else if (!seeded) {
+	srand(atoi(seed));
+	seeded = 1;
+    }
 
     unsigned bool = (unsigned)(CONVERT(rand()) + 0.5);
     unsigned secs = (unsigned)(CONVERT(rand()) * MAX_SLEEP);
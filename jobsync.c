@@ -0,0 +1,458 @@
+/*
+ * jobsync.c - Synchronization between shell jobs and the trace driver
+ *
+ * A job tells the driver that it is ready to receive signals (the
+ * driver's WAIT command) and then blocks until the driver releases
+ * it (the driver's SIGNAL command). There are two transports:
+ *
+ * Shared memory: SYNCSHM holds a descriptor for a struct jobsync_shm
+ * created by runtrace. Each job claims a slot keyed by its PID, so
+ * the driver knows which job synced and can release one job in
+ * particular. Both sides block on futexes, so a handshake costs a
+ * couple of futex wakeups instead of socket round trips.
+ *
+ * Sockets: SYNCFD holds one end of a datagram socket pair. The job
+ * sends an empty datagram and blocks in recv until the driver sends
+ * one back. This is the fallback when SYNCSHM isn't set.
+ *
+ * With shared memory the driver may also own a virtual clock. Jobs
+ * then arm their timeouts with jobsync_alarm, which records a deadline
+ * in virtual msecs instead of calling alarm, and idle in jobsync_spin
+ * instead of spinning. The driver advances the clock whenever every
+ * process is blocked and delivers SIGALRM to the jobs whose deadline
+ * has passed, so timeouts cost no wall-clock time.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "config.h"
+#include "jobsync.h"
+
+static int syncfd = -1;
+static struct jobsync_shm *shm = NULL;
+static char buf[MAXBUF];
+
+/* Maps the PIDs that jobs see to the driver's PIDs (see jobsync_pidmap) */
+static pid_t (*pidmap)(pid_t pid) = NULL;
+
+/* Driver-side bookkeeping of the arrivals it has already consumed */
+static int seen_arrivals = 0;
+static int seen_pid[JOBSYNC_SLOTS];
+static int seen[JOBSYNC_SLOTS];
+
+/*
+ * futex_wait - Sleep while *addr == val, for at most ts (NULL = forever)
+ */
+static int futex_wait(int *addr, int val, struct timespec *ts)
+{
+    return syscall(SYS_futex, addr, FUTEX_WAIT, val, ts, NULL, 0);
+}
+
+/*
+ * futex_wake - Wake every process sleeping on addr
+ */
+static int futex_wake(int *addr)
+{
+    return syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/*
+ * take - Atomically decrement *addr if it is positive.
+ *        Returns 1 if we took one, 0 if it was already zero.
+ */
+static int take(int *addr)
+{
+    int n = __atomic_load_n(addr, __ATOMIC_SEQ_CST);
+
+    while (n > 0) {
+	if (__atomic_compare_exchange_n(addr, &n, n - 1, 0,
+					__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+	    return 1;
+    }
+    return 0;
+}
+
+/*
+ * myslot - Return this job's slot, claiming a free one (or one left
+ *          behind by a job that has since died) on first use
+ */
+static struct jobsync_slot *myslot(void)
+{
+    int i, pid, old;
+    static struct jobsync_slot *slot = NULL;
+
+    if (slot && slot->pid == getpid())
+	return slot;
+
+    pid = getpid();
+    for (i = 0; i < JOBSYNC_SLOTS; i++) {
+	old = 0;
+	if (__atomic_compare_exchange_n(&shm->slot[i].pid, &old, pid, 0,
+					__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+	    return (slot = &shm->slot[i]);
+    }
+    for (i = 0; i < JOBSYNC_SLOTS; i++) {
+	old = shm->slot[i].pid;
+	if (kill(old, 0) < 0 && errno == ESRCH &&
+	    __atomic_compare_exchange_n(&shm->slot[i].pid, &old, pid, 0,
+					__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+	    shm->slot[i].arrived = 0;
+	    shm->slot[i].released = 0;
+	    shm->slot[i].deadline = 0;
+	    shm->slot[i].waiting = 0;
+	    return (slot = &shm->slot[i]);
+	}
+    }
+    fprintf(stderr, "jobsync: no free slots\n");
+    exit(1);
+}
+
+/*
+ * jobsync_init - Determine if the job is running standalone or under
+ *     the control of the driver program. If running under the driver,
+ *     attach to its shared sync region, or else get the number of its
+ *     synchronizing domain socket descriptor. Returns 1 under the
+ *     driver, 0 if standalone.
+ */
+int jobsync_init(void)
+{
+    char *str;
+    int fd;
+    struct stat stat;
+    void *p;
+
+    if ((str = getenv("SYNCSHM")) != NULL) {
+	fd = atoi(str);
+	if (fstat(fd, &stat) != -1) {
+	    p = mmap(NULL, sizeof(struct jobsync_shm), PROT_READ|PROT_WRITE,
+		     MAP_SHARED, fd, 0);
+	    if (p != MAP_FAILED) {
+		shm = p;
+		return 1;
+	    }
+	}
+    }
+
+    if ((str = getenv("SYNCFD")) != NULL) {
+	syncfd = atoi(str);              /* Get descriptor number */
+	if (fstat(syncfd, &stat) != -1)  /* Is is open? */
+	    return 1;
+    }
+    syncfd = -1;
+    return 0;
+}
+
+/*
+ * jobsync_signal - Tell the driver that we are ready
+ */
+void jobsync_signal(void)
+{
+    char *cmdp = "";
+    struct jobsync_slot *slot;
+
+    if (shm) {
+	slot = myslot();
+	__atomic_store_n(&slot->waiting, 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&slot->arrived, 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&shm->arrivals, 1, __ATOMIC_SEQ_CST);
+	futex_wake(&shm->arrivals);
+	return;
+    }
+
+    if (send(syncfd, cmdp, strlen(cmdp), 0) < 0) {
+	perror("send");
+	exit(1);
+    }
+}
+
+/*
+ * jobsync_wait - Block until the driver releases us
+ */
+void jobsync_wait(void)
+{
+    int seq;
+    struct jobsync_slot *slot;
+
+    if (shm) {
+	slot = myslot();
+	while (1) {
+	    seq = __atomic_load_n(&shm->releases, __ATOMIC_SEQ_CST);
+	    if (take(&slot->released) || take(&shm->tokens)) {
+		__atomic_store_n(&slot->waiting, 0, __ATOMIC_SEQ_CST);
+		return;
+	    }
+	    futex_wait(&shm->releases, seq, NULL);
+	}
+    }
+
+    if (recv(syncfd, buf, MAXBUF, 0) < 0) {
+	perror("recv");
+	exit(1);
+    }
+}
+
+/*
+ * jobsync_alarm - Like alarm, but on the driver's virtual clock when
+ *     it has one. Returns the secs remaining on the previous alarm.
+ */
+unsigned int jobsync_alarm(unsigned int secs)
+{
+    int left;
+    struct jobsync_slot *slot;
+
+    if (!shm || !shm->virtual)
+	return alarm(secs);
+
+    slot = myslot();
+    left = slot->deadline ? slot->deadline - shm->now : 0;
+    slot->deadline = secs ? shm->now + 1000*secs : 0;
+    return left > 0 ? (left + 999) / 1000 : 0;
+}
+
+/*
+ * jobsync_spin - Spin until a signal terminates us. On a virtual
+ *     clock, sleep instead so that the driver can advance time.
+ */
+void jobsync_spin(void)
+{
+    if (shm && shm->virtual) {
+	while (1)
+	    pause();
+    }
+    while(1);
+}
+
+/*
+ * jobsync_report - Hand a measurement (say, a latency) to the driver.
+ *     Returns 1 if OK, 0 if there is no shared region or it is full.
+ */
+int jobsync_report(int sample)
+{
+    int i;
+
+    if (!shm)
+	return 0;
+    i = __atomic_fetch_add(&shm->num_samples, 1, __ATOMIC_SEQ_CST);
+    if (i >= JOBSYNC_SAMPLES)
+	return 0;
+    shm->samples[i] = sample;
+    __atomic_store_n(&shm->sample_ready[i], 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/*
+ * jobsync_create - Create the shared sync region for our jobs.
+ *     Returns the descriptor to pass along in SYNCSHM, or -1 if
+ *     shared memory isn't available.
+ */
+int jobsync_create(void)
+{
+    int fd;
+    void *p;
+
+    if ((fd = memfd_create("jobsync", 0)) < 0)
+	return -1;
+    if (ftruncate(fd, sizeof(struct jobsync_shm)) < 0) {
+	close(fd);
+	return -1;
+    }
+    p = mmap(NULL, sizeof(struct jobsync_shm), PROT_READ|PROT_WRITE,
+	     MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+	close(fd);
+	return -1;
+    }
+    shm = p;
+    return fd;
+}
+
+/*
+ * jobsync_await - Wait msecs milliseconds for the next job to signal.
+ *     Returns the PID of the job, 0 on timeout, or -1 if a job signaled
+ *     but another job took over its slot before we looked, so we can't
+ *     tell which job it was.
+ */
+pid_t jobsync_await(int msecs)
+{
+    int i, n;
+    struct timespec now, deadline, ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += msecs / 1000;
+    deadline.tv_nsec += (msecs % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+	deadline.tv_sec++;
+	deadline.tv_nsec -= 1000000000L;
+    }
+
+    while ((n = __atomic_load_n(&shm->arrivals, __ATOMIC_SEQ_CST))
+	   == seen_arrivals) {
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ts.tv_sec = deadline.tv_sec - now.tv_sec;
+	ts.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+	if (ts.tv_nsec < 0) {
+	    ts.tv_sec--;
+	    ts.tv_nsec += 1000000000L;
+	}
+	if (ts.tv_sec < 0)
+	    return 0;
+	futex_wait(&shm->arrivals, n, &ts);
+    }
+    seen_arrivals++;
+
+    /* Find the job behind the arrival we just consumed */
+    for (i = 0; i < JOBSYNC_SLOTS; i++) {
+	if (shm->slot[i].pid != seen_pid[i]) {
+	    seen_pid[i] = shm->slot[i].pid;
+	    seen[i] = 0;
+	}
+	if (shm->slot[i].arrived > seen[i]) {
+	    seen[i]++;
+	    return shm->slot[i].pid;
+	}
+    }
+    return -1; /* A job reused a slot before we saw its arrival */
+}
+
+/*
+ * jobsync_release - Release job pid, or whichever job waits first if
+ *     pid is 0. Returns 0 if OK, -1 if pid never synced with us.
+ */
+int jobsync_release(pid_t pid)
+{
+    int i;
+
+    if (pid == 0)
+	__atomic_add_fetch(&shm->tokens, 1, __ATOMIC_SEQ_CST);
+    else {
+	for (i = 0; i < JOBSYNC_SLOTS; i++)
+	    if (shm->slot[i].pid == pid)
+		break;
+	if (i == JOBSYNC_SLOTS)
+	    return -1;
+	__atomic_add_fetch(&shm->slot[i].released, 1, __ATOMIC_SEQ_CST);
+    }
+    __atomic_add_fetch(&shm->releases, 1, __ATOMIC_SEQ_CST);
+    futex_wake(&shm->releases);
+    return 0;
+}
+
+/*
+ * jobsync_release_all - Release every job that has signaled and not
+ *     yet been released, all with a single wakeup, so that they resume
+ *     within microseconds of each other. Returns the number released.
+ */
+int jobsync_release_all(void)
+{
+    int i, n = 0;
+    struct jobsync_slot *slot;
+
+    for (i = 0; i < JOBSYNC_SLOTS; i++) {
+	slot = &shm->slot[i];
+	if (slot->pid && __atomic_load_n(&slot->waiting, __ATOMIC_SEQ_CST) &&
+	    __atomic_load_n(&slot->released, __ATOMIC_SEQ_CST) == 0) {
+	    __atomic_add_fetch(&slot->released, 1, __ATOMIC_SEQ_CST);
+	    n++;
+	}
+    }
+    __atomic_add_fetch(&shm->releases, 1, __ATOMIC_SEQ_CST);
+    futex_wake(&shm->releases);
+    return n;
+}
+
+/*
+ * jobsync_virtual - Put our jobs on a virtual clock starting at 0
+ */
+void jobsync_virtual(void)
+{
+    shm->now = 0;
+    shm->virtual = 1;
+}
+
+/*
+ * jobsync_now - Return the virtual time in msecs
+ */
+int jobsync_now(void)
+{
+    return shm->now;
+}
+
+/*
+ * jobsync_next_deadline - Return the earliest pending job alarm in
+ *     virtual msecs, or 0 if no job has an alarm set
+ */
+int jobsync_next_deadline(void)
+{
+    int i, d, next = 0;
+
+    for (i = 0; i < JOBSYNC_SLOTS; i++) {
+	d = shm->slot[i].deadline;
+	if (shm->slot[i].pid && d && (!next || d < next))
+	    next = d;
+    }
+    return next;
+}
+
+/*
+ * jobsync_advance - Move the virtual clock forward to now, and deliver
+ *     SIGALRM to every job whose alarm has gone off
+ */
+void jobsync_advance(int now)
+{
+    int i, d;
+    pid_t pid;
+
+    if (now <= shm->now)
+	return;
+    shm->now = now;
+    for (i = 0; i < JOBSYNC_SLOTS; i++) {
+	d = shm->slot[i].deadline;
+	if (shm->slot[i].pid && d && d <= now) {
+	    shm->slot[i].deadline = 0;
+	    pid = pidmap ? pidmap(shm->slot[i].pid) : shm->slot[i].pid;
+	    if (pid > 0)
+		kill(pid, SIGALRM);
+	}
+    }
+}
+
+/*
+ * jobsync_pidmap - Install a function that maps the PID a job sees for
+ *     itself to the driver's PID for it, for jobs in a PID namespace
+ */
+void jobsync_pidmap(pid_t (*map)(pid_t pid))
+{
+    pidmap = map;
+}
+
+/*
+ * jobsync_samples - Point *samples at the measurements that jobs have
+ *     reported so far and return how many there are. A job claims its
+ *     slot before it writes the sample, so only the leading slots that
+ *     are marked ready count.
+ */
+int jobsync_samples(int **samples)
+{
+    int i, n = __atomic_load_n(&shm->num_samples, __ATOMIC_SEQ_CST);
+
+    if (n > JOBSYNC_SAMPLES)
+	n = JOBSYNC_SAMPLES;
+    for (i = 0; i < n; i++)
+	if (!__atomic_load_n(&shm->sample_ready[i], __ATOMIC_ACQUIRE))
+	    break;
+    *samples = shm->samples;
+    return i;
+}
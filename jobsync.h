@@ -0,0 +1,60 @@
+/*
+ * jobsync.h - Synchronization between shell jobs and the trace driver
+ */
+#ifndef __JOBSYNC_H__
+#define __JOBSYNC_H__
+
+#include <sys/types.h>
+
+/* Number of jobs that can be synchronizing at any point in time */
+#define JOBSYNC_SLOTS 64
+
+/* Number of measurements that jobs can report in one run */
+#define JOBSYNC_SAMPLES 4096
+
+/* Per-job state in the shared region */
+struct jobsync_slot {
+    int pid;                    /* Job PID, 0 if the slot is free */
+    int arrived;                /* Number of times the job has signaled */
+    int released;               /* Releases addressed to this job */
+    int deadline;               /* Virtual msecs of the job's alarm, or 0 */
+    int waiting;                /* True from the job's signal to its release */
+};
+
+/*
+ * The region that runtrace shares with its jobs through the SYNCSHM
+ * descriptor. The arrivals and releases words double as futexes.
+ */
+struct jobsync_shm {
+    int arrivals;               /* Total signals from all jobs */
+    int releases;               /* Bumped every time the driver releases */
+    int tokens;                 /* Releases for whichever job waits first */
+    int virtual;                /* True if the driver owns the clock */
+    int now;                    /* Virtual time in msecs */
+    struct jobsync_slot slot[JOBSYNC_SLOTS];
+    int num_samples;            /* Measurements reported by jobs */
+    int samples[JOBSYNC_SAMPLES];
+    int sample_ready[JOBSYNC_SAMPLES]; /* Set once samples[i] is written */
+};
+
+/* Job side */
+int jobsync_init(void);
+void jobsync_signal(void);
+void jobsync_wait(void);
+unsigned int jobsync_alarm(unsigned int secs);
+void jobsync_spin(void);
+int jobsync_report(int sample);
+
+/* Driver side */
+int jobsync_create(void);
+pid_t jobsync_await(int msecs);
+int jobsync_release(pid_t pid);
+int jobsync_release_all(void);
+void jobsync_virtual(void);
+int jobsync_now(void);
+int jobsync_next_deadline(void);
+void jobsync_advance(int now);
+void jobsync_pidmap(pid_t (*map)(pid_t pid));
+int jobsync_samples(int **samples);
+
+#endif /* __JOBSYNC_H__ */
@@ -0,0 +1,712 @@
+/*
+ * loadgen.c - Shell lab load generator
+ *
+ * Runs a trace, or a mix of traces, against many shells at once from
+ * a single process. Each session is a shell with its own datagram
+ * socket pair for commands and output and its own socket pair for
+ * job syncs (jobs sync over SYNCFD, as under "runtrace -S"), and a
+ * small interpreter that steps through its trace the way runtrace
+ * does. One epoll loop waits on all of them, along with a signalfd
+ * for SIGCHLD, so a thousand sessions cost a thousand shells but only
+ * one driver.
+ *
+ * Session i runs the i-th trace given with -f, round robin, and runs
+ * it -i times, each time in a new shell. A command's latency runs from
+ * the time it is sent to the time the next prompt comes back, so for a
+ * foreground job it includes the job. At the end comes the aggregate
+ * rate of commands and the latency percentiles over all commands and
+ * over the sessions' own medians and 99th percentiles.
+ *
+ * Since jobs sync over sockets, the driver can't tell them apart:
+ * traces may "SIGNAL" or "SIGNAL all" but not "SIGNAL <pid>" or
+ * "SIGNAL @k", and SETTLE isn't supported. DELAY is honored unless -F.
+ *
+ * Usage: ./loadgen [-hFv] [-s <shell>] -f <trace> [-f <trace> ...]
+ *                  [-n <sessions>] [-i <iters>] [-t <secs>]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <dirent.h>
+
+#include "config.h"
+
+extern char **environ;
+
+#define MAXTRACES 64
+#define MAXSESSIONS 4096
+#define MAXEVENTS 256
+
+/* A trace, read into memory once */
+struct trace_t {
+    char *name;
+    char **lines;
+    int num_lines;
+};
+
+/* What a session is waiting for */
+enum { S_NEXT, S_WAIT, S_DELAY, S_RUN, S_EXIT, S_DONE };
+static char *waiting_for[] = {"prompt", "sync", "delay", "", "exit", ""};
+
+struct session_t {
+    struct trace_t *trace;
+    int iter;                  /* Runs of the trace so far */
+    pid_t pid;                 /* The shell */
+    int datafd;                /* Our ends of the socket pairs */
+    int syncfd;
+    int state;
+    int pc;                    /* Next trace line */
+    int prompts;               /* Prompts that no NEXT has taken yet */
+    int syncs;                 /* Syncs that no WAIT has taken yet */
+    int want;                  /* Syncs that the WAIT is waiting for */
+    int waiting;               /* Jobs that synced but weren't released */
+    double deadline;           /* For the wait, or the end of the DELAY */
+    double sent;               /* When the command being timed went out */
+    int timing;                /* True while a command waits for a prompt */
+    int failed;
+    int *lat;                  /* Latency of each command, in usecs */
+    int num_lat, max_lat;
+};
+
+/* Modified by command line args */
+char *shellprog = "./tsh";
+struct trace_t traces[MAXTRACES];
+int num_traces = 0;
+int num_sessions = 10;
+int iters = 1;
+int timeout = DRIVER_TIMEOUT;
+int fast = 0;
+int verbose = 0;
+
+struct session_t *sessions;
+int epfd, sigfd;
+int active = 0;                /* Sessions that haven't finished */
+sigset_t chldmask;
+
+/* Prototypes */
+void usage(void);
+void load_trace(struct trace_t *t, char *name);
+void start_session(struct session_t *s);
+void step(struct session_t *s);
+void on_data(struct session_t *s);
+void on_sync(struct session_t *s);
+void reap(void);
+void end_session(struct session_t *s);
+void fail(struct session_t *s, char *msg);
+void check_deadlines(double t);
+int next_timeout(double t);
+void release(struct session_t *s, int n);
+void add_latency(struct session_t *s, int usecs);
+void report(double secs);
+void percentiles(char *what, int *a, int n);
+void kill_strays(void);
+int cmpint(const void *a, const void *b);
+double now(void);
+
+int main(int argc, char **argv)
+{
+    int c, i, n;
+    double start;
+    struct epoll_event events[MAXEVENTS];
+    struct rlimit rl;
+
+    while ((c = getopt(argc, argv, "hFvs:f:n:i:t:")) != EOF) {
+	switch (c) {
+	case 's':             /* The shell to load (default ./tsh) */
+	    shellprog = optarg;
+	    break;
+	case 'f':             /* A trace in the mix */
+	    if (num_traces == MAXTRACES) {
+		printf("loadgen: at most %d traces\n", MAXTRACES);
+		exit(1);
+	    }
+	    load_trace(&traces[num_traces++], optarg);
+	    break;
+	case 'n':             /* Concurrent sessions */
+	    num_sessions = atoi(optarg);
+	    if (num_sessions < 1 || num_sessions > MAXSESSIONS) {
+		printf("loadgen: -n must be between 1 and %d\n", MAXSESSIONS);
+		exit(1);
+	    }
+	    break;
+	case 'i':             /* Runs of the trace per session */
+	    iters = atoi(optarg);
+	    if (iters < 1)
+		usage();
+	    break;
+	case 't':             /* Timeout in secs (default DRIVER_TIMEOUT) */
+	    timeout = atoi(optarg);
+	    break;
+	case 'F':             /* Skip DELAY directives */
+	    fast = 1;
+	    break;
+	case 'v':             /* A line per session at the end */
+	    verbose = 1;
+	    break;
+	case 'h':
+	default:
+	    usage();
+	}
+    }
+    if (num_traces == 0)
+	usage();
+
+    /* Two sockets per session, and the shells' own descriptors */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+	rl.rlim_cur = rl.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    /* Orphaned jobs come to us, so that we can clean them up */
+    prctl(PR_SET_CHILD_SUBREAPER, 1);
+    sigemptyset(&chldmask);
+    sigaddset(&chldmask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chldmask, NULL);
+    if ((sigfd = signalfd(-1, &chldmask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0) {
+	perror("signalfd");
+	exit(1);
+    }
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+	perror("epoll_create1");
+	exit(1);
+    }
+    events[0].events = EPOLLIN;
+    events[0].data.u64 = (uint64_t)-1;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sigfd, &events[0]) < 0) {
+	perror("epoll_ctl");
+	exit(1);
+    }
+
+    if ((sessions = calloc(num_sessions, sizeof(struct session_t))) == NULL) {
+	perror("calloc");
+	exit(1);
+    }
+    printf("%s, %d sessions x %d runs of %d trace%s\n", shellprog,
+	   num_sessions, iters, num_traces, num_traces > 1 ? "s" : "");
+    fflush(stdout);
+
+    start = now();
+    for (i = 0; i < num_sessions; i++) {
+	sessions[i].trace = &traces[i % num_traces];
+	start_session(&sessions[i]);
+	active++;
+    }
+
+    while (active > 0) {
+	if ((n = epoll_wait(epfd, events, MAXEVENTS, next_timeout(now()))) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    perror("epoll_wait");
+	    exit(1);
+	}
+	for (i = 0; i < n; i++) {
+	    uint64_t u = events[i].data.u64;
+
+	    if (u == (uint64_t)-1)
+		reap();
+	    else if (u & 1)
+		on_sync(&sessions[u >> 1]);
+	    else
+		on_data(&sessions[u >> 1]);
+	}
+	check_deadlines(now());
+	for (i = 0; i < num_sessions; i++)
+	    if (sessions[i].state == S_RUN)
+		step(&sessions[i]);
+    }
+
+    report(now() - start);
+    kill_strays();
+    for (i = 0; i < num_sessions; i++)
+	if (sessions[i].failed)
+	    exit(1);
+    exit(0);
+}
+
+/*
+ * load_trace - Read a trace into memory, and reject the directives
+ *     that we can't carry out with socket sync
+ */
+void load_trace(struct trace_t *t, char *name)
+{
+    FILE *fp;
+    char line[MAXBUF], word[MAXBUF], arg[MAXBUF];
+    int max = 0, lineno = 0;
+
+    if ((fp = fopen(name, "r")) == NULL) {
+	perror(name);
+	exit(1);
+    }
+    t->name = name;
+    t->lines = NULL;
+    t->num_lines = 0;
+    while (fgets(line, MAXBUF, fp)) {
+	lineno++;
+	line[strcspn(line, "\n")] = '\0';
+	word[0] = arg[0] = '\0';
+	if (line[0] == '#' || sscanf(line, "%s %s", word, arg) < 1)
+	    continue;
+	if (!strcmp(word, "SETTLE") ||
+	    (!strcmp(word, "SIGNAL") && arg[0] && arg[0] != '#' &&
+	     strcmp(arg, "all"))) {
+	    printf("%s:%d: loadgen can't run \"%s\" (jobs sync over sockets)\n",
+		   name, lineno, line);
+	    exit(1);
+	}
+	if (t->num_lines == max) {
+	    max = max ? 2*max : 64;
+	    if ((t->lines = realloc(t->lines, max * sizeof(char *))) == NULL) {
+		perror("realloc");
+		exit(1);
+	    }
+	}
+	t->lines[t->num_lines++] = strdup(line);
+    }
+    fclose(fp);
+}
+
+/*
+ * start_session - Start a new shell for a session, on a fresh pair of
+ *     sockets, and wait for its first prompt
+ */
+void start_session(struct session_t *s)
+{
+    int datafd[2], syncfd[2];
+    char *argv[] = {shellprog, NULL};
+    char env[64];
+    struct epoll_event ev;
+    int id = s - sessions;
+
+    if (socketpair(AF_LOCAL, SOCK_DGRAM | SOCK_CLOEXEC, 0, datafd) < 0 ||
+	socketpair(AF_LOCAL, SOCK_DGRAM | SOCK_CLOEXEC, 0, syncfd) < 0) {
+	perror("socketpair");
+	exit(1);
+    }
+    if ((s->pid = fork()) < 0) {
+	perror("fork");
+	exit(1);
+    }
+    if (s->pid == 0) {
+	sigprocmask(SIG_UNBLOCK, &chldmask, NULL);
+	prctl(PR_SET_PDEATHSIG, SIGKILL);
+	dup2(datafd[1], 0);
+	dup2(datafd[1], 1);
+	fcntl(syncfd[1], F_SETFD, 0);
+	sprintf(env, "%d", syncfd[1]);
+	setenv("SYNCFD", env, 1);
+	unsetenv("SYNCSHM");
+	execve(argv[0], argv, environ);
+	perror(argv[0]);
+	exit(1);
+    }
+    close(datafd[1]);
+    close(syncfd[1]);
+    s->datafd = datafd[0];
+    s->syncfd = syncfd[0];
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = (uint64_t)id << 1;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, s->datafd, &ev) < 0) {
+	perror("epoll_ctl");
+	exit(1);
+    }
+    ev.data.u64 = ((uint64_t)id << 1) | 1;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, s->syncfd, &ev) < 0) {
+	perror("epoll_ctl");
+	exit(1);
+    }
+
+    /* The first prompt is like a NEXT before the first line */
+    s->pc = 0;
+    s->prompts = s->syncs = s->waiting = 0;
+    s->timing = 0;
+    s->state = S_NEXT;
+    s->deadline = now() + timeout;
+}
+
+/*
+ * step - Run the session's trace until it has to wait for something
+ */
+void step(struct session_t *s)
+{
+    char *line, word[MAXBUF], arg[MAXBUF], buf[MAXBUF + 1];
+    int n;
+
+    while (s->state == S_RUN) {
+	if (s->pc == s->trace->num_lines) {
+	    send(s->datafd, "", 0, 0);    /* EOF; the shell may be gone */
+	    s->state = S_EXIT;
+	    s->deadline = now() + timeout;
+	    return;
+	}
+	line = s->trace->lines[s->pc++];
+	word[0] = arg[0] = '\0';
+	sscanf(line, "%s %s", word, arg);
+
+	if (!strcmp(word, "NEXT")) {
+	    if (s->prompts > 0)
+		s->prompts--;
+	    else {
+		s->state = S_NEXT;
+		s->deadline = now() + timeout;
+	    }
+	}
+	else if (!strcmp(word, "WAIT")) {
+	    s->want = arg[0] ? atoi(arg) : 1;
+	    if (s->syncs >= s->want)
+		s->syncs -= s->want;
+	    else {
+		s->state = S_WAIT;
+		s->deadline = now() + timeout;
+	    }
+	}
+	else if (!strcmp(word, "SIGNAL"))
+	    release(s, strcmp(arg, "all") ? 1 : s->waiting);
+	else if (!strcmp(word, "SIGINT"))
+	    kill(s->pid, SIGINT);
+	else if (!strcmp(word, "SIGTSTP"))
+	    kill(s->pid, SIGTSTP);
+	else if (!strcmp(word, "DELAY")) {
+	    if (!fast && (n = atoi(arg)) > 0) {
+		s->state = S_DELAY;
+		s->deadline = now() + n / 1000.0;
+	    }
+	}
+	else {
+	    sprintf(buf, "%s\n", line);
+	    if (send(s->datafd, buf, strlen(buf), 0) < 0) {
+		fail(s, "shell went away");
+		return;
+	    }
+	    s->sent = now();
+	    s->timing = 1;
+	}
+    }
+}
+
+/*
+ * on_data - Take the datagrams that the shell sent. We only look for
+ *     prompts; the rest of the output goes nowhere.
+ */
+void on_data(struct session_t *s)
+{
+    char buf[MAXBUF];
+    int n;
+
+    while ((n = recv(s->datafd, buf, MAXBUF - 1, MSG_DONTWAIT)) >= 0) {
+	if (n == 0) {          /* The shell and its jobs are all gone */
+	    epoll_ctl(epfd, EPOLL_CTL_DEL, s->datafd, NULL);
+	    return;
+	}
+	buf[n] = '\0';
+	if (strcmp(buf, PROMPT))
+	    continue;
+	if (s->timing) {
+	    add_latency(s, (now() - s->sent) * 1e6);
+	    s->timing = 0;
+	}
+	if (s->state == S_NEXT)
+	    s->state = S_RUN;
+	else
+	    s->prompts++;
+    }
+}
+
+/*
+ * on_sync - Count the jobs that synced with the session
+ */
+void on_sync(struct session_t *s)
+{
+    char buf[MAXBUF];
+    int n;
+
+    while ((n = recv(s->syncfd, buf, MAXBUF, MSG_DONTWAIT)) >= 0) {
+	if (n > 0)             /* A sync is an empty datagram */
+	    continue;
+	s->waiting++;
+	s->syncs++;
+	if (s->state == S_WAIT && s->syncs >= s->want) {
+	    s->syncs -= s->want;
+	    s->state = S_RUN;
+	}
+    }
+}
+
+/*
+ * release - Release n of the session's synced jobs
+ */
+void release(struct session_t *s, int n)
+{
+    while (n-- > 0) {
+	if (send(s->syncfd, "signal", 6, 0) < 0)
+	    break;
+	if (s->waiting > 0)
+	    s->waiting--;
+    }
+}
+
+/*
+ * reap - Reap the shells that exited, and the orphaned jobs that came
+ *     to us, and end or restart the shells' sessions
+ */
+void reap(void)
+{
+    struct signalfd_siginfo si;
+    pid_t pid;
+    int i;
+
+    while (read(sigfd, &si, sizeof(si)) > 0)
+	;
+    while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+	for (i = 0; i < num_sessions && sessions[i].pid != pid; i++)
+	    ;
+	if (i == num_sessions)
+	    continue;
+	if (sessions[i].state != S_EXIT)
+	    fail(&sessions[i], "shell exited early");
+	end_session(&sessions[i]);
+    }
+}
+
+/*
+ * end_session - The session's shell is gone: run the trace again in a
+ *     new shell, or finish
+ */
+void end_session(struct session_t *s)
+{
+    close(s->datafd);
+    close(s->syncfd);
+    s->pid = 0;
+    if (++s->iter < iters && !s->failed)
+	start_session(s);
+    else {
+	s->state = S_DONE;
+	active--;
+    }
+}
+
+/*
+ * fail - A session went wrong: say where, and kill its shell
+ */
+void fail(struct session_t *s, char *msg)
+{
+    printf("loadgen: session %d (%s:%d): %s\n", (int)(s - sessions),
+	   s->trace->name, s->pc, msg);
+    s->failed = 1;
+    s->state = S_EXIT;
+    s->deadline = now() + timeout;
+    if (s->pid > 0)
+	kill(s->pid, SIGKILL);
+}
+
+/*
+ * check_deadlines - End the DELAYs that are over, and fail the
+ *     sessions that waited too long
+ */
+void check_deadlines(double t)
+{
+    char msg[MAXBUF];
+    int i;
+    struct session_t *s;
+
+    for (i = 0; i < num_sessions; i++) {
+	s = &sessions[i];
+	if (s->state == S_RUN || s->state == S_DONE || t < s->deadline)
+	    continue;
+	if (s->state == S_DELAY)
+	    s->state = S_RUN;
+	else if (s->state == S_EXIT && s->failed)
+	    s->deadline = t + timeout;         /* SIGKILL will get it */
+	else {
+	    sprintf(msg, "timed out waiting for %s", waiting_for[s->state]);
+	    fail(s, msg);
+	}
+    }
+}
+
+/*
+ * next_timeout - Msecs until the next session deadline, for epoll_wait
+ */
+int next_timeout(double t)
+{
+    double next = t + timeout;
+    int i;
+
+    for (i = 0; i < num_sessions; i++) {
+	if (sessions[i].state == S_RUN)
+	    return 0;
+	if (sessions[i].state != S_DONE && sessions[i].deadline < next)
+	    next = sessions[i].deadline;
+    }
+    return next <= t ? 0 : (int)((next - t) * 1000) + 1;
+}
+
+/*
+ * add_latency - Record the latency of one of the session's commands
+ */
+void add_latency(struct session_t *s, int usecs)
+{
+    if (s->num_lat == s->max_lat) {
+	s->max_lat = s->max_lat ? 2*s->max_lat : 64;
+	if ((s->lat = realloc(s->lat, s->max_lat * sizeof(int))) == NULL) {
+	    perror("realloc");
+	    exit(1);
+	}
+    }
+    s->lat[s->num_lat++] = usecs;
+}
+
+/*
+ * report - Print the rate of commands and the latency percentiles
+ */
+void report(double secs)
+{
+    int *all, *med, *p99, i, n = 0, m = 0, failed = 0;
+    struct session_t *s;
+
+    for (i = 0; i < num_sessions; i++) {
+	n += sessions[i].num_lat;
+	failed += sessions[i].failed;
+    }
+    all = malloc((n + 1) * sizeof(int));
+    med = malloc(num_sessions * sizeof(int));
+    p99 = malloc(num_sessions * sizeof(int));
+    if (!all || !med || !p99) {
+	perror("malloc");
+	exit(1);
+    }
+
+    n = 0;
+    for (i = 0; i < num_sessions; i++) {
+	s = &sessions[i];
+	if (s->num_lat == 0)
+	    continue;
+	memcpy(all + n, s->lat, s->num_lat * sizeof(int));
+	n += s->num_lat;
+	qsort(s->lat, s->num_lat, sizeof(int), cmpint);
+	med[m] = s->lat[s->num_lat / 2];
+	p99[m] = s->lat[(s->num_lat * 99) / 100];
+	m++;
+	if (verbose)
+	    printf("session %4d %-16s %6d commands, median %8.3fms, "
+		   "p99 %8.3fms%s\n", i, s->trace->name, s->num_lat,
+		   med[m-1] / 1000.0, p99[m-1] / 1000.0,
+		   s->failed ? " FAILED" : "");
+    }
+
+    printf("%d sessions, %d failed; %d commands in %.3f secs, "
+	   "%.0f commands/sec\n", num_sessions, failed, n, secs,
+	   secs > 0 ? n / secs : 0.0);
+    printf("%-16s %10s %10s %10s %10s %10s\n", "latency", "min", "median",
+	   "p90", "p99", "max");
+    percentiles("all commands", all, n);
+    percentiles("session medians", med, m);
+    percentiles("session p99s", p99, m);
+    free(all);
+    free(med);
+    free(p99);
+}
+
+/*
+ * percentiles - Print a row of percentiles of n latencies in usecs,
+ *     in msecs
+ */
+void percentiles(char *what, int *a, int n)
+{
+    if (n == 0) {
+	printf("%-16s %10s %10s %10s %10s %10s\n", what, "-", "-", "-", "-",
+	       "-");
+	return;
+    }
+    qsort(a, n, sizeof(int), cmpint);
+    printf("%-16s %8.3fms %8.3fms %8.3fms %8.3fms %8.3fms\n", what,
+	   a[0] / 1000.0, a[n / 2] / 1000.0, a[(n * 90) / 100] / 1000.0,
+	   a[(n * 99) / 100] / 1000.0, a[n - 1] / 1000.0);
+}
+
+/*
+ * kill_strays - Kill the jobs that outlived their shells (stopped
+ *     jobs, say); as a subreaper, we are their parent now
+ */
+void kill_strays(void)
+{
+    DIR *dir;
+    struct dirent *de;
+    char path[64], line[MAXBUF];
+    FILE *fp;
+    int ppid;
+
+    if ((dir = opendir("/proc")) == NULL)
+	return;
+    while ((de = readdir(dir)) != NULL) {
+	if (!isdigit(de->d_name[0]))
+	    continue;
+	sprintf(path, "/proc/%.16s/stat", de->d_name);
+	if ((fp = fopen(path, "r")) == NULL)
+	    continue;
+	if (fgets(line, MAXBUF, fp) && strrchr(line, ')') &&
+	    sscanf(strrchr(line, ')') + 2, "%*c %d", &ppid) == 1 &&
+	    ppid == getpid())
+	    kill(atoi(de->d_name), SIGKILL);
+	fclose(fp);
+    }
+    closedir(dir);
+    while (waitpid(-1, NULL, WNOHANG) > 0)
+	;
+}
+
+/*
+ * cmpint - Compare two ints for qsort
+ */
+int cmpint(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * now - Return the time in secs on the monotonic clock
+ */
+double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * usage - Print help message and terminate
+ */
+void usage(void)
+{
+    printf("Usage: loadgen [-hFv] [-s <shell>] -f <trace> [-f <trace> ...]\n");
+    printf("               [-n <sessions>] [-i <iters>] [-t <secs>]\n");
+    printf("Runs traces against many shells at once from one process and\n");
+    printf("reports commands/sec and the latency of the commands.\n");
+    printf("Options:\n");
+    printf("  -h            Print this message\n");
+    printf("  -s <shell>    Shell program to load (default ./tsh)\n");
+    printf("  -f <trace>    A trace in the mix; sessions take them in turn\n");
+    printf("  -n <sessions> Concurrent sessions (default 10)\n");
+    printf("  -i <iters>    Runs of the trace per session, each in a new "
+	   "shell (default 1)\n");
+    printf("  -t <secs>     Timeout while waiting for a shell (default %d)\n",
+	   DRIVER_TIMEOUT);
+    printf("  -F            Skip DELAY directives\n");
+    printf("  -v            Print each session's latencies\n");
+    exit(1);
+}
@@ -0,0 +1,47 @@
+/* 
+ * mybulk.c - Shell lab test program
+ *
+ * Writes nbytes bytes of numbered lines to its standard output, in
+ * writes of several lines at a time, for traces that push a lot of job
+ * output through the shell. Each line starts with the shell's prompt,
+ * so a driver that takes any "tsh> " for the prompt gets it wrong.
+ *
+ * Usage: ./mybulk <nbytes>
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+
+#define LINES 64   /* lines per write */
+
+static char buf[LINES * MAXBUF];
+
+int mybulk_main(int argc, char **argv) 
+{
+    long nbytes, line = 0;
+    int len, n;
+
+    if (argc != 2) {
+	fprintf(stderr, "Usage: %s <nbytes>\n", argv[0]);
+	exit(1);
+    }
+    nbytes = atol(argv[1]);
+
+    while (nbytes > 0) {
+	for (len = 0, n = 0; n < LINES && len < nbytes; n++)
+	    len += sprintf(buf + len, "%sline %07ld of bulk output\n", 
+			   PROMPT, ++line);
+	if (len > nbytes)
+	    len = nbytes;
+	if (write(STDOUT_FILENO, buf, len) != len) {
+	    perror("write");
+	    exit(1);
+	}
+	nbytes -= len;
+    }
+    exit(0);
+}
@@ -0,0 +1,33 @@
+/* 
+ * mycat.c - Shell lab test program
+ *
+ * Copies its standard input to its standard output. Useful for
+ * testing a shell's I/O redirection.
+ *
+ * Usage: ./mycat
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+#include "config.h"
+
+static char buf[MAXBUF];
+
+int mycat_main(int argc, char **argv) 
+{
+    ssize_t n;
+
+    while ((n = read(STDIN_FILENO, buf, MAXBUF)) > 0) {
+	if (write(STDOUT_FILENO, buf, n) != n) {
+	    perror("write");
+	    exit(1);
+	}
+    }
+    if (n < 0) {
+	perror("read");
+	exit(1);
+    }
+    exit(0);
+}
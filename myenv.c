@@ -8,7 +8,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-int main() 
+int myenv_main(int argc, char **argv) 
 {
     printf("OSTYPE=%s\n", getenv("OSTYPE"));
     fflush(stdout);
@@ -0,0 +1,101 @@
+/* 
+ * myhelper.c - Multi-call binary for the shell lab test programs
+ *
+ * All of the helper programs that the traces run (myspin1, mysplit,
+ * mycat, ...) are linked into this one executable, and the Makefile
+ * creates a hard link to it under each helper's name. The helper to
+ * run is chosen from the name it was invoked by, so "./myspin1 5"
+ * behaves exactly like the old standalone myspin1 binary. The helper
+ * can also be named explicitly, as in "./myhelper myspin1 5".
+ *
+ * Sharing one small binary means each exec maps and relocates a single
+ * image that is usually already in the page cache, and the SYNCFD
+ * handshake lives in one place (jobsync.c).
+ *
+ * Usage: ./<helper> [args]  or  ./myhelper <helper> [args]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Entry points of the individual helpers */
+int mybulk_main(int argc, char **argv);
+int mycat_main(int argc, char **argv);
+int myenv_main(int argc, char **argv);
+int myintp_main(int argc, char **argv);
+int myints_main(int argc, char **argv);
+int myprobe_main(int argc, char **argv);
+int mypsgrep_main(int argc, char **argv);
+int myspin1_main(int argc, char **argv);
+int myspin2_main(int argc, char **argv);
+int mysplit_main(int argc, char **argv);
+int mysplitp_main(int argc, char **argv);
+int mystorm_main(int argc, char **argv);
+int mytstpp_main(int argc, char **argv);
+int mytstps_main(int argc, char **argv);
+
+struct helper_t {
+    char *name;
+    int (*main)(int argc, char **argv);
+};
+
+static struct helper_t helpers[] = {
+    {"mybulk",   mybulk_main},
+    {"mycat",    mycat_main},
+    {"myenv",    myenv_main},
+    {"myintp",   myintp_main},
+    {"myints",   myints_main},
+    {"myprobe",  myprobe_main},
+    {"mypsgrep", mypsgrep_main},
+    {"myspin1",  myspin1_main},
+    {"myspin2",  myspin2_main},
+    {"mysplit",  mysplit_main},
+    {"mysplitp", mysplitp_main},
+    {"mystorm",  mystorm_main},
+    {"mytstpp",  mytstpp_main},
+    {"mytstps",  mytstps_main},
+    {NULL,       NULL}
+};
+
+/*
+ * usage - Print the helpers we know about and terminate
+ */
+static void usage(void)
+{
+    struct helper_t *h;
+
+    printf("Usage: myhelper <helper> [args]\n");
+    printf("Helpers:");
+    for (h = helpers; h->name != NULL; h++)
+	printf(" %s", h->name);
+    printf("\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) 
+{
+    char *name;
+    struct helper_t *h;
+
+    /* Dispatch on the basename of the name we were invoked by */
+    name = strrchr(argv[0], '/');
+    name = name ? name + 1 : argv[0];
+
+    /* Invoked as "myhelper <helper> [args]" */
+    if (!strcmp(name, "myhelper")) {
+	if (argc < 2)
+	    usage();
+	argc--;
+	argv++;
+	name = argv[0];
+    }
+
+    for (h = helpers; h->name != NULL; h++)
+	if (!strcmp(name, h->name))
+	    return h->main(argc, argv);
+
+    fprintf(stderr, "myhelper: unknown helper %s\n", name);
+    usage();
+    return 1;
+}
@@ -0,0 +1,113 @@
+/*
+ * myprobe - Shell lab test program.
+ *
+ * Measures the latency of the shell's signal forwarding. Like myintp,
+ * it sends a signal to its parent (the shell), which a correctly
+ * written shell forwards to the foreground job, i.e., back to us.
+ * Unlike myintp, it keeps the signal blocked and collects it with
+ * sigtimedwait, so it survives to do this count times, and it times
+ * each round trip on the monotonic clock.
+ *
+ * Under the driver with shared-memory sync, each latency (in nsecs,
+ * or -1 for a signal that never came back within PROBE_TIMEOUT_MS) goes
+ * to runtrace through jobsync_report, which logs them as "probe"
+ * events in its timeline log. Otherwise, it prints a summary.
+ *
+ * With "burn", it instead syncs with the driver and then spins until
+ * its shell goes away, which makes for background load.
+ *
+ * Usage: ./myprobe [int | tstp] [count]  or  ./myprobe burn
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "config.h"
+#include "jobsync.h"
+
+#define PROBE_COUNT 100         /* Default number of round trips */
+#define PROBE_TIMEOUT_MS 100    /* How long to wait for each signal */
+#define PROBE_MAX JOBSYNC_SAMPLES
+
+static void sigalrm_handler(int signum)
+{
+	exit(0);
+}
+
+static int cmpint(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+int myprobe_main(int argc, char **argv)
+{
+	int sig = SIGINT, count = PROBE_COUNT, driven, i, n = 0, missed = 0;
+	int nsecs[PROBE_MAX];
+	pid_t shell = getppid();
+	sigset_t mask;
+	struct timespec start, end, timeout = {0, PROBE_TIMEOUT_MS * 1000000L};
+
+	signal(SIGALRM, sigalrm_handler);
+	driven = jobsync_init();
+
+	/* Background load: burn the CPU until the shell exits */
+	if (argc > 1 && !strcmp(argv[1], "burn")) {
+		jobsync_alarm(JOB_TIMEOUT);
+		if (driven)
+			jobsync_signal();
+		while (getppid() == shell)
+			;
+		exit(0);
+	}
+
+	if (argc > 1 && !strcmp(argv[1], "tstp"))
+		sig = SIGTSTP;
+	else if (argc > 1 && strcmp(argv[1], "int")) {
+		fprintf(stderr, "Usage: %s [int | tstp] [count]\n", argv[0]);
+		exit(1);
+	}
+	if (argc > 2)
+		count = atoi(argv[2]);
+	if (count < 1 || count > PROBE_MAX)
+		count = PROBE_COUNT;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, sig);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	jobsync_alarm(JOB_TIMEOUT);
+
+	for (i = 0; i < count; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (kill(shell, sig) < 0) {
+			perror("kill");
+			exit(1);
+		}
+		if (sigtimedwait(&mask, NULL, &timeout) < 0) {
+			if (!jobsync_report(-1))
+				missed++;
+		}
+		else {
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			nsecs[n] = (end.tv_sec - start.tv_sec) * 1000000000L +
+				(end.tv_nsec - start.tv_nsec);
+			if (!jobsync_report(nsecs[n]))
+				n++;
+		}
+	}
+
+	/* Whatever the driver didn't take, we report ourselves */
+	if (n > 0 || missed > 0) {
+		qsort(nsecs, n, sizeof(int), cmpint);
+		printf("myprobe: %d round trips, %d missed", n, missed);
+		if (n > 0)
+			printf(", min %d median %d max %d nsecs", nsecs[0],
+			       nsecs[n / 2], nsecs[n - 1]);
+		printf("\n");
+	}
+	exit(0);
+}
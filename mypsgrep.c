@@ -0,0 +1,279 @@
+/*
+ * mypsgrep.c - Shell lab test program
+ *
+ * Lists the state and command line of every process whose name
+ * contains <name> and/or whose process group is <pgid>, one process
+ * per line in the form
+ *
+ *     T ./mysplit 10
+ *
+ * This is the same information that the traces used to extract with
+ * "ps h | fgrep -v grep | fgrep <name> | expand | colrm ...", but it
+ * is gathered by scanning /proc directly in a single process. Only
+ * the /proc/<pid>/stat file of each process is read, plus the cmdline
+ * file of the processes that match.
+ *
+ * By default only descendants of the calling shell are listed, so
+ * that stray jobs and zombies left behind by other shells don't show
+ * up in the output. The -A flag lists matching processes system-wide.
+ *
+ * If a time budget is given with -t, the scan gives up and exits with
+ * status 2 once it has taken more than <usecs> microseconds.
+ *
+ * Usage: ./mypsgrep [-A] [-g <pgid>] [-t <usecs>] [name]
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "config.h"
+
+static char buf[MAXBUF];
+static char cmdline[MAXBUF];
+
+/* One entry per process found in /proc */
+struct proc_t {
+    pid_t pid;
+    pid_t ppid;
+    char state;
+    int match;                 /* True if the process passed the filters */
+    char comm[32];
+};
+static struct proc_t *procs = NULL;   /* Processes in ascending PID order */
+static int nprocs = 0;
+static int maxprocs = 0;
+
+/* Prototypes */
+static void usage(void);
+static long elapsed_usecs(struct timespec *start);
+static int read_file(char *path, char *dst, int size);
+static int print_cmdline(pid_t pid, char *comm, char state);
+static struct proc_t *addproc(void);
+static struct proc_t *findproc(pid_t pid);
+static int descendant(struct proc_t *p, pid_t ancestor);
+
+int mypsgrep_main(int argc, char **argv)
+{
+    int c, i, n;
+    int all = 0;               /* List processes system-wide? (-A) */
+    char *name = NULL;         /* Name to match (default any) */
+    pid_t pgid = 0;            /* Process group to match (default any) */
+    long budget = 0;           /* Time budget in usecs (default none) */
+    pid_t self = getpid();
+    struct timespec start;
+    DIR *dirp;
+    struct dirent *de;
+    char path[64];
+    char *comm, *endcomm;
+    char state;
+    pid_t pid, ppid, pgrp;
+    struct proc_t *p;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while ((c = getopt(argc, argv, "hAg:t:")) != EOF) {
+	switch (c) {
+	case 'A':             /* Don't restrict to the calling shell */
+	    all = 1;
+	    break;
+	case 'g':             /* Process group to match */
+	    pgid = atoi(optarg);
+	    break;
+	case 't':             /* Time budget in microseconds */
+	    budget = atol(optarg);
+	    break;
+	case 'h':
+	default:
+	    usage();
+	}
+    }
+    if (optind < argc)
+	name = argv[optind];
+    if (!name && !pgid)
+	usage();
+
+    if ((dirp = opendir("/proc")) == NULL) {
+	perror("opendir /proc");
+	exit(1);
+    }
+
+    while ((de = readdir(dirp)) != NULL) {
+	if (budget && elapsed_usecs(&start) > budget) {
+	    fprintf(stderr, "mypsgrep: time budget of %ld usecs exceeded\n",
+		    budget);
+	    exit(2);
+	}
+
+	/* Only the numeric entries are processes */
+	if (!isdigit(de->d_name[0]))
+	    continue;
+	pid = atoi(de->d_name);
+	if (pid == self)
+	    continue;
+
+	/*
+	 * The stat file looks like "pid (comm) S ppid pgrp ...". The
+	 * comm field may itself contain spaces and parens, so it
+	 * ends at the last ')' in the line.
+	 */
+	sprintf(path, "/proc/%d/stat", pid);
+	if ((n = read_file(path, buf, MAXBUF)) <= 0)
+	    continue;          /* Process went away */
+	if ((comm = strchr(buf, '(')) == NULL ||
+	    (endcomm = strrchr(buf, ')')) == NULL)
+	    continue;
+	comm++;
+	*endcomm = '\0';
+	if (sscanf(endcomm + 2, "%c %d %d", &state, &ppid, &pgrp) != 3)
+	    continue;
+
+	/* Remember every process so that we can walk up its ancestors */
+	p = addproc();
+	p->pid = pid;
+	p->ppid = ppid;
+	p->state = state;
+	strncpy(p->comm, comm, sizeof(p->comm) - 1);
+	p->comm[sizeof(p->comm) - 1] = '\0';
+	p->match = (!pgid || pgrp == pgid) && (!name || strstr(comm, name));
+    }
+    closedir(dirp);
+
+    for (i = 0; i < nprocs; i++) {
+	p = &procs[i];
+	if (p->match && (all || descendant(p, getppid())))
+	    print_cmdline(p->pid, p->comm, p->state);
+    }
+
+    fflush(stdout);
+    exit(0);
+}
+
+/*
+ * print_cmdline - Print the state and command line of process pid
+ */
+static int print_cmdline(pid_t pid, char *comm, char state)
+{
+    int i, n;
+    char path[64];
+
+    sprintf(path, "/proc/%d/cmdline", pid);
+    n = read_file(path, cmdline, MAXBUF);
+
+    /* Zombies and kernel threads have an empty command line */
+    if (n <= 0) {
+	printf("%c [%s]%s\n", state, comm, state == 'Z' ? " <defunct>" : "");
+	return 0;
+    }
+
+    /* Arguments are separated (and terminated) by NUL characters */
+    if (cmdline[n-1] == '\0')
+	n--;
+    for (i = 0; i < n; i++)
+	if (cmdline[i] == '\0')
+	    cmdline[i] = ' ';
+    cmdline[n] = '\0';
+
+    printf("%c %s\n", state, cmdline);
+    return 1;
+}
+
+/*
+ * addproc - Append a new (uninitialized) entry to the process list
+ */
+static struct proc_t *addproc(void)
+{
+    if (nprocs == maxprocs) {
+	maxprocs = maxprocs ? 2 * maxprocs : 256;
+	if ((procs = realloc(procs, maxprocs * sizeof(struct proc_t))) == NULL) {
+	    perror("realloc");
+	    exit(1);
+	}
+    }
+    memset(&procs[nprocs], 0, sizeof(struct proc_t));
+    return &procs[nprocs++];
+}
+
+/*
+ * findproc - Binary search the process list (readdir on /proc
+ *            returns PIDs in ascending order) for process pid
+ */
+static struct proc_t *findproc(pid_t pid)
+{
+    int lo = 0, hi = nprocs - 1, mid;
+
+    while (lo <= hi) {
+	mid = (lo + hi) / 2;
+	if (procs[mid].pid == pid)
+	    return &procs[mid];
+	if (procs[mid].pid < pid)
+	    lo = mid + 1;
+	else
+	    hi = mid - 1;
+    }
+    return NULL;
+}
+
+/*
+ * descendant - Return true if process p is a descendant of ancestor
+ */
+static int descendant(struct proc_t *p, pid_t ancestor)
+{
+    while (p != NULL && p->ppid > 0) {
+	if (p->ppid == ancestor)
+	    return 1;
+	p = findproc(p->ppid);
+    }
+    return 0;
+}
+
+/*
+ * read_file - Read at most size-1 bytes of a /proc file into dst and
+ *             NUL-terminate it. Returns the number of bytes read, or
+ *             -1 if the file could not be read.
+ */
+static int read_file(char *path, char *dst, int size)
+{
+    int fd, n;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+	return -1;
+    n = read(fd, dst, size - 1);
+    close(fd);
+    if (n < 0)
+	return -1;
+    dst[n] = '\0';
+    return n;
+}
+
+/*
+ * elapsed_usecs - Microseconds since start on the monotonic clock
+ */
+static long elapsed_usecs(struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000L +
+	(now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+/*
+ * usage - Print help message and terminate
+ */
+static void usage(void)
+{
+    printf("Usage: mypsgrep [-A] [-g <pgid>] [-t <usecs>] [name]\n");
+    printf("Options:\n");
+    printf("  -h            Print this message\n");
+    printf("  -A            List processes of every shell, not just ours\n");
+    printf("  -g <pgid>     Only list processes in process group <pgid>\n");
+    printf("  -t <usecs>    Give up after <usecs> microseconds\n");
+    exit(1);
+}
@@ -18,64 +18,38 @@
 #include <stdlib.h>
 #include <signal.h>
 #include <sys/types.h>
-#include <sys/socket.h>
-#include <sys/stat.h>
-#include <string.h>
 
 #include "config.h"
+#include "jobsync.h"
 
-char buf[MAXBUF];
-int syncfd;
-
-void sigalrm_handler(int signum) 
+static void sigalrm_handler(int signum) 
 {
 	exit(0);
 }
 
-void sigterm_handler(int signum)
+static void sigterm_handler(int signum)
 {
-	int rc;
-	char *cmdp;
-
 	printf("Took SIGTERM!\n");
 	fflush(stdout);
-	cmdp = "";
-	if ((rc = recv(syncfd, buf, MAXBUF, 0)) < 0) {
-		perror("recv");
-		exit(1);
-	}
-	if ((rc = send(syncfd, cmdp, strlen(cmdp), 0)) < 0) {
-		perror("send");
-		exit(1);
-	}
+	jobsync_wait();
+	jobsync_signal();
 	exit(0);
 }
 
 
 
-int main(int argc, char **argv) 
+int myspin1_main(int argc, char **argv) 
 {
-	int rc;
 	int standalone;
-	char *str;
-	char *cmdp;
-	struct stat stat;
 
 	signal(SIGALRM, sigalrm_handler);
 	signal(SIGTERM, sigterm_handler);
 
 	/* 
 	 * Determine if the shell is running standalone or under the
-	 * control of the driver program. If running under the driver, get
-	 * the number of the driver's synchronizing domain socket
-	 * descriptor.  
+	 * control of the driver program.
 	 */
-	standalone = 1;
-	if ((str = getenv("SYNCFD")) != NULL) {
-		syncfd = atoi(str);              /* Get descriptor number */
-		if (fstat(syncfd, &stat) != -1)  /* Is is open? */
-			standalone = 0;
-	}
+	standalone = !jobsync_init();
 
 	/* 
 	 * If the job is being run by the driver, then synchronize with
@@ -84,16 +58,9 @@ int main(int argc, char **argv)
 	 */
 
 	if (!standalone) {
-		alarm(JOB_TIMEOUT);
-		cmdp = "";
-		if ((rc = send(syncfd, cmdp, strlen(cmdp), 0)) < 0) {
-			perror("send");
-			exit(1);
-		}
-		if ((rc = recv(syncfd, buf, MAXBUF, 0)) < 0) {
-			perror("recv");
-			exit(1);
-		}
+		jobsync_alarm(JOB_TIMEOUT);
+		jobsync_signal();
+		jobsync_wait();
 		exit(0);
 	}
 	/*
@@ -101,15 +68,14 @@ int main(int argc, char **argv)
 	 */
 	else {
 		if (argc > 1)
-			alarm(atoi(argv[1]));
+			jobsync_alarm(atoi(argv[1]));
 		else
-			alarm(JOB_TIMEOUT);
+			jobsync_alarm(JOB_TIMEOUT);
 
-		while(1);
+		jobsync_spin();
 	}
 
 	/* Control should never reach here */
 	exit(1);
 }
 
-
@@ -12,45 +12,29 @@
 #include <stdlib.h>
 #include <signal.h>
 #include <sys/types.h>
-#include <sys/socket.h>
-#include <sys/stat.h>
 #include <sys/wait.h>
-#include <string.h>
 
 #include "config.h"
+#include "jobsync.h"
 
-char buf[MAXBUF];
-
-void sigalrm_handler(int signum) 
+static void sigalrm_handler(int signum) 
 {
     exit(0);
 }
 
-int main(int argc, char **argv) 
+int mysplit_main(int argc, char **argv) 
 {
-    int rc;
     int standalone;
-    int syncfd;
-    char *str;
-    char *cmdp;
-    struct stat stat;
 
     signal(SIGALRM, sigalrm_handler);
 
+    /* 
+     * Determine if the shell is running standalone or under the
+     * control of the driver program.
+     */
+    standalone = !jobsync_init();
+
     if (fork() == 0) { /* child */
-	/* 
-	 * Determine if the shell is running standalone or under the
-	 * control of the driver program. If running under the driver, get
-	 * the number of the driver's synchronizing domain socket
-	 * descriptor.  
-	 */
-	standalone = 1;
-	if ((str = getenv("SYNCFD")) != NULL) {
-	    syncfd = atoi(str);              /* Get descriptor number */
-	    if (fstat(syncfd, &stat) != -1)  /* Is is open? */
-		standalone = 0;
-	}
-	
 	/* 
 	 * If the job is being run by the driver, then synchronize with
 	 * the driver over its synchronizing domain socket.  Ignore any
@@ -58,17 +42,9 @@ int main(int argc, char **argv)
 	 */
 	
 	if (!standalone) {
-	    alarm(JOB_TIMEOUT);
-	    cmdp = "";
-	    if ((rc = send(syncfd, cmdp, strlen(cmdp), 0)) < 0) {
-		perror("send");
-		exit(1);
-	    }
-	    
-	    if ((rc = recv(syncfd, buf, MAXBUF, 0)) < 0) {
-		perror("recv");
-		exit(1);
-	    }
+	    jobsync_alarm(JOB_TIMEOUT);
+	    jobsync_signal();
+	    jobsync_wait();
 	    exit(0);
 	}
 	
@@ -77,17 +53,17 @@ int main(int argc, char **argv)
 	 */
 	else {
 	    if (argc > 1)
-		alarm(atoi(argv[1]));
+		jobsync_alarm(atoi(argv[1]));
 	    else
-		alarm(JOB_TIMEOUT);
+		jobsync_alarm(JOB_TIMEOUT);
 	    
-	    while(1);
+	    jobsync_spin();
 	}
 	
     }
 
     /* Parent waits for child to terminate */
-    alarm(JOB_TIMEOUT);
+    jobsync_alarm(JOB_TIMEOUT);
     wait(NULL);
     exit(0);
 }
@@ -19,9 +19,7 @@
 
 #include "config.h"
 
-char buf[MAXBUF];
-
-int main(int argc, char **argv) 
+int mysplitp_main(int argc, char **argv) 
 {
     pid_t child_pid;
 
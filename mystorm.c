@@ -0,0 +1,62 @@
+/*
+ * mystorm - Shell lab test program.
+ *
+ * One job of a storm: a burst of background jobs that all exit or
+ * stop at (nearly) the same moment, so that the shell gets one
+ * coalesced SIGCHLD for many children and has to reap them all in a
+ * single pass of its handler.
+ *
+ * When called by the shell driver, it syncs with the driver like
+ * myspin1 and then waits to be released. The driver's "SIGNAL all"
+ * releases every waiting job with a single wakeup, and each job then
+ * exits (mode "exit", the default) or stops itself with SIGTSTP (mode
+ * "stop"). A stopped job exits when it is continued. If it doesn't
+ * hear from the driver after some period of time, it times out and
+ * terminates.
+ *
+ * When called standalone, it exits or stops right away.
+ *
+ * Usage: ./mystorm [exit | stop]
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/types.h>
+
+#include "config.h"
+#include "jobsync.h"
+
+static void sigalrm_handler(int signum)
+{
+	exit(0);
+}
+
+int mystorm_main(int argc, char **argv)
+{
+	int stop = 0;
+
+	if (argc > 1 && !strcmp(argv[1], "stop"))
+		stop = 1;
+	else if (argc > 1 && strcmp(argv[1], "exit")) {
+		fprintf(stderr, "Usage: %s [exit | stop]\n", argv[0]);
+		exit(1);
+	}
+
+	signal(SIGALRM, sigalrm_handler);
+
+	/* Under the driver, wait for the rest of the storm */
+	if (jobsync_init()) {
+		jobsync_alarm(JOB_TIMEOUT);
+		jobsync_signal();
+		jobsync_wait();
+	}
+
+	if (stop && kill(getpid(), SIGTSTP) < 0) {
+		perror("kill");
+		exit(1);
+	}
+	exit(0);
+}
@@ -9,22 +9,24 @@
 #include <signal.h>
 #include <stdlib.h>
 #include "config.h"
+#include "jobsync.h"
 
-void sigalrm_handler() 
+static void sigalrm_handler() 
 {
     exit(0);
 }
 
-int main() 
+int mytstpp_main(int argc, char **argv) 
 {
     signal(SIGALRM, sigalrm_handler);
-    alarm(JOB_TIMEOUT);
+    jobsync_init();
+    jobsync_alarm(JOB_TIMEOUT);
 
     if (kill(getppid(), SIGTSTP) < 0) {
 	perror("kill");
 	exit(1);
     }
 
-    while(1);
+    jobsync_spin();
     exit(0);
 }
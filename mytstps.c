@@ -7,7 +7,7 @@
 #include <signal.h>
 #include <stdlib.h>
 
-int main() 
+int mytstps_main(int argc, char **argv) 
 {
     if (kill(getpid(), SIGTSTP) < 0) {
 	perror("kill");
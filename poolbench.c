@@ -0,0 +1,297 @@
+/*
+ * poolbench.c - Contention benchmark for the csapp thread pool
+ *
+ * Runs the same number of tiny tasks through four ways of handing
+ * work to threads, with 1, 2, 4, ... up to <threads> consumer threads,
+ * and prints the throughput of each in millions of tasks per second:
+ *
+ *   sbuf   The book's bounded buffer, guarded by P and V on POSIX
+ *          semaphores, with the main thread as producer
+ *   mpmc   The lock-free mpmc queue, with the main thread as producer
+ *          and consumers that yield when it is empty
+ *   pool   The thread pool, with the main thread submitting each task
+ *          through pool_submit_cb
+ *   fork   The thread pool, with the tasks spawned by the workers
+ *          themselves as a binary tree of futures, so that they go
+ *          through the workers' own deques and get stolen
+ *
+ * Usage: ./poolbench [-h] [-t <threads>] [-n <tasks>] [-w <work>]
+ */
+#include "csapp.h"
+
+#define MAXTHREADS 64
+#define SBUF_SIZE 1024         /* Slots in the sbuf and mpmc buffers */
+#define LEAF_TASKS 16          /* Tasks that a fork leaf runs itself */
+
+/* Modified by command line args */
+int max_threads = MAXTHREADS;
+long num_tasks = 200000;
+int work = 100;
+
+/* The book's semaphore-based bounded buffer */
+typedef struct {
+    void **buf;
+    int n;                     /* Maximum number of slots */
+    int front;                 /* buf[(front+1)%n] is first item */
+    int rear;                  /* buf[rear%n] is last item */
+    sem_t mutex;               /* Protects accesses to buf */
+    sem_t slots;               /* Counts available slots */
+    sem_t items;               /* Counts available items */
+} sbuf_t;
+
+sbuf_t sbuf;
+mpmc_t mpmc;
+pool_t *pool;
+
+/* Prototypes */
+void usage(void);
+double run_sbuf(int nthreads);
+double run_mpmc(int nthreads);
+double run_pool(int nthreads);
+double run_fork(int nthreads);
+void *task(void *vargp);
+double elapsed(struct timespec *start);
+void sbuf_init(sbuf_t *sp, int n);
+void sbuf_deinit(sbuf_t *sp);
+void sbuf_insert(sbuf_t *sp, void *item);
+void *sbuf_remove(sbuf_t *sp);
+
+int main(int argc, char **argv)
+{
+    int c, n;
+
+    while ((c = getopt(argc, argv, "ht:n:w:")) != EOF) {
+	switch (c) {
+	case 't':             /* Most consumer threads */
+	    max_threads = atoi(optarg);
+	    if (max_threads < 1 || max_threads > MAXTHREADS) {
+		printf("poolbench: -t must be between 1 and %d\n", MAXTHREADS);
+		exit(1);
+	    }
+	    break;
+	case 'n':             /* Tasks per run */
+	    num_tasks = atol(optarg);
+	    if (num_tasks < 1) {
+		printf("poolbench: -n must be positive\n");
+		exit(1);
+	    }
+	    break;
+	case 'w':             /* Loop iterations per task */
+	    work = atoi(optarg);
+	    break;
+	case 'h':
+	default:
+	    usage();
+	}
+    }
+
+    printf("%ld tasks of %d iterations each, Mtasks/sec\n", num_tasks, work);
+    printf("%7s %8s %8s %8s %8s\n", "threads", "sbuf", "mpmc", "pool", "fork");
+    for (n = 1; n <= max_threads; n = 2*n) {
+	printf("%7d %8.3f %8.3f %8.3f %8.3f\n", n, run_sbuf(n), run_mpmc(n),
+	       run_pool(n), run_fork(n));
+	fflush(stdout);
+	if (n < max_threads && 2*n > max_threads)
+	    n = max_threads / 2;
+    }
+    exit(0);
+}
+
+/*
+ * task - The work that each task does
+ */
+void *task(void *vargp)
+{
+    volatile int i, x = 0;
+
+    for (i = 0; i < work; i++)
+	x += i;
+    return NULL;
+}
+
+/*
+ * sbuf consumers run tasks until they remove a NULL
+ */
+void *sbuf_consumer(void *vargp)
+{
+    void *item;
+
+    while ((item = sbuf_remove(&sbuf)) != NULL)
+	task(item);
+    return NULL;
+}
+
+double run_sbuf(int nthreads)
+{
+    pthread_t tid[MAXTHREADS];
+    struct timespec start;
+    long i;
+
+    sbuf_init(&sbuf, SBUF_SIZE);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nthreads; i++)
+	Pthread_create(&tid[i], NULL, sbuf_consumer, NULL);
+    for (i = 0; i < num_tasks; i++)
+	sbuf_insert(&sbuf, &sbuf);
+    for (i = 0; i < nthreads; i++)
+	sbuf_insert(&sbuf, NULL);
+    for (i = 0; i < nthreads; i++)
+	Pthread_join(tid[i], NULL);
+    sbuf_deinit(&sbuf);
+    return num_tasks / elapsed(&start);
+}
+
+/*
+ * mpmc consumers run tasks until they pop a NULL
+ */
+void *mpmc_consumer(void *vargp)
+{
+    void *item;
+
+    for (;;) {
+	if (!mpmc_pop(&mpmc, &item))
+	    sched_yield();
+	else if (item == NULL)
+	    break;
+	else
+	    task(item);
+    }
+    return NULL;
+}
+
+double run_mpmc(int nthreads)
+{
+    pthread_t tid[MAXTHREADS];
+    struct timespec start;
+    long i;
+
+    Mpmc_init(&mpmc, SBUF_SIZE);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nthreads; i++)
+	Pthread_create(&tid[i], NULL, mpmc_consumer, NULL);
+    for (i = 0; i < num_tasks + nthreads; i++)
+	while (!mpmc_push(&mpmc, i < num_tasks ? &mpmc : NULL))
+	    sched_yield();
+    for (i = 0; i < nthreads; i++)
+	Pthread_join(tid[i], NULL);
+    mpmc_deinit(&mpmc);
+    return num_tasks / elapsed(&start);
+}
+
+double run_pool(int nthreads)
+{
+    struct timespec start;
+    long i;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pool = Pool_create(nthreads);
+    for (i = 0; i < num_tasks; i++)
+	pool_submit_cb(pool, task, NULL, NULL, NULL);
+    pool_destroy(pool);
+    return num_tasks / elapsed(&start);
+}
+
+/*
+ * fork_range - Run the tasks in [lo, hi), splitting the range in two
+ *     and submitting one half until it is small
+ */
+void *fork_range(void *vargp)
+{
+    long *range = vargp, lo = range[0], hi = range[1], mid, half[2], i;
+    future_t *f;
+
+    if (hi - lo <= LEAF_TASKS) {
+	for (i = lo; i < hi; i++)
+	    task(NULL);
+	return NULL;
+    }
+    mid = lo + (hi - lo) / 2;
+    half[0] = lo;
+    half[1] = mid;
+    f = pool_submit(pool, fork_range, half);   /* half outlives f */
+    range[0] = mid;
+    range[1] = hi;
+    fork_range(range);
+    future_get(f);
+    return NULL;
+}
+
+double run_fork(int nthreads)
+{
+    struct timespec start;
+    long range[2] = { 0, num_tasks };
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pool = Pool_create(nthreads);
+    future_get(pool_submit(pool, fork_range, range));
+    pool_destroy(pool);
+    return num_tasks / elapsed(&start);
+}
+
+/*
+ * elapsed - Return the usecs since start
+ */
+double elapsed(struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e6 +
+	(now.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+/*
+ * The sbuf package, as in the book
+ */
+void sbuf_init(sbuf_t *sp, int n)
+{
+    sp->buf = Calloc(n, sizeof(void *));
+    sp->n = n;
+    sp->front = sp->rear = 0;
+    Sem_init(&sp->mutex, 0, 1);
+    Sem_init(&sp->slots, 0, n);
+    Sem_init(&sp->items, 0, 0);
+}
+
+void sbuf_deinit(sbuf_t *sp)
+{
+    Free(sp->buf);
+}
+
+void sbuf_insert(sbuf_t *sp, void *item)
+{
+    P(&sp->slots);
+    P(&sp->mutex);
+    sp->buf[(++sp->rear)%(sp->n)] = item;
+    V(&sp->mutex);
+    V(&sp->items);
+}
+
+void *sbuf_remove(sbuf_t *sp)
+{
+    void *item;
+
+    P(&sp->items);
+    P(&sp->mutex);
+    item = sp->buf[(++sp->front)%(sp->n)];
+    V(&sp->mutex);
+    V(&sp->slots);
+    return item;
+}
+
+/*
+ * usage - Print help message and terminate
+ */
+void usage(void)
+{
+    printf("Usage: poolbench [-h] [-t <threads>] [-n <tasks>] [-w <work>]\n");
+    printf("Compares the throughput of a semaphore-based bounded buffer,\n");
+    printf("the lock-free mpmc queue, and the work-stealing thread pool,\n");
+    printf("with 1, 2, 4, ... up to <threads> threads.\n");
+    printf("Options:\n");
+    printf("  -h            Print this message\n");
+    printf("  -t <threads>  Most threads (default and max %d)\n", MAXTHREADS);
+    printf("  -n <tasks>    Tasks per run (default 200000)\n");
+    printf("  -w <work>     Loop iterations per task (default 100)\n");
+    exit(1);
+}
@@ -0,0 +1,377 @@
+/*
+ * race.c - Wrappers for kill, waitpid, sigprocmask, setpgid and execve
+ *          that inject random delays to expose races in the shell
+ *
+ * fork.c perturbs the order in which parent and child run after fork.
+ * The other races in a shell sit around how signals, reaping, masking
+ * and process groups interleave, so this file wraps those calls the
+ * same way: given -Wl,--wrap,kill (and so on), the linker sends the
+ * shell's calls to kill to __wrap_kill, which may sleep before calling
+ * __real_kill. Nothing happens unless RACE_SPEC or RACE_REPLAY is set.
+ *
+ * RACE_SPEC is a comma-separated list of entries of the form
+ *
+ *     call[@site][:prob[:usecs]]
+ *
+ * where call is kill, waitpid, sigprocmask, setpgid, execve or * (any
+ * of them), site optionally restricts the entry to calls made from
+ * within a given function of the shell (e.g., sigchld_handler, either
+ * directly or through a wrapper like Kill), prob is the probability of
+ * a delay (default 0.5), and usecs bounds its length (default 10000).
+ * The first matching entry wins. For example:
+ *
+ *     RACE_SPEC="waitpid@sigchld_handler:1:2000,kill:0.3,*:0.1:500"
+ *
+ * RACE_SEED seeds the generator, so that a run can be repeated as long
+ * as the signals arrive in the same order; by default the seed comes
+ * from the time of day. RACE_LOG names a file to which every delay is
+ * appended, and RACE_REPLAY names such a file to replay exactly: each
+ * call then sleeps for whatever the log says, regardless of RACE_SPEC.
+ *
+ * A log line reads "<proc> <seq> <call> <usecs>", where seq counts the
+ * wrapped calls of a process and proc names the process: 0 for the
+ * shell, and "<parent>.<seq>" for a child that the parent forked right
+ * after its seq'th call. Unlike PIDs, these are the same in every run.
+ * A replay stays exact for as long as the shell makes the same calls
+ * in the same order; if, say, the SIGCHLD handler loops once more than
+ * it did, the delays after that land on different calls.
+ *
+ * The wrappers are called from signal handlers, so everything that
+ * runs on a call is async-signal-safe: no malloc, no stdio, and sites
+ * are resolved to address ranges at startup rather than on each call.
+ * Sites need the shell to be linked with -rdynamic (for dlsym) and
+ * compiled with frame pointers (to look a few frames up the stack).
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <link.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+/* Calls that we wrap */
+enum { RACE_KILL, RACE_WAITPID, RACE_SIGPROCMASK, RACE_SETPGID,
+       RACE_EXECVE, RACE_NCALLS, RACE_ANY = -1 };
+static char *callnames[] = { "kill", "waitpid", "sigprocmask", "setpgid",
+			     "execve" };
+
+#define MAXRULES 32             /* Max entries in RACE_SPEC */
+#define MAXREPLAY 16384         /* Max delays replayed from RACE_REPLAY */
+#define MAXPROC 64              /* Max length of a process name */
+#define SITE_FRAMES 3           /* How far up the stack a site can be */
+#define DEFAULT_PROB 0.5
+#define DEFAULT_USECS 10000
+
+/* One entry of RACE_SPEC */
+struct rule_t {
+    int call;                   /* RACE_* or RACE_ANY */
+    char *site;                 /* Function name, or NULL for anywhere */
+    unsigned long lo, hi;       /* Address range of site */
+    double prob;
+    long usecs;
+};
+
+/* One delay read from RACE_REPLAY */
+struct replay_t {
+    char proc[MAXPROC];
+    long seq;
+    int call;
+    long usecs;
+};
+
+static struct rule_t rules[MAXRULES];
+static int num_rules = 0;
+static struct replay_t *replay = NULL;
+static int num_replay = 0;
+static int logfd = -1;
+
+/* Per-process state, inherited (and then renamed) across fork */
+static unsigned long long state;  /* xorshift64* generator state */
+static pid_t owner;               /* Process that the state belongs to */
+static char proc[MAXPROC] = "0";  /* Name of this process */
+static long seq = 0;              /* Wrapped calls made so far */
+
+/* The real functions */
+int __real_kill(pid_t pid, int sig);
+pid_t __real_waitpid(pid_t pid, int *status, int options);
+int __real_sigprocmask(int how, const sigset_t *set, sigset_t *oldset);
+int __real_setpgid(pid_t pid, pid_t pgid);
+int __real_execve(const char *filename, char *const argv[],
+		  char *const envp[]);
+
+/*
+ * race_init - Parse RACE_SPEC, resolve its sites, and open the log or
+ *     load the replay file. Runs before main.
+ */
+static void __attribute__((constructor)) race_init(void)
+{
+    char *spec, *entry, *p, *seed;
+    char line[256];
+    struct rule_t *r;
+    struct timeval tv;
+    FILE *fp;
+    void *addr;
+    Dl_info info;
+    const ElfW(Sym) *sym;
+    int i;
+
+    owner = getpid();
+    if ((seed = getenv("RACE_SEED")) != NULL)
+	state = strtoull(seed, NULL, 10);
+    else {
+	gettimeofday(&tv, NULL);
+	state = tv.tv_sec * 1000000ULL + tv.tv_usec;
+    }
+    state = state * 2654435761ULL + 1;  /* Never zero */
+
+    if ((p = getenv("RACE_REPLAY")) != NULL) {
+	if ((fp = fopen(p, "r")) == NULL) {
+	    perror(p);
+	    exit(1);
+	}
+	replay = calloc(MAXREPLAY, sizeof(struct replay_t));
+	while (replay && num_replay < MAXREPLAY && fgets(line, sizeof(line), fp)) {
+	    struct replay_t *d = &replay[num_replay];
+	    char call[32];
+
+	    if (line[0] == '#' || sscanf(line, "%63s %ld %31s %ld", d->proc,
+					 &d->seq, call, &d->usecs) != 4)
+		continue;
+	    for (i = 0; i < RACE_NCALLS && strcmp(call, callnames[i]); i++)
+		;
+	    d->call = i;
+	    num_replay++;
+	}
+	fclose(fp);
+    }
+
+    if ((spec = getenv("RACE_SPEC")) != NULL && !replay) {
+	spec = strdup(spec);
+	for (entry = strtok(spec, ","); entry && num_rules < MAXRULES;
+	     entry = strtok(NULL, ",")) {
+	    r = &rules[num_rules];
+	    r->prob = DEFAULT_PROB;
+	    r->usecs = DEFAULT_USECS;
+	    if ((p = strchr(entry, ':')) != NULL) {
+		*p++ = '\0';
+		r->prob = atof(p);
+		if ((p = strchr(p, ':')) != NULL)
+		    r->usecs = atol(p + 1);
+	    }
+	    if ((p = strchr(entry, '@')) != NULL) {
+		*p++ = '\0';
+		r->site = p;
+	    }
+	    if (!strcmp(entry, "*"))
+		r->call = RACE_ANY;
+	    else {
+		for (i = 0; i < RACE_NCALLS && strcmp(entry, callnames[i]); i++)
+		    ;
+		if (i == RACE_NCALLS) {
+		    fprintf(stderr, "race: unknown call %s in RACE_SPEC\n", entry);
+		    exit(1);
+		}
+		r->call = i;
+	    }
+
+	    /* A site is the address range of a function */
+	    if (r->site) {
+		if ((addr = dlsym(RTLD_DEFAULT, r->site)) == NULL ||
+		    !dladdr1(addr, &info, (void **)&sym, RTLD_DL_SYMENT) ||
+		    sym == NULL) {
+		    fprintf(stderr, "race: unknown site %s in RACE_SPEC "
+			    "(link with -rdynamic)\n", r->site);
+		    exit(1);
+		}
+		r->lo = (unsigned long)addr;
+		r->hi = r->lo + (sym->st_size ? sym->st_size : 1);
+	    }
+	    num_rules++;
+	}
+    }
+
+    if ((p = getenv("RACE_LOG")) != NULL) {
+	if ((logfd = open(p, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0) {
+	    perror(p);
+	    exit(1);
+	}
+	if (!replay) {
+	    sprintf(line, "# seed %s spec %.200s\n", seed ? seed : "time",
+		    getenv("RACE_SPEC") ? getenv("RACE_SPEC") : "");
+	    write(logfd, line, strlen(line));
+	}
+    }
+}
+
+/*
+ * next_random - Return the next number from the generator (xorshift64*)
+ */
+static unsigned long long next_random(void)
+{
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 2685821657736338717ULL;
+}
+
+/*
+ * putnum - Append the decimal digits of n to the string at p
+ */
+static char *putnum(char *p, long n)
+{
+    char digits[24];
+    int i = 0;
+
+    if (n < 0) {
+	*p++ = '-';
+	n = -n;
+    }
+    do {
+	digits[i++] = '0' + n % 10;
+	n /= 10;
+    } while (n > 0);
+    while (i > 0)
+	*p++ = digits[--i];
+    return p;
+}
+
+/*
+ * in_site - Return true if any of the first few callers on the stack
+ *     lies within the address range of rule r's site. Walks the frame
+ *     pointer chain, so the shell must keep its frame pointers.
+ */
+static int in_site(struct rule_t *r, void *frame)
+{
+    void **fp = frame;
+    unsigned long ret;
+    int i;
+
+    for (i = 0; i < SITE_FRAMES && fp != NULL; i++) {
+	ret = (unsigned long)fp[1];
+	if (ret >= r->lo && ret < r->hi)
+	    return 1;
+	if ((void **)fp[0] <= fp)  /* Stacks grow down; stop if confused */
+	    break;
+	fp = (void **)fp[0];
+    }
+    return 0;
+}
+
+/*
+ * race - Called before every wrapped call. Decides on a delay, logs
+ *     it, and sleeps. Async-signal-safe.
+ */
+static void race(int call, void *frame)
+{
+    int i, olderrno = errno;
+    long usecs = 0;
+    char *p, line[MAXPROC + 64];
+    struct rule_t *r;
+    struct timespec ts;
+
+    if (num_rules == 0 && replay == NULL)
+	return;
+
+    /* First call in a new child: name it after its parent */
+    if (getpid() != owner) {
+	owner = getpid();
+	p = proc + strlen(proc);
+	if (p - proc < MAXPROC - 24) {
+	    *p++ = '.';
+	    *putnum(p, seq) = '\0';
+	}
+	seq = 0;
+	state ^= 0x9e3779b97f4a7c15ULL;
+	next_random();
+    }
+    seq++;
+
+    if (replay) {
+	for (i = 0; i < num_replay; i++) {
+	    if (replay[i].seq == seq && replay[i].call == call &&
+		!strcmp(replay[i].proc, proc)) {
+		usecs = replay[i].usecs;
+		break;
+	    }
+	}
+    }
+    else {
+	for (i = 0; i < num_rules; i++) {
+	    r = &rules[i];
+	    if ((r->call == RACE_ANY || r->call == call) &&
+		(!r->site || in_site(r, frame)))
+		break;
+	}
+	if (i < num_rules) {
+	    r = &rules[i];
+	    if ((next_random() >> 11) * (1.0 / 9007199254740992.0) < r->prob)
+		usecs = r->usecs ? next_random() % r->usecs : 0;
+	}
+    }
+    if (usecs == 0) {
+	errno = olderrno;
+	return;
+    }
+
+    if (logfd >= 0) {
+	p = line;
+	strcpy(p, proc);
+	p += strlen(proc);
+	*p++ = ' ';
+	p = putnum(p, seq);
+	*p++ = ' ';
+	strcpy(p, callnames[call]);
+	p += strlen(callnames[call]);
+	*p++ = ' ';
+	p = putnum(p, usecs);
+	*p++ = '\n';
+	write(logfd, line, p - line);
+    }
+
+    ts.tv_sec = usecs / 1000000;
+    ts.tv_nsec = (usecs % 1000000) * 1000;
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+	;
+    errno = olderrno;
+}
+
+/*
+ * The wrappers themselves
+ */
+int __wrap_kill(pid_t pid, int sig)
+{
+    race(RACE_KILL, __builtin_frame_address(0));
+    return __real_kill(pid, sig);
+}
+
+pid_t __wrap_waitpid(pid_t pid, int *status, int options)
+{
+    race(RACE_WAITPID, __builtin_frame_address(0));
+    return __real_waitpid(pid, status, options);
+}
+
+int __wrap_sigprocmask(int how, const sigset_t *set, sigset_t *oldset)
+{
+    race(RACE_SIGPROCMASK, __builtin_frame_address(0));
+    return __real_sigprocmask(how, set, oldset);
+}
+
+int __wrap_setpgid(pid_t pid, pid_t pgid)
+{
+    race(RACE_SETPGID, __builtin_frame_address(0));
+    return __real_setpgid(pid, pgid);
+}
+
+int __wrap_execve(const char *filename, char *const argv[],
+		  char *const envp[])
+{
+    race(RACE_EXECVE, __builtin_frame_address(0));
+    return __real_execve(filename, argv, envp);
+}
@@ -0,0 +1,255 @@
+/*
+ * riobench.c - Throughput benchmark for the Rio line readers
+ *
+ * A child process writes lines of random length down a pipe, in
+ * chunks of random size, and we read them back three ways:
+ *
+ *   blocking   rio_readlineb on a blocking pipe
+ *   nonblock   rio_readlineb_nonblock on a nonblocking pipe, from an
+ *              epoll loop, so that lines get split across readiness
+ *              events and have to be resumed
+ *   file       rio_readlineb and rio_readlineb_nonblock on the same
+ *              lines in a file, without the pipe in the way
+ *
+ * and check that each way got the same lines. Lines of MAXLINE bytes
+ * or more (see -l) are only read by the nonblocking reader, since
+ * rio_readlineb splits them.
+ *
+ * Usage: ./riobench [-h] [-n <lines>] [-l <maxlen>]
+ */
+#include "csapp.h"
+#include <sys/epoll.h>
+
+/* Modified by command line args */
+long num_lines = 500000;
+long max_len = 200;
+
+/* The lines, all in one buffer */
+char *data;
+size_t data_len;
+
+/* Prototypes */
+void usage(void);
+void make_data(void);
+pid_t start_writer(int *fdp);
+double read_blocking(int fd, long *lines, size_t *bytes);
+double read_nonblock(int fd, int use_epoll, long *lines, size_t *bytes);
+void report(char *name, double usecs, long lines, size_t bytes);
+double elapsed(struct timespec *start);
+
+int main(int argc, char **argv)
+{
+    int c, fd;
+    long lines;
+    size_t bytes;
+    double usecs;
+    char file[64];
+
+    while ((c = getopt(argc, argv, "hn:l:")) != EOF) {
+	switch (c) {
+	case 'n':             /* Lines per run */
+	    num_lines = atol(optarg);
+	    break;
+	case 'l':             /* Longest line */
+	    max_len = atol(optarg);
+	    break;
+	case 'h':
+	default:
+	    usage();
+	}
+    }
+    if (num_lines < 1 || max_len < 2)
+	usage();
+
+    make_data();
+    printf("%ld lines of 1 to %ld bytes (%.1f MB)\n", num_lines, max_len,
+	   data_len / 1e6);
+    printf("%-18s %10s %10s %12s\n", "reader", "MB/sec", "lines", "check");
+
+    /* Through a pipe */
+    if (max_len < MAXLINE) {
+	start_writer(&fd);
+	usecs = read_blocking(fd, &lines, &bytes);
+	report("pipe blocking", usecs, lines, bytes);
+	Close(fd);
+	wait(NULL);
+    }
+    start_writer(&fd);
+    usecs = read_nonblock(fd, 1, &lines, &bytes);
+    report("pipe nonblock", usecs, lines, bytes);
+    Close(fd);
+    wait(NULL);
+
+    /* From a file */
+    sprintf(file, "/tmp/riobench.%d", getpid());
+    fd = Open(file, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    unlink(file);
+    Rio_writen(fd, data, data_len);
+    if (max_len < MAXLINE) {
+	Lseek(fd, 0, SEEK_SET);
+	usecs = read_blocking(fd, &lines, &bytes);
+	report("file blocking", usecs, lines, bytes);
+    }
+    Lseek(fd, 0, SEEK_SET);
+    usecs = read_nonblock(fd, 0, &lines, &bytes);
+    report("file nonblock", usecs, lines, bytes);
+    Close(fd);
+    exit(0);
+}
+
+/*
+ * make_data - Make num_lines lines of 1 to max_len bytes, counting
+ *     the newline
+ */
+void make_data(void)
+{
+    long i, len;
+    size_t cap = 0;
+    unsigned int seed = 1;
+
+    data = NULL;
+    data_len = 0;
+    for (i = 0; i < num_lines; i++) {
+	len = 1 + rand_r(&seed) % max_len;
+	if (data_len + len > cap) {
+	    cap = cap ? 2*cap : 1 << 20;
+	    while (data_len + len > cap)
+		cap *= 2;
+	    data = Realloc(data, cap);
+	}
+	memset(data + data_len, 'a' + i % 26, len - 1);
+	data[data_len + len - 1] = '\n';
+	data_len += len;
+    }
+}
+
+/*
+ * start_writer - Fork a child that writes the lines to a pipe in
+ *     chunks of random size, and return the pipe's read end in *fdp
+ */
+pid_t start_writer(int *fdp)
+{
+    int fds[2];
+    pid_t pid;
+    size_t off, n;
+    unsigned int seed = 2;
+
+    if (pipe(fds) < 0)
+	unix_error("pipe error");
+    fflush(stdout);
+    if ((pid = Fork()) == 0) {
+	Close(fds[0]);
+	for (off = 0; off < data_len; off += n) {
+	    n = 1 + rand_r(&seed) % (2 * RIO_BUFSIZE);
+	    if (n > data_len - off)
+		n = data_len - off;
+	    Rio_writen(fds[1], data + off, n);
+	}
+	exit(0);
+    }
+    Close(fds[1]);
+    *fdp = fds[0];
+    return pid;
+}
+
+/*
+ * read_blocking - Read lines with rio_readlineb until EOF. Returns the
+ *     usecs it took.
+ */
+double read_blocking(int fd, long *lines, size_t *bytes)
+{
+    static rio_t rio;
+    static char buf[MAXLINE];
+    struct timespec start;
+    ssize_t n;
+
+    *lines = 0;
+    *bytes = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    Rio_readinitb(&rio, fd);
+    while ((n = Rio_readlineb(&rio, buf, MAXLINE)) > 0) {
+	(*lines)++;
+	*bytes += n;
+    }
+    return elapsed(&start);
+}
+
+/*
+ * read_nonblock - Read lines with rio_readlineb_nonblock until EOF,
+ *     waiting in epoll_wait whenever the pipe runs dry if use_epoll is
+ *     set. Returns the usecs it took.
+ */
+double read_nonblock(int fd, int use_epoll, long *lines, size_t *bytes)
+{
+    static rio_t rio;
+    struct timespec start;
+    struct epoll_event ev;
+    int epfd = -1;
+    ssize_t n;
+    char *line;
+
+    *lines = 0;
+    *bytes = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    Rio_readinitb_nonblock(&rio, fd);
+    if (use_epoll) {
+	if ((epfd = epoll_create1(0)) < 0)
+	    unix_error("epoll_create1 error");
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+	    unix_error("epoll_ctl error");
+    }
+    for (;;) {
+	if ((n = Rio_readlineb_nonblock(&rio, &line)) > 0) {
+	    (*lines)++;
+	    *bytes += n;
+	}
+	else if (n == 0)
+	    break;
+	else if (epoll_wait(epfd, &ev, 1, -1) < 0 && errno != EINTR)
+	    unix_error("epoll_wait error");
+    }
+    if (epfd >= 0)
+	Close(epfd);
+    rio_freeb(&rio);
+    return elapsed(&start);
+}
+
+/*
+ * report - Print one reader's throughput, and whether it read all of
+ *     the lines and bytes that were written
+ */
+void report(char *name, double usecs, long lines, size_t bytes)
+{
+    printf("%-18s %10.1f %10ld %12s\n", name, bytes / usecs, lines,
+	   (lines == num_lines && bytes == data_len) ? "ok" : "MISMATCH");
+    fflush(stdout);
+}
+
+/*
+ * elapsed - Return the usecs since start
+ */
+double elapsed(struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e6 +
+	(now.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+/*
+ * usage - Print help message and terminate
+ */
+void usage(void)
+{
+    printf("Usage: riobench [-h] [-n <lines>] [-l <maxlen>]\n");
+    printf("Compares the throughput of the blocking and nonblocking Rio\n");
+    printf("line readers.\n");
+    printf("Options:\n");
+    printf("  -h            Print this message\n");
+    printf("  -n <lines>    Lines to read (default 500000)\n");
+    printf("  -l <maxlen>   Longest line, counting the newline (default 200)\n");
+    exit(1);
+}
@@ -3,24 +3,90 @@
  *
  * Runs a tiny shell on a trace file.
  *
+ * With -P, the shell runs in a fresh user and PID namespace (with its
+ * own /proc), so the PIDs it prints are the same from run to run and
+ * concurrent runs can't see or signal each other's jobs. This needs no
+ * privileges beyond unprivileged user namespaces. PID 1 is a tiny init
+ * that reaps orphans, as in a normal system, so the shell is PID 2.
+ *
+ * With -L <file>, runtrace writes a timeline of the run to <file> as
+ * NDJSON, one event per line: each directive, the bytes sent to and
+ * received from the shell, prompts, job syncs and releases, signals,
+ * and timeouts, all stamped with microseconds since the start on the
+ * monotonic clock. tracelog renders and compares these logs. At the
+ * end come the measurements that jobs reported (see myprobe.c).
+ *
+ * With -A <file>, the shell runs with acct.so preloaded, which writes
+ * its allocations and syscalls per command to <file>; with -B, a
+ * command that goes over budget fails the trace.
+ *
+ * With -x, the shell and its jobs run under a seccomp filter that lets
+ * through only the syscalls that the traces need. A supervisor process
+ * gets every other syscall through seccomp user notification, prints
+ * it, and fails it with EPERM, and the trace fails.
+ *
+ * With -T (and -L), a tracer process follows the shell, but not its
+ * jobs, with PTRACE_SYSCALL, and the log ends with the number of each
+ * syscall that the shell made, and the time it spent in them, for
+ * each command, from the time runtrace sends it to the time it sends
+ * the next. "tracelog -y" renders them, or compares two shells.
+ *
+ * "DELAY <msecs>" pauses before the next directive, to replay the
+ * think time of a session that tshrec recorded; -F skips the pauses
+ * and replays the session as fast as the shell goes.
+ *
+ * The shell's stdin and stdout are a stream socket by default, so a
+ * trace can push any amount of job output through the shell; it lands
+ * in a RINGSIZE receive buffer. The last "tsh> " the shell has sent,
+ * recognized even when it is split over several reads, is its prompt
+ * once the shell blocks reading its input (per /proc/<pid>/syscall),
+ * so a job that prints "tsh> " can't fool it. Output that follows the
+ * prompt is kept for the next one. With -m seqpacket or -m dgram,
+ * each write of the shell is a record, and a prompt is a record that
+ * is just "tsh> ", as in the original driver. -V reports the
+ * throughput at the end.
+ *
  * Copyright (c) 2004, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
 #include <ctype.h>
 #include <errno.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/mount.h>
+#include <sys/prctl.h>
+#include <sys/ptrace.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <stddef.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <linux/audit.h>
+#include <sched.h>
+#include <dirent.h>
+#include <fcntl.h>
 #include "config.h"
+#include "jobsync.h"
 
 #define MAXBUF 1024
+#define MAXSYNCS 1024
+#define SETTLE_USECS 50   /* How often SETTLE looks at the shell */
+#define MAXTRACED 256     /* Commands that -T counts syscalls for */
+#define MAXSYSCALLS 512
+#define RINGSIZE (1 << 20) /* Receive buffer for the shell's output */
 
 /* 
  * Global variables 
@@ -28,6 +94,7 @@
 char buf[MAXBUF];
 char line[MAXBUF];
 char command[MAXBUF];
+char syncenv[MAXBUF];
 extern char **environ;
 char *state;
 
@@ -37,18 +104,108 @@ int sandboxing = 0;
 char *tracefile = NULL;
 char *shellprog = "./tsh";
 char *shellargs = NULL;
+int timeout = DRIVER_TIMEOUT;
+int sockets_only = 0;
+int vclock = 0;
+int pidns = 0;
+char *acctfile = NULL;
+char *acctbudget = NULL;
+int tracing = 0;
+int fast = 0;
+int transport = SOCK_STREAM;
 
 /* domain socket pairs */
 int datafd[2];
 int syncfd[2];
 
+/* shared-memory sync region, or -1 if jobs sync over syncfd */
+int syncshm = -1;
+
+/* Timeline log (-L), and the trace file line being executed */
+FILE *logfp = NULL;
+int lineno = 0;
+struct timespec log_start;
+
+/* Log an event; costs a single test when the log is disabled */
+#define TL(...) do { if (logfp) tl_event(__VA_ARGS__); } while (0)
+
+/* PID of the shell */
+pid_t shell_pid = 0;
+
+/*
+ * What the shell has sent: ring[rhead..rtail) is not yet printed, and
+ * ring[rhead..rscan) has been searched for the prompt. rcand is where
+ * a prompt starts that more output followed, rclen is its length, and
+ * rmatch is how much of a prompt ends at rscan. rbytes, received
+ * between the monotonic times rfirst and rlast (in ns), measure the
+ * throughput.
+ */
+char ring[RINGSIZE];
+int rhead = 0, rscan = 0, rtail = 0, rcand = -1, rclen = 0, rmatch = 0;
+long rbytes = 0, rfirst = 0, rlast = 0;
+
+/*
+ * Syscall counts (-T), shared with the tracer. Runtrace sets cmd as
+ * it sends each command, and the tracer charges each syscall to the
+ * command that was current when the syscall returned.
+ */
+struct sccount_t {
+    int count;
+    long nsecs;
+};
+struct sctable_t {
+    volatile int cmd;
+    struct sccount_t calls[MAXTRACED][MAXSYSCALLS];
+} *sctable = NULL;
+pid_t tracer_pid = 0;
+
+/* The sandbox (-x) supervisor, and the syscalls it has denied */
+pid_t supervisor_pid = 0;
+int sandfd[2];
+volatile int *violations;
+
+int traced_lines[MAXTRACED];     /* Trace file line of each command */
+char *traced_cmds[MAXTRACED];
+int num_traced = 0;
+
+/* PIDs of the jobs that have synced so far, in order (0 if unknown) */
+pid_t synced[MAXSYNCS];
+int nsynced = 0;
+
 /* Prototypes */
 void usage(char *msg);
 int blankline(char *str);
 void print_child_status(void);
 int next_prompt(void);
+int get_prompt(int initial);
+int shell_reading(void);
 int readable(int fd, int secs);
+int readable_until(int fd, int secs, int (*stop)(void));
 void clean(void);
+int wait_job(void);
+void signal_job(char *arg);
+int quiescent(pid_t root);
+int settle(void);
+int settled(pid_t root);
+int vclock_idle(int vdeadline, time_t rdeadline, int *quiet);
+void enter_pidns(void);
+void mount_proc(void);
+void run_init(void);
+pid_t host_pid(pid_t pid);
+void tl_open(char *filename);
+void tl_event(char *ev, char *fmt, ...);
+void tl_close(void);
+char *jsonstr(char *dst, char *src, int size);
+int acct_check(void);
+void strace_start(void);
+void strace_command(char *text);
+void strace_report(void);
+void run_tracer(pid_t pid, int readyfd);
+char *syscall_name(int nr);
+void sandbox_start(void);
+void sandbox_install(void);
+void run_supervisor(int sockfd);
+int sandbox_check(void);
 
 /*
  * sigalrm_handler - Notify when we timeout waiting for the child
@@ -70,12 +227,14 @@ int main(int argc, char **argv)
     FILE *tracefp;
     int n=0; /* keep gcc happy */
     struct stat statbuf;
+    char *logfile = NULL;
+    char esc[2*MAXBUF];
     
     /* Install the signal handler */
     signal(SIGALRM, sigalrm_handler);
 
     /* Parse the command line */
-    while ((c = getopt(argc, argv, "hVxs:f:")) != EOF) {
+    while ((c = getopt(argc, argv, "hVxCFPSTs:f:t:L:A:B:m:")) != EOF) {
         switch (c) {
         case 'h':             /* Print help message */
             usage("");
@@ -89,8 +248,45 @@ int main(int argc, char **argv)
 	case 'f':             /* Trace file name */
 	    tracefile = strdup(optarg);
 	    break;
-	case 'x':             /* Enable sandboxing */
-	    sandboxing = 1;   /* Hidden argument */
+	case 't':             /* Timeout in secs (default DRIVER_TIMEOUT) */
+	    timeout = atoi(optarg);
+	    break;
+	case 'L':             /* Write a timeline log */
+	    logfile = strdup(optarg);
+	    break;
+	case 'A':             /* Account for the shell's allocs and syscalls */
+	    acctfile = strdup(optarg);
+	    break;
+	case 'B':             /* Budget for -A, as <allocs>,<syscalls> */
+	    acctbudget = strdup(optarg);
+	    break;
+	case 'T':             /* Count the shell's syscalls per command */
+	    tracing = 1;
+	    break;
+	case 'C':             /* Run jobs on a virtual clock */
+	    vclock = 1;
+	    break;
+	case 'P':             /* Run the shell in its own PID namespace */
+	    pidns = 1;
+	    break;
+	case 'F':             /* Skip DELAY directives */
+	    fast = 1;
+	    break;
+	case 'S':             /* Sync with jobs over sockets only */
+	    sockets_only = 1;
+	    break;
+	case 'x':             /* Run the shell under a seccomp filter */
+	    sandboxing = 1;
+	    break;
+	case 'm':             /* Socket type for the shell's stdin and stdout */
+	    if (!strcmp(optarg, "stream"))
+		transport = SOCK_STREAM;
+	    else if (!strcmp(optarg, "seqpacket"))
+		transport = SOCK_SEQPACKET;
+	    else if (!strcmp(optarg, "dgram"))
+		transport = SOCK_DGRAM;
+	    else
+		usage("Transport (-m) must be stream, seqpacket or dgram");
 	    break;
 	default:
             usage("Unrecognized argument");
@@ -99,6 +295,8 @@ int main(int argc, char **argv)
 
     if (!tracefile)
 	  usage("Missing required argument (-f)");
+    if (tracing && !logfile)
+	  usage("Syscall tracing (-T) needs a timeline log (-L)");
     
     /* Make sure the requested shell is executable */
     if (stat(shellprog, &statbuf) < 0) {
@@ -116,11 +314,24 @@ int main(int argc, char **argv)
 	exit(1);
     }
 
-    /* Socket pair for data transfers between runtrace and shell */
-    if (socketpair(AF_LOCAL, SOCK_DGRAM, 0, datafd) < 0) {
+    /* Start the timeline log */
+    if (logfile) {
+	tl_open(logfile);
+	TL("start", "\"trace\":\"%s\",\"vclock\":%d,\"pidns\":%d", 
+	   jsonstr(esc, tracefile, sizeof(esc)), vclock, pidns);
+    }
+
+    /* 
+     * Socket pair for data transfers between runtrace and shell. The
+     * kernel caps the buffers at its own limits, and says nothing.
+     */
+    if (socketpair(AF_LOCAL, transport, 0, datafd) < 0) {
 	perror("socketpair datafd");
 	exit(1);
     }
+    n = RINGSIZE;
+    setsockopt(datafd[0], SOL_SOCKET, SO_RCVBUF, &n, sizeof(n));
+    setsockopt(datafd[1], SOL_SOCKET, SO_SNDBUF, &n, sizeof(n));
 
     /* Socket pair for synchronization between runtrace and shell jobs */
     if (socketpair(AF_LOCAL, SOCK_DGRAM, 0, syncfd) < 0) {
@@ -128,29 +339,69 @@ int main(int argc, char **argv)
 	exit(1);
     }
 
+    /* 
+     * Shared-memory region for synchronization between runtrace and
+     * shell jobs. Falls back to the socket pair if it isn't available.
+     */
+    if (!sockets_only)
+	syncshm = jobsync_create();
+
+    /* The virtual clock lives in the shared region */
+    if (vclock) {
+	if (syncshm < 0) {
+	    fprintf(stderr, "%s: Virtual clock (-C) needs shared-memory sync\n",
+		    tracefile);
+	    exit(1);
+	}
+	jobsync_virtual();
+    }
+
     /*
      * Create an environment variable that tells shell jobs
      * such as myspin which descriptor to synchronize on.
      */
-    sprintf(buf, "SYNCFD=%d", syncfd[1]);
-    if (putenv(buf) < 0) {
+    if (syncshm >= 0)
+	sprintf(syncenv, "SYNCSHM=%d", syncshm);
+    else
+	sprintf(syncenv, "SYNCFD=%d", syncfd[1]);
+    if (putenv(syncenv) < 0) {
 	perror("putenv");
 	exit(1);
     }
 
     if (verbose) {
-	printf("Created environment variable %s\n", buf);
+	printf("Created environment variable %s\n", syncenv);
+    }
+
+    /* The supervisor must stay out of the shell's PID namespace */
+    if (sandboxing)
+	sandbox_start();
+
+    /* 
+     * The next process we fork becomes PID 1 of the new namespace.
+     * Jobs sync with their namespace PIDs, so the clock needs a map.
+     */
+    if (pidns) {
+	enter_pidns();
+	jobsync_pidmap(host_pid);
     }
 
 
     /************************* 
      * Child code runs a shell
      *************************/ 
-    if ((child_pid  = fork()) == 0) {  
+    if ((shell_pid = child_pid = fork()) == 0) {  
 
 	/* Close the descriptor the child is not using */
 	close(datafd[0]);
 
+	/* Take the whole namespace down with us if runtrace dies */
+	if (pidns) {
+	    prctl(PR_SET_PDEATHSIG, SIGKILL);
+	    mount_proc();
+	    run_init();
+	}
+
 	/* Redirect stdin and stdout to the domain socket */
 	dup2(datafd[1], 0);
 	dup2(datafd[1], 1);
@@ -165,12 +416,19 @@ int main(int argc, char **argv)
 	    shellargv[1] = '\0';
 	}
 
-	/* Modify the environment if sandboxing is enabled */
-	if (sandboxing) {
-	    strcpy(line, "LD_PRELOAD=/usr/lib/libdl.so ./sandbox.so");
+	/* Modify the environment if accounting is enabled */
+	if (acctfile) {
+	    strcpy(line, "LD_PRELOAD=./acct.so");
+	    setenv("ACCT_LOG", acctfile, 1);
+	    if (acctbudget)
+		setenv("ACCT_BUDGET", acctbudget, 1);
 	    putenv(line);
 	}
 
+	/* The filter is the last thing, since it holds for the exec too */
+	if (sandboxing)
+	    sandbox_install();
+
 	/* Now go ahead and run the shell */
 	if (execve(shellprog, shellargv, environ) < 0) {
 	    perror("execve");
@@ -186,23 +444,17 @@ int main(int argc, char **argv)
     close(datafd[1]); 
 
     /* Read the initial prompt from the shell */
-    if (readable(datafd[0], DRIVER_TIMEOUT) == 0) {
-	fprintf(stderr, "%s: Runtrace timed out waiting for initial shell prompt\n", tracefile);
-        n = n; /* keep gcc happy */
-    }     
-    else {
-	bzero(buf, MAXBUF);
-	n = recv(datafd[0], buf, MAXBUF, 0);
-	if (strcmp(buf, PROMPT)) {
-	    fprintf(stderr, "%s: Runtrace expected initial shell prompt but got '%s' instead.\n", tracefile, buf);
-	    exit(1);
-	}
-    }
+    get_prompt(1);
+
+    /* Follow the shell's syscalls from here on */
+    if (tracing)
+	strace_start();
 
     /* 
      * Parent reads trace file and sends commands to the shell 
      */
     while (fgets(line, MAXBUF, tracefp)) {
+	lineno++;
 
 	/* Delete newline character */
 	line[strlen(line)-1] = '\0';
@@ -224,24 +476,21 @@ int main(int argc, char **argv)
 	sscanf(line, "%s", command);
 	if (verbose)
 	    printf("runtrace: command=%s line=%s\n", command, line);
+	TL("directive", "\"text\":\"%s\"", jsonstr(esc, line, sizeof(esc)));
 	
-	/* WAIT command */
+	/* WAIT [n] command: wait for n jobs (default 1) to sync */
 	if (!strcmp(command, "WAIT")) {
-	    if (readable(syncfd[0], DRIVER_TIMEOUT) == 0) {
-		printf("%s: Runtrace timed out waiting for sync from job\n", 
-		       tracefile);
-		exit(1);
-	    }
-	    else {
-		bzero(buf, MAXBUF);
-		if ((recv(syncfd[0], buf, MAXBUF, 0)) < 0) {
-		    perror("recv syncfd");
+	    n = 1;
+	    sscanf(line, "%*s %d", &n);
+	    while (n-- > 0) {
+		if (wait_job() == 0) {
+		    TL("timeout", "\"waiting\":\"sync\"");
+		    printf("%s: Runtrace timed out waiting for sync from job\n", 
+			   tracefile);
 		    exit(1);
 		}
-		if (verbose)
-		    printf("runtrace: received sync from job\n");
-		continue;
 	    }
+	    continue;
 	}
 
 
@@ -252,15 +501,37 @@ int main(int argc, char **argv)
 	    continue;
 	}
 
-	/* SIGNAL command */
+	/* SIGNAL [pid | @k | all] command: release synced jobs */
 	else if (!strcmp(command, "SIGNAL")) {
-	    bufp = "signal";
-	    if ((send(syncfd[0], bufp, strlen(bufp), 0)) < 0) {
-		perror("send syncfd");
+	    bzero(buf, MAXBUF);
+	    sscanf(line, "%*s %s", buf);
+	    signal_job(buf);
+	    continue;
+	}
+
+	/* SETTLE command: wait for the shell to reap all it can */
+	else if (!strcmp(command, "SETTLE")) {
+	    if (settle() == 0) {
+		TL("timeout", "\"waiting\":\"settle\"");
+		printf("%s: Runtrace timed out waiting for the shell to settle\n",
+		       tracefile);
 		exit(1);
 	    }
-	    if (verbose)
-		printf("runtrace: sent sync to shell job\n");
+	    continue;
+	}
+
+	/* DELAY msecs command: the user's think time in a recording */
+	else if (!strcmp(command, "DELAY")) {
+	    struct timespec ts;
+
+	    n = 0;
+	    sscanf(line, "%*s %d", &n);
+	    if (fast || n <= 0)
+		continue;
+	    ts.tv_sec = n / 1000;
+	    ts.tv_nsec = (n % 1000) * 1000000L;
+	    while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+		;
 	    continue;
 	}
 
@@ -272,6 +543,7 @@ int main(int argc, char **argv)
 	    }
 	    if (verbose)
 		printf("Runtrace sent SIGINT to process %d\n", child_pid);
+	    TL("signal", "\"sig\":\"SIGINT\"");
 	    continue;
 	}
 
@@ -283,6 +555,7 @@ int main(int argc, char **argv)
 	    }
 	    if (verbose)
 		printf("Runtrace sent SIGTSTP to process %d\n", child_pid);
+	    TL("signal", "\"sig\":\"SIGTSTP\"");
 	    continue;
 	}
 
@@ -291,35 +564,229 @@ int main(int argc, char **argv)
 	    if (verbose) {
 		printf("runtrace: Sending '%s' to shell\n", line);
 	    }
+	    if (tracing)
+		strace_command(line);
 	    strcat(line, "\n");
 	    if ((send(datafd[0], line, strlen(line), 0)) < 0) {
 		perror("send datafd[0]");
 		exit(1);
 	    }
+	    TL("send", "\"bytes\":%d", (int)strlen(line));
 	}
 
     } /* while loop */
 
     /* Signal EOF to the shell */
+    lineno = 0;
+    if (tracing)
+	strace_command("(shutdown)");
     bufp = "";
-    send(datafd[0], bufp, 0, 0);
+    if (transport == SOCK_DGRAM)
+	send(datafd[0], bufp, 0, 0);
+    else
+	shutdown(datafd[0], SHUT_WR);
+    TL("eof", "");
+    if (verbose && rlast > rfirst)
+	printf("runtrace: received %ld bytes from the shell in %.3f secs "
+	       "(%.1f MB/s)\n", rbytes, (rlast - rfirst) / 1e9, 
+	       rbytes * 1e3 / (rlast - rfirst));
+    TL("transport", "\"bytes\":%ld,\"usecs\":%ld", rbytes, 
+       (rlast - rfirst) / 1000);
 
     /* Wait for the shell to terminate */
-    alarm(DRIVER_TIMEOUT);
+    alarm(timeout);
     state = "waiting for shell to terminate";
+    if (tracing)   /* Reap it first, or a PID namespace can't go away */
+	waitpid(tracer_pid, NULL, 0);
     waitpid(child_pid, NULL, 0);
+    TL("exit", "");
+    if (tracing)
+	strace_report();
+
+    /* Pass along what the jobs measured (e.g., myprobe's latencies) */
+    if (syncshm >= 0) {
+	int *samples, i;
+
+	n = jobsync_samples(&samples);
+	for (i = 0; i < n; i++) {
+	    if (verbose)
+		printf("runtrace: job reported %d\n", samples[i]);
+	    TL("probe", "\"nsecs\":%d", samples[i]);
+	}
+    }
+
+    /* Fail if the shell went over its accounting budget */
+    if (acctfile && acct_check() > 0) {
+	clean();
+	exit(1);
+    }
 
     /* Kill any of our stray shells and jobs */
     clean();
+
+    /* Fail if the shell or a job made a syscall outside the sandbox */
+    if (sandboxing && sandbox_check() > 0)
+	exit(1);
     exit(0);
 }
 
 
+/*
+ * wait_job - Wait for the next job to sync with us.
+ *            Returns 1 if OK, 0 on timeout.
+ */
+int wait_job(void)
+{
+    pid_t pid;
+
+    /* Shared memory tells us which job it was */
+    if (syncshm >= 0) {
+	if (vclock) {
+	    int vdeadline = jobsync_now() + 1000*timeout;
+	    time_t rdeadline = time(NULL) + timeout;
+	    int quiet = 0;
+
+	    while ((pid = jobsync_await(1)) == 0)
+		if (vclock_idle(vdeadline, rdeadline, &quiet))
+		    return 0;
+	}
+	else if ((pid = jobsync_await(1000*timeout)) == 0)
+	    return 0;
+
+	/* The sync still counts if the job's identity was lost */
+	if (pid < 0) {
+	    if (nsynced < MAXSYNCS)
+		synced[nsynced++] = 0;
+	    if (verbose)
+		printf("runtrace: received sync from unknown job\n");
+	    TL("sync", "\"pid\":null");
+	    return 1;
+	}
+	if (nsynced < MAXSYNCS)
+	    synced[nsynced++] = pid;
+	if (verbose)
+	    printf("runtrace: received sync from job %d\n", pid);
+	TL("sync", "\"pid\":%d", pid);
+	return 1;
+    }
+
+    if (readable(syncfd[0], timeout) == 0)
+	return 0;
+    bzero(buf, MAXBUF);
+    if ((recv(syncfd[0], buf, MAXBUF, 0)) < 0) {
+	perror("recv syncfd");
+	exit(1);
+    }
+    if (verbose)
+	printf("runtrace: received sync from job\n");
+    TL("sync", "");
+    return 1;
+}
+
+/*
+ * signal_job - Release the job named by arg: a PID, "@k" for the k-th
+ *              job to sync, "all" for every job that is waiting, or ""
+ *              for whichever job is waiting
+ */
+void signal_job(char *arg)
+{
+    pid_t pid = 0;
+    int k;
+    char *bufp;
+
+    /* Ignore trailing comments, as in "SIGNAL # restart myspin" */
+    if (arg[0] == '#')
+	arg[0] = '\0';
+
+    /* Over the socket we can't tell the jobs apart */
+    if (syncshm < 0) {
+	if (arg[0]) {
+	    printf("%s: SIGNAL %s needs shared-memory sync (no -S)\n", 
+		   tracefile, arg);
+	    exit(1);
+	}
+	bufp = "signal";
+	if ((send(syncfd[0], bufp, strlen(bufp), 0)) < 0) {
+	    perror("send syncfd");
+	    exit(1);
+	}
+	if (verbose)
+	    printf("runtrace: sent sync to shell job\n");
+	TL("release", "");
+	return;
+    }
+
+    /* SIGNAL all releases every waiting job with one wakeup */
+    if (!strcmp(arg, "all")) {
+	k = jobsync_release_all();
+	if (verbose)
+	    printf("runtrace: sent sync to %d shell jobs\n", k);
+	TL("release", "\"jobs\":%d", k);
+	return;
+    }
+
+    if (arg[0] == '@') {
+	k = atoi(arg + 1);
+	if (k < 1 || k > nsynced) {
+	    printf("%s: No job %s has synced with runtrace\n", tracefile, arg);
+	    exit(1);
+	}
+	if ((pid = synced[k-1]) == 0) {
+	    printf("%s: Can't tell which job was %s to sync\n", 
+		   tracefile, arg);
+	    exit(1);
+	}
+    }
+    else if (arg[0])
+	pid = atoi(arg);
+
+    if (jobsync_release(pid) < 0) {
+	printf("%s: Job %d has not synced with runtrace\n", tracefile, pid);
+	exit(1);
+    }
+    if (verbose) {
+	if (pid)
+	    printf("runtrace: sent sync to shell job %d\n", pid);
+	else
+	    printf("runtrace: sent sync to shell job\n");
+    }
+    TL("release", "\"pid\":%d", pid);
+}
+
 /*
  * clean - clean up any stray jobs or shells 
  */
 void clean() {
-    system("/bin/kill -9 tsh tshref mytstpp mytstps mycat myenv myintp myints myspin1 myspin2 mysplit > /dev/null 2>&1");
+    /* Killing our init kills every process in the namespace */
+    if (pidns) {
+	kill(shell_pid, SIGKILL);
+	return;
+    }
+    system("/bin/kill -9 tsh tshref mytstpp mytstps mycat myenv myintp myints myspin1 myspin2 mysplit mystorm myprobe > /dev/null 2>&1");
+}
+
+/*
+ * acct_check - Print the cycles that went over the budget, as written
+ *     by acct.so to the -A log, and return how many there were
+ */
+int acct_check(void)
+{
+    FILE *fp;
+    int n = 0;
+
+    if ((fp = fopen(acctfile, "r")) == NULL) {
+	printf("%s: No accounting log from the shell in %s\n", tracefile,
+	       acctfile);
+	return 1;
+    }
+    while (fgets(buf, MAXBUF, fp)) {
+	if (!strncmp(buf, "BUDGET", 6)) {
+	    printf("%s: %s", tracefile, buf);
+	    n++;
+	}
+    }
+    fclose(fp);
+    return n;
 }
 
 /*
@@ -328,11 +795,27 @@ void clean() {
 void usage(char *msg)
 {
     printf("%s\n", msg);
-    printf("Usage: runtrace -f <file> -s <shellprog> [-hV]\n");
+    printf("Usage: runtrace -f <file> -s <shellprog> [-hCFPSTVx] [-t <secs>] [-L <file>]\n");
+    printf("                [-A <file> [-B <allocs>,<syscalls>]] [-m <type>]\n");
     printf("Options:\n");
     printf("  -h            Print this message\n");
     printf("  -s <shell>    Shell program to test (default ./tsh)\n");
     printf("  -f <file>     Trace file\n");
+    printf("  -t <secs>     Timeout while waiting for the shell (default %d)\n",
+	   DRIVER_TIMEOUT);
+    printf("  -S            Sync with jobs over a socket, not shared memory\n");
+    printf("  -C            Run job timeouts on a virtual clock\n");
+    printf("  -P            Run the shell in a new PID namespace\n");
+    printf("  -F            Skip DELAY directives (replay as fast as possible)\n");
+    printf("  -L <file>     Write a timeline of the run to <file> (NDJSON)\n");
+    printf("  -T            With -L, log the shell's syscalls per command\n");
+    printf("  -x            Run the shell and jobs in a seccomp sandbox\n");
+    printf("  -m <type>     Talk to the shell over a stream (default),\n");
+    printf("                seqpacket or dgram socket\n");
+    printf("  -A <file>     Count the shell's allocs and syscalls per command\n");
+    printf("                into <file> (preloads acct.so)\n");
+    printf("  -B <a>,<s>    With -A, fail if a command cycle makes more than\n");
+    printf("                <a> allocs or <s> syscalls (-1 for no limit)\n");
     printf("  -V            Be more verbose\n");
 
     exit(0);
@@ -404,69 +887,1054 @@ void print_child_status()
  */
 int next_prompt(void)
 {
-    int n;
-    
-    bzero(buf, MAXBUF);
-    if (readable(datafd[0], DRIVER_TIMEOUT) == 0) {
-	printf("%s: Runtrace timed out waiting for next shell prompt\n", 
-	       tracefile);
-	print_child_status();
-	return 0;
+    return get_prompt(0);
+}
+
+/*
+ * ring_out - Print the shell's output in the ring up to ring[end]. Any
+ *     output before the initial prompt is an error.
+ */
+void ring_out(int end, int initial)
+{
+    if (end <= rhead)
+	return;
+    if (initial) {
+	fprintf(stderr, "%s: Runtrace expected initial shell prompt but "
+		"got '%.*s' instead.\n", tracefile, end - rhead, ring + rhead);
+	exit(1);
     }
-    else {
-	if ((n = recv(datafd[0], buf, MAXBUF, 0)) < 0) {
-	    perror("next_prompt:recv1");
-	    exit(1);
-	}
-	else if (n == 0) { /* EOF */
-	    return 0;
-	} 
+    fwrite(ring + rhead, 1, end - rhead, stdout);
+    rhead = end;
+}
+
+/*
+ * ring_recv - Receive what the shell has sent into the ring. A record
+ *     (on a dgram or seqpacket socket) always arrives whole, since the
+ *     ring is empty when one is received. Returns the number of bytes,
+ *     or 0 on EOF.
+ */
+int ring_recv(void)
+{
+    struct timespec now;
+    int n, size;
+
+    /* Make room: all that we keep is an unconfirmed prompt and on */
+    if (rhead > 0) {
+	memmove(ring, ring + rhead, rtail - rhead);
+	rscan -= rhead;
+	rtail -= rhead;
+	if (rcand >= 0)
+	    rcand -= rhead;
+	rhead = 0;
+    }
+    if (rtail == RINGSIZE) {  /* too much output after it to be one */
+	rcand = -1;
+	ring_out(rscan - rmatch, 0);
+	return ring_recv();
     }
 
-    while(strcmp(buf, PROMPT)) {
-	printf("%s", buf);
+    if (transport != SOCK_STREAM &&
+	(size = recv(datafd[0], NULL, 0, MSG_PEEK | MSG_TRUNC)) > RINGSIZE)
+	TL("truncated", "\"bytes\":%d", size);
+    if ((n = recv(datafd[0], ring + rtail, RINGSIZE - rtail, 0)) < 0) {
+	perror("get_prompt:recv");
+	exit(1);
+    }
+    rtail += n;
+    if (n > 0) {
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	rlast = now.tv_sec * 1000000000L + now.tv_nsec;
+	if (rbytes == 0)
+	    rfirst = rlast;
+	rbytes += n;
+	TL("recv", "\"bytes\":%d", n);
+    }
+    return n;
+}
 
-	bzero(buf, MAXBUF);
-	if (readable(datafd[0], DRIVER_TIMEOUT) == 0) {
-	    printf("%s: Runtrace timed out waiting for next shell prompt\n", 
-		   tracefile);
-	    print_child_status();
-	    return 0;
+/*
+ * get_prompt - Read, and print, the shell's output up to its next prompt.
+ *     Output that follows the prompt stays in the ring for the next
+ *     time. Returns 1 if OK, 0 on EOF or timeout.
+ */
+int get_prompt(int initial)
+{
+    int plen = strlen(PROMPT), p2len = strlen(PROMPT2), n;
+
+    while (1) {
+	if (transport != SOCK_STREAM && rtail > rhead) {
+	    /* A record is either just a prompt or just output */
+	    if ((rtail - rhead == plen && !memcmp(ring + rhead, PROMPT, plen)) ||
+		(!initial && rtail - rhead == p2len && 
+		 !memcmp(ring + rhead, PROMPT2, p2len))) {
+		rhead = rscan = rtail = 0;
+		break;
+	    }
+	    ring_out(rtail, initial);
+	    rscan = rtail;
 	}
-	else {
-	    if ((n = recv(datafd[0], buf, MAXBUF, 0)) < 0) {
-		perror("next_prompt:recv1");
-		exit(1);
+	else if (transport == SOCK_STREAM) {
+	    /* A continuation prompt is one only at the end of the output */
+	    if (rcand >= 0 && rclen == p2len && rcand + rclen < rtail)
+		rcand = -1;
+
+	    /* Find the prompt, even if it came in pieces */
+	    for (; rscan < rtail; rscan++) {
+		if (ring[rscan] == PROMPT[rmatch])
+		    rmatch++;
+		else
+		    rmatch = (ring[rscan] == PROMPT[0]);
+		if (rmatch == plen) {
+		    if (rcand >= 0)
+			ring_out(rcand + rclen, initial);
+		    rcand = rscan + 1 - plen;
+		    rclen = plen;
+		    rmatch = 0;
+		}
 	    }
-	    else if (n == 0) { /* EOF */
-		return 0;
-	    } 
+
+	    /* 
+	     * The shell asks for the rest of a compound command with
+	     * PROMPT2, which "tsh> " itself ends with
+	     */
+	    if (!initial && rmatch == 0 && rtail - rhead >= p2len &&
+		(rcand < 0 || rcand + rclen <= rtail - p2len) &&
+		!memcmp(ring + rtail - p2len, PROMPT2, p2len)) {
+		if (rcand >= 0)
+		    ring_out(rcand + rclen, initial);
+		rcand = rtail - p2len;
+		rclen = p2len;
+	    }
+	    ring_out(rcand >= 0 ? rcand : rscan - rmatch, initial);
+	}
+
+	/* 
+	 * A job's output can contain "tsh> " too, so the last "tsh> " is
+	 * the shell's prompt only once the shell blocks reading its next
+	 * command, and we've read all that it sent before that. Anything
+	 * after the prompt is then for the next one.
+	 */
+	n = readable_until(datafd[0], timeout, rcand >= 0 ? shell_reading : NULL);
+	if (n < 0) {
+	    ring_out(rcand, initial);
+	    rhead = rcand + rclen;
+	    rcand = -1;
+	    break;
+	}
+	if (n == 0) {
+	    TL("timeout", "\"waiting\":\"prompt\"");
+	    if (initial)
+		fprintf(stderr, "%s: Runtrace timed out waiting for initial shell prompt\n", tracefile);
+	    else {
+		printf("%s: Runtrace timed out waiting for next shell prompt\n", 
+		       tracefile);
+		print_child_status();
+	    }
+	    return 0;
+	}
+	if (ring_recv() == 0) { /* EOF */
+	    rcand = -1;
+	    ring_out(rtail, 0);
+	    return 0;
 	}
     }
+    TL("prompt", "");
     return 1;
 }
 
+/*
+ * shell_reading - Return true if the shell is blocked reading its input
+ */
+int shell_reading(void)
+{
+    static pid_t pid = 0;
+    char path[64], sc[64];
+    int fd, len, nr;
+    unsigned long fdarg;
+
+    if (pid == 0 && (pid = pidns ? host_pid(2) : shell_pid) == 0)
+	return 0;
+    sprintf(path, "/proc/%d/syscall", pid);
+    if ((fd = open(path, O_RDONLY)) < 0)
+	return 1;   /* can't tell, so trust the prompt */
+    len = read(fd, sc, sizeof(sc) - 1);
+    close(fd);
+    if (len <= 0)
+	return 1;
+    sc[len] = '\0';
+    return sscanf(sc, "%d %lx", &nr, &fdarg) == 2 && nr == SYS_read &&
+	fdarg == 0;
+}
+
 /*
  * readable - Wait secs seconds for descriptor fd to become readable
  *            Return > 0 if fd is readable, 0 if timeout.
  */
 int readable(int fd, int secs) 
 {
-    int n;
+    return readable_until(fd, secs, NULL);
+}
+
+/*
+ * readable_until - Like readable, but also give up, and return -1, once
+ *     stop() is true and fd still has nothing to read, if stop isn't
+ *     NULL. stop() is tested first, so that whatever was sent before it
+ *     became true is read before we give up.
+ */
+int readable_until(int fd, int secs, int (*stop)(void))
+{
+    int n, stopped;
+    int vdeadline, quiet = 0, slices = vclock || stop;
+    time_t rdeadline = time(NULL) + secs;
 
     fd_set rset;
     struct timeval tv;
 
-    FD_ZERO(&rset);
-    FD_SET(fd, &rset);
+    /* 
+     * On a virtual clock, poll in 1 ms slices and let time jump
+     * ahead whenever everything is blocked 
+     */
+    vdeadline = vclock ? jobsync_now() + 1000*secs : 0;
+    do {
+	stopped = stop && stop();
+
+	FD_ZERO(&rset);
+	FD_SET(fd, &rset);
 
-    tv.tv_sec = secs;
-    tv.tv_usec = 0;
+	tv.tv_sec = slices ? 0 : secs;
+	tv.tv_usec = stopped ? 0 : slices ? 1000 : 0;
     
-    if ((n = select(fd+1, &rset, NULL, NULL, &tv)) < 0) {
-	perror("select");
+	if ((n = select(fd+1, &rset, NULL, NULL, &tv)) < 0) {
+	    perror("select");
+	    exit(1);
+	}
+	if (n == 0 && stopped)
+	    return -1;
+    } while (n == 0 && (vclock ? !vclock_idle(vdeadline, rdeadline, &quiet)
+			: slices && time(NULL) < rdeadline));
+
+    return n;
+}
+
+/*
+ * vclock_idle - Called by the wait loops each time a 1 ms poll comes
+ *     up empty. Once the shell and its jobs have been blocked for two
+ *     polls in a row, move the virtual clock to the next job alarm, or
+ *     to vdeadline if that comes first. Returns 1 if vdeadline passed,
+ *     or if the real-time deadline rdeadline passed because something
+ *     kept running.
+ */
+int vclock_idle(int vdeadline, time_t rdeadline, int *quiet)
+{
+    int next;
+
+    if (time(NULL) > rdeadline)
+	return 1;
+
+    if (!quiescent(shell_pid)) {
+	*quiet = 0;
+	return 0;
+    }
+    if (++*quiet < 2)
+	return 0;
+    *quiet = 0;
+
+    next = jobsync_next_deadline();
+    if (next && next < vdeadline) {
+	if (verbose)
+	    printf("runtrace: virtual clock advanced to %d ms\n", next);
+	jobsync_advance(next);
+	TL("vclock", "\"now\":%d", next);
+	return 0;
+    }
+    jobsync_advance(vdeadline);
+    TL("vclock", "\"now\":%d", vdeadline);
+    return 1;
+}
+
+/*
+ * quiescent - Return true if process root and all of its descendants
+ *     are blocked, that is, sleeping, stopped or dead. A process that
+ *     sleeps on a real timer (e.g., the random delay that fork.c adds)
+ *     will wake up on its own, so it counts as running, and so does one
+ *     whose wait channel the kernel can't tell us (it says "0"; this
+ *     happens for a task that is just going to sleep). We only walk
+ *     root's subtree, since this runs every millisecond.
+ */
+int quiescent(pid_t root)
+{
+    int fd, len;
+    char path[64], stat[MAXBUF], *p, *end;
+    pid_t child;
+
+    /* The stat file looks like "pid (comm) S ..." */
+    sprintf(path, "/proc/%d/stat", root);
+    if ((fd = open(path, O_RDONLY)) < 0)
+	return 1;
+    len = read(fd, stat, MAXBUF - 1);
+    close(fd);
+    stat[len > 0 ? len : 0] = '\0';
+    if ((p = strrchr(stat, ')')) == NULL || p[1] == '\0')
+	return 1;
+    if (p[2] == 'R' || p[2] == 'D')
+	return 0;
+
+    /* Sleeping, but on what? */
+    if (p[2] == 'S') {
+	sprintf(path, "/proc/%d/wchan", root);
+	if ((fd = open(path, O_RDONLY)) >= 0) {
+	    len = read(fd, stat, MAXBUF - 1);
+	    close(fd);
+	    stat[len > 0 ? len : 0] = '\0';
+	    if (strstr(stat, "nanosleep") || !strcmp(stat, "0"))
+		return 0;
+	}
+    }
+
+    /* Now the same for each of its children */
+    sprintf(path, "/proc/%d/task/%d/children", root, root);
+    if ((fd = open(path, O_RDONLY)) < 0)
+	return 1;
+    len = read(fd, stat, MAXBUF - 1);
+    close(fd);
+    stat[len > 0 ? len : 0] = '\0';
+    for (p = stat; (child = strtol(p, &end, 10)) > 0; p = end)
+	if (!quiescent(child))
+	    return 0;
+    return 1;
+}
+
+/*
+ * settle - Wait until the shell has reaped every child that it can
+ *     and gone back to sleep, as after a burst of jobs exit or stop.
+ *     Polls every SETTLE_USECS, so the time it logs is only that fine.
+ *     Returns 1 if OK, 0 on timeout.
+ */
+int settle(void)
+{
+    struct timespec start, now, ts = {0, SETTLE_USECS * 1000};
+    long usecs;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (1) {
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	usecs = (now.tv_sec - start.tv_sec) * 1000000L +
+	    (now.tv_nsec - start.tv_nsec) / 1000;
+	if (settled(shell_pid))
+	    break;
+	if (usecs > 1000000L * timeout)
+	    return 0;
+	nanosleep(&ts, NULL);
+    }
+    if (verbose)
+	printf("runtrace: shell settled after %ld usecs\n", usecs);
+    TL("settle", "\"usecs\":%ld", usecs);
+    return 1;
+}
+
+/*
+ * settled - Return true if process root and its descendants are
+ *     quiescent, none of them is a zombie waiting to be reaped, and
+ *     none has a signal (say, a SIGCHLD) pending
+ */
+int settled(pid_t root)
+{
+    FILE *fp;
+    char path[64], line[MAXBUF], *p, *end;
+    pid_t child;
+    int ok = 1, stopped = 0;
+
+    /* Signals pending on a stopped job can wait until it's continued */
+    sprintf(path, "/proc/%d/status", root);
+    if ((fp = fopen(path, "r")) == NULL)
+	return 1;
+    while (ok && fgets(line, MAXBUF, fp)) {
+	if (!strncmp(line, "State:", 6)) {
+	    p = line + 6 + strspn(line + 6, " \t");
+	    ok = (*p != 'Z');
+	    stopped = (*p == 'T' || *p == 't');
+	}
+	else if ((!strncmp(line, "SigPnd:", 7) || !strncmp(line, "ShdPnd:", 7))
+		 && !stopped && strtoull(line + 7, NULL, 16) != 0)
+	    ok = 0;
+    }
+    fclose(fp);
+    if (!ok)
+	return 0;
+
+    sprintf(path, "/proc/%d/task/%d/children", root, root);
+    if ((fp = fopen(path, "r")) == NULL)
+	return 1;
+    if (fgets(line, MAXBUF, fp) == NULL)
+	line[0] = '\0';
+    fclose(fp);
+    for (p = line; (child = strtol(p, &end, 10)) > 0; p = end)
+	if (!settled(child))
+	    return 0;
+    return quiescent(root);
+}
+
+/*
+ * enter_pidns - Move into a new user namespace, where we map ourselves
+ *     to root so that we may create a PID namespace (and later mount
+ *     /proc), and then into a new PID namespace for our next child
+ */
+void enter_pidns(void)
+{
+    int fd;
+    char map[64];
+    uid_t uid = getuid();
+    gid_t gid = getgid();
+
+    if (unshare(CLONE_NEWUSER | CLONE_NEWPID) < 0) {
+	perror("unshare");
 	exit(1);
     }
 
-    return n;
+    /* setgroups must be denied before an unprivileged gid_map write */
+    if ((fd = open("/proc/self/setgroups", O_WRONLY)) >= 0) {
+	write(fd, "deny", 4);
+	close(fd);
+    }
+    sprintf(map, "0 %d 1", (int)uid);
+    if ((fd = open("/proc/self/uid_map", O_WRONLY)) < 0 ||
+	write(fd, map, strlen(map)) < 0) {
+	perror("uid_map");
+	exit(1);
+    }
+    close(fd);
+    sprintf(map, "0 %d 1", (int)gid);
+    if ((fd = open("/proc/self/gid_map", O_WRONLY)) < 0 ||
+	write(fd, map, strlen(map)) < 0) {
+	perror("gid_map");
+	exit(1);
+    }
+    close(fd);
+}
+
+/*
+ * mount_proc - Give the namespace's PID 1 a private /proc of its own,
+ *     so that helpers like mypsgrep only see processes in the namespace
+ */
+void mount_proc(void)
+{
+    if (unshare(CLONE_NEWNS) < 0 ||
+	mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) < 0 ||
+	mount("proc", "/proc", "proc", MS_NOSUID | MS_NODEV | MS_NOEXEC,
+	      NULL) < 0) {
+	perror("mount /proc");
+	exit(1);
+    }
+}
+
+/*
+ * run_init - Stand in as PID 1 of the namespace. Forks the shell, which
+ *     returns to the caller, then forwards runtrace's signals to it and
+ *     reaps orphaned jobs until it exits.
+ */
+pid_t init_shell;
+
+void init_handler(int sig)
+{
+    kill(init_shell, sig);
+}
+
+void run_init(void)
+{
+    int status;
+    pid_t pid;
+
+    if ((init_shell = fork()) < 0) {
+	perror("fork");
+	exit(1);
+    }
+    if (init_shell == 0)
+	return;
+
+    close(datafd[1]);
+    signal(SIGINT, init_handler);
+    signal(SIGTSTP, init_handler);
+    signal(SIGQUIT, init_handler);
+    signal(SIGALRM, SIG_DFL);
+
+    while ((pid = wait(&status)) != init_shell)
+	if (pid < 0 && errno == ECHILD)
+	    exit(1);
+    exit(WIFEXITED(status) ? WEXITSTATUS(status) : 1);
+}
+
+/*
+ * host_pid - Map a PID in the shell's namespace to our PID for the
+ *     same process, or return 0 if there is no such process
+ */
+pid_t host_pid(pid_t pid)
+{
+    DIR *dirp;
+    struct dirent *de;
+    char path[64], ns[64], myns[64], status[MAXBUF], *p, *q;
+    int fd, len;
+    pid_t host = 0, inner;
+
+    sprintf(path, "/proc/%d/ns/pid", shell_pid);
+    if ((len = readlink(path, myns, sizeof(myns) - 1)) < 0)
+	return 0;
+    myns[len] = '\0';
+
+    if ((dirp = opendir("/proc")) == NULL)
+	return 0;
+    while (!host && (de = readdir(dirp)) != NULL) {
+	if (!isdigit(de->d_name[0]))
+	    continue;
+
+	/* The NSpid line lists our PID first and the innermost last */
+	sprintf(path, "/proc/%.16s/status", de->d_name);
+	if ((fd = open(path, O_RDONLY)) < 0)
+	    continue;
+	len = read(fd, status, MAXBUF - 1);
+	close(fd);
+	status[len > 0 ? len : 0] = '\0';
+	if ((p = strstr(status, "NSpid:")) == NULL)
+	    continue;
+	if ((q = strchr(p, '\n')) != NULL)
+	    *q = '\0';
+	if ((p = strrchr(p, '\t')) == NULL || (inner = atoi(p + 1)) != pid)
+	    continue;
+
+	/* Different runs reuse the same inner PIDs */
+	sprintf(path, "/proc/%.16s/ns/pid", de->d_name);
+	if ((len = readlink(path, ns, sizeof(ns) - 1)) < 0)
+	    continue;
+	ns[len] = '\0';
+	if (!strcmp(ns, myns))
+	    host = atoi(de->d_name);
+    }
+    closedir(dirp);
+    return host;
+}
+
+/*
+ * strace_start - Start a tracer process that follows the shell's
+ *     syscalls, and wait until it has hold of the shell. Counting
+ *     starts at the first prompt, and charges the shell's syscalls to
+ *     "(startup)" until runtrace sends the first command.
+ *
+ *     This could filter in the kernel with seccomp (SECCOMP_RET_TRACE
+ *     or user notification) instead of stopping the shell at every
+ *     syscall, but a filter has to be installed by the shell itself
+ *     before it runs and is inherited by every job, so it would stop
+ *     the jobs as well, and without a tracer they would fail their
+ *     syscalls with ENOSYS; nor does it see syscalls return, so it
+ *     can't time them. The shell alone makes few enough syscalls that
+ *     two stops per syscall cost little.
+ */
+void strace_start(void)
+{
+    int fds[2];
+    char c;
+    pid_t pid = pidns ? 2 : shell_pid;   /* We fork into the namespace */
+
+    sctable = mmap(NULL, sizeof(struct sctable_t), PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (sctable == MAP_FAILED) {
+	perror("mmap");
+	exit(1);
+    }
+    strace_command("(startup)");
+
+    if (pipe(fds) < 0) {
+	perror("pipe");
+	exit(1);
+    }
+    fflush(stdout);
+    if (logfp)
+	fflush(logfp);
+    if ((tracer_pid = fork()) < 0) {
+	perror("fork");
+	exit(1);
+    }
+    if (tracer_pid == 0) {
+	close(fds[0]);
+	prctl(PR_SET_PDEATHSIG, SIGKILL);
+	signal(SIGALRM, SIG_DFL);
+	run_tracer(pid, fds[1]);
+	_exit(0);
+    }
+
+    /* The tracer closes its end without writing if it can't attach */
+    close(fds[1]);
+    if (read(fds[0], &c, 1) != 1) {
+	fprintf(stderr, "%s: Runtrace unable to trace the shell (pid %d)\n",
+		tracefile, (int)pid);
+	clean();
+	exit(1);
+    }
+    close(fds[0]);
+    if (verbose)
+	printf("runtrace: tracer %d is following shell %d\n",
+	       (int)tracer_pid, (int)pid);
+}
+
+/*
+ * strace_command - Charge the shell's syscalls from now on to the
+ *     command text, on the current line of the trace file
+ */
+void strace_command(char *text)
+{
+    if (num_traced < MAXTRACED) {
+	traced_lines[num_traced] = lineno;
+	traced_cmds[num_traced] = strdup(text);
+	num_traced++;
+    }
+    sctable->cmd = num_traced - 1;
+}
+
+/*
+ * run_tracer - The tracer process. Attaches to the shell, tells
+ *     runtrace that it has through readyfd, and counts the shell's
+ *     syscalls until it exits, passing on its signals as it goes.
+ */
+void run_tracer(pid_t pid, int readyfd)
+{
+    int status, sig, nr = -1, cmd;
+    struct __ptrace_syscall_info info;
+    struct timespec entry, now;
+    struct sccount_t *sc;
+
+    if (ptrace(PTRACE_SEIZE, pid, 0, PTRACE_O_TRACESYSGOOD) < 0 ||
+	ptrace(PTRACE_INTERRUPT, pid, 0, 0) < 0) {
+	perror("ptrace");
+	_exit(1);
+    }
+
+    while (waitpid(pid, &status, __WALL) == pid) {
+	if (WIFEXITED(status) || WIFSIGNALED(status))
+	    break;
+	sig = 0;
+
+	/* A syscall stop, on the way in or out */
+	if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+	    if (ptrace(PTRACE_GET_SYSCALL_INFO, pid, sizeof(info), &info) < 0)
+		info.op = PTRACE_SYSCALL_INFO_NONE;
+	    if (info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+		nr = info.entry.nr;
+		clock_gettime(CLOCK_MONOTONIC, &entry);
+	    }
+	    else if (info.op == PTRACE_SYSCALL_INFO_EXIT && nr >= 0) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (nr < MAXSYSCALLS) {
+		    cmd = sctable->cmd;
+		    sc = &sctable->calls[cmd][nr];
+		    sc->count++;
+		    sc->nsecs += (now.tv_sec - entry.tv_sec) * 1000000000L +
+			(now.tv_nsec - entry.tv_nsec);
+		}
+		nr = -1;
+	    }
+	}
+
+	/* Our PTRACE_INTERRUPT, or the shell stopping for a signal */
+	else if (status >> 16 == PTRACE_EVENT_STOP) {
+	    if (readyfd >= 0) {
+		write(readyfd, "", 1);
+		close(readyfd);
+		readyfd = -1;
+	    }
+	    if (WSTOPSIG(status) != SIGTRAP) {
+		ptrace(PTRACE_LISTEN, pid, 0, 0);
+		continue;
+	    }
+	}
+
+	/* A signal on its way to the shell */
+	else
+	    sig = WSTOPSIG(status);
+
+	if (ptrace(PTRACE_SYSCALL, pid, 0, sig) < 0 && errno != ESRCH) {
+	    perror("ptrace");
+	    _exit(1);
+	}
+    }
+}
+
+/*
+ * strace_report - Log what the tracer counted, as a "syscall" event
+ *     for each syscall that each command made
+ */
+void strace_report(void)
+{
+    int i, nr;
+    struct sccount_t *sc;
+    char esc[2*MAXBUF];
+
+    for (i = 0; i < num_traced; i++) {
+	lineno = traced_lines[i];
+	jsonstr(esc, traced_cmds[i], sizeof(esc));
+	for (nr = 0; nr < MAXSYSCALLS; nr++) {
+	    sc = &sctable->calls[i][nr];
+	    if (sc->count == 0)
+		continue;
+	    TL("syscall", "\"cmd\":\"%s\",\"name\":\"%s\",\"count\":%d,"
+	       "\"usecs\":%ld", esc, syscall_name(nr), sc->count,
+	       sc->nsecs / 1000);
+	}
+    }
+    lineno = 0;
+}
+
+/*
+ * syscall_name - Return the name of syscall nr. The table has the
+ *     ones a shell is likely to make; the rest go by number.
+ */
+#define SC(name) [SYS_##name] = #name
+static const char *syscall_names[MAXSYSCALLS] = {
+    SC(read), SC(write), SC(openat), SC(close), SC(fstat), SC(newfstatat),
+    SC(lseek), SC(mmap), SC(mprotect), SC(munmap), SC(brk),
+    SC(rt_sigaction), SC(rt_sigprocmask), SC(rt_sigreturn),
+    SC(rt_sigsuspend), SC(ioctl), SC(pread64), SC(pipe2), SC(pselect6),
+    SC(ppoll), SC(sched_yield), SC(dup), SC(dup3), SC(nanosleep),
+    SC(clock_nanosleep), SC(getpid), SC(getppid), SC(clone), SC(execve),
+    SC(exit), SC(exit_group), SC(wait4), SC(waitid), SC(kill), SC(tgkill),
+    SC(fcntl), SC(getcwd), SC(chdir), SC(setpgid), SC(getpgid),
+    SC(setsid), SC(getuid), SC(geteuid), SC(getgid), SC(getegid),
+    SC(prlimit64), SC(set_tid_address), SC(set_robust_list), SC(futex),
+    SC(getrandom), SC(sendto), SC(recvfrom), SC(getdents64), SC(uname),
+    SC(faccessat), SC(readlinkat), SC(statx), SC(mremap),
+    SC(socket), SC(connect), SC(bind), SC(listen), SC(accept4), SC(ptrace),
+    SC(mount), SC(umount2), SC(unshare), SC(setns), SC(chroot), SC(bpf),
+    SC(perf_event_open), SC(personality), SC(process_vm_readv),
+    SC(setuid), SC(setgid), SC(sethostname), SC(reboot), SC(socketpair),
+    SC(sendmsg), SC(recvmsg), SC(memfd_create), SC(prctl), SC(madvise),
+#ifdef SYS_open
+    SC(open), SC(stat), SC(lstat), SC(poll), SC(access), SC(pipe),
+    SC(select), SC(dup2), SC(fork), SC(vfork), SC(getpgrp), SC(readlink),
+#endif
+#ifdef SYS_arch_prctl
+    SC(arch_prctl),
+#endif
+#ifdef SYS_rseq
+    SC(rseq),
+#endif
+#ifdef SYS_clone3
+    SC(clone3),
+#endif
+#ifdef SYS_faccessat2
+    SC(faccessat2),
+#endif
+};
+
+char *syscall_name(int nr)
+{
+    static char name[32];
+
+    if (nr >= 0 && nr < MAXSYSCALLS && syscall_names[nr])
+	return (char *)syscall_names[nr];
+    sprintf(name, "syscall_%d", nr);
+    return name;
+}
+
+/*
+ * The syscalls that the shell, the helpers, /bin/echo and /bin/kill
+ * need to run the traces. Everything else goes to the supervisor.
+ */
+static const int sandbox_allow[] = {
+    /* Files and descriptors */
+    SYS_read, SYS_write, SYS_readv, SYS_writev, SYS_pread64, SYS_openat,
+    SYS_close, SYS_fstat, SYS_newfstatat, SYS_statx, SYS_lseek, SYS_fcntl,
+    SYS_ioctl, SYS_dup, SYS_dup3, SYS_pipe2, SYS_getdents64, SYS_getcwd,
+    SYS_chdir, SYS_readlinkat, SYS_faccessat, SYS_statfs, SYS_fstatfs,
+    SYS_umask, SYS_ppoll, SYS_pselect6, SYS_memfd_create, SYS_ftruncate,
+    /* Memory */
+    SYS_mmap, SYS_mprotect, SYS_munmap, SYS_mremap, SYS_brk, SYS_madvise,
+    /* Processes */
+    SYS_clone, SYS_execve, SYS_exit, SYS_exit_group, SYS_wait4, SYS_waitid,
+    SYS_getpid, SYS_getppid, SYS_gettid, SYS_setpgid, SYS_getpgid,
+    SYS_getsid, SYS_setsid, SYS_getuid, SYS_geteuid, SYS_getgid,
+    SYS_getegid, SYS_getgroups, SYS_getresuid, SYS_getresgid, SYS_prctl,
+    SYS_prlimit64, SYS_getrusage, SYS_sysinfo, SYS_uname, SYS_sched_yield,
+    SYS_sched_getaffinity, SYS_set_tid_address, SYS_set_robust_list,
+    SYS_futex, SYS_getrandom,
+    /* Signals and time */
+    SYS_rt_sigaction, SYS_rt_sigprocmask, SYS_rt_sigreturn,
+    SYS_rt_sigsuspend, SYS_rt_sigtimedwait, SYS_rt_sigpending,
+    SYS_sigaltstack, SYS_kill, SYS_tgkill, SYS_restart_syscall,
+    SYS_nanosleep, SYS_clock_nanosleep, SYS_clock_gettime,
+    SYS_clock_getres, SYS_gettimeofday, SYS_getitimer, SYS_setitimer,
+    /* Sync with runtrace over its sockets */
+    SYS_sendto, SYS_recvfrom, SYS_sendmsg, SYS_recvmsg, SYS_socketpair,
+#ifdef SYS_open
+    SYS_open, SYS_stat, SYS_lstat, SYS_access, SYS_pipe, SYS_poll,
+    SYS_select, SYS_dup2, SYS_fork, SYS_vfork, SYS_readlink, SYS_getpgrp,
+    SYS_alarm, SYS_pause, SYS_time,
+#endif
+#ifdef SYS_arch_prctl
+    SYS_arch_prctl,
+#endif
+#ifdef SYS_rseq
+    SYS_rseq,
+#endif
+#ifdef SYS_clone3
+    SYS_clone3,
+#endif
+#ifdef SYS_faccessat2
+    SYS_faccessat2,
+#endif
+};
+#define NALLOW (sizeof(sandbox_allow) / sizeof(sandbox_allow[0]))
+
+#if defined(__x86_64__)
+#define SANDBOX_ARCH AUDIT_ARCH_X86_64
+#elif defined(__aarch64__)
+#define SANDBOX_ARCH AUDIT_ARCH_AARCH64
+#endif
+
+/*
+ * sandbox_start - Start the supervisor, which gets the filter's
+ *     notification descriptor from the shell over sandfd
+ */
+void sandbox_start(void)
+{
+    violations = mmap(NULL, sizeof(int), PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (violations == MAP_FAILED) {
+	perror("mmap");
+	exit(1);
+    }
+    if (socketpair(AF_LOCAL, SOCK_DGRAM, 0, sandfd) < 0) {
+	perror("socketpair sandfd");
+	exit(1);
+    }
+    fflush(stdout);
+    if (logfp)
+	fflush(logfp);
+    if ((supervisor_pid = fork()) < 0) {
+	perror("fork");
+	exit(1);
+    }
+    if (supervisor_pid == 0) {
+	close(sandfd[1]);
+	close(datafd[0]);
+	close(datafd[1]);
+	prctl(PR_SET_PDEATHSIG, SIGKILL);
+	signal(SIGALRM, SIG_DFL);
+	run_supervisor(sandfd[0]);
+	_exit(0);
+    }
+    close(sandfd[0]);
+}
+
+/*
+ * sandbox_install - Called by the shell's process just before it
+ *     execs the shell. Installs the filter, which the shell's jobs
+ *     inherit, and hands its notification descriptor to the
+ *     supervisor. The filter looks at nothing but the syscall number,
+ *     so the kernel can decide each allowed syscall once and cache it
+ *     (Linux 5.11 and up), and the filter costs next to nothing.
+ */
+void sandbox_install(void)
+{
+    struct sock_filter filter[NALLOW + 5];
+    struct sock_fprog prog;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    char cbuf[CMSG_SPACE(sizeof(int))], c = 0;
+    struct iovec iov = { &c, 1 };
+    int i, n = 0, fd;
+
+#ifdef SANDBOX_ARCH
+    /* Kill anything that isn't a native syscall */
+    filter[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+	offsetof(struct seccomp_data, arch));
+    filter[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+	SANDBOX_ARCH, 1, 0);
+    filter[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K,
+	SECCOMP_RET_KILL_PROCESS);
+#endif
+    filter[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+	offsetof(struct seccomp_data, nr));
+    for (i = 0; i < NALLOW; i++)
+	filter[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+	    sandbox_allow[i], NALLOW - i, 0);
+    filter[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K,
+	SECCOMP_RET_USER_NOTIF);
+    filter[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K,
+	SECCOMP_RET_ALLOW);
+    prog.len = n;
+    prog.filter = filter;
+
+    if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0 ||
+	(fd = syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER,
+		      SECCOMP_FILTER_FLAG_NEW_LISTENER, &prog)) < 0) {
+	perror("seccomp");
+	exit(1);
+    }
+
+    /* Pass the notification descriptor along */
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    if (sendmsg(sandfd[1], &msg, 0) < 0) {
+	perror("sendmsg sandfd");
+	exit(1);
+    }
+    close(fd);
+    close(sandfd[1]);
+}
+
+/*
+ * run_supervisor - The supervisor process. Waits for the filter's
+ *     notification descriptor, then fails every syscall that the
+ *     filter sends its way with EPERM, printing each one.
+ */
+void run_supervisor(int sockfd)
+{
+    struct seccomp_notif_sizes sizes;
+    struct seccomp_notif *req;
+    struct seccomp_notif_resp *resp;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct pollfd pfd;
+    char cbuf[CMSG_SPACE(sizeof(int))], c, comm[64], path[64], out[MAXBUF];
+    struct iovec iov = { &c, 1 };
+    int fd, n, len;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    if (recvmsg(sockfd, &msg, 0) <= 0 || (cmsg = CMSG_FIRSTHDR(&msg)) == NULL)
+	_exit(0);
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    close(sockfd);
+
+    if (syscall(SYS_seccomp, SECCOMP_GET_NOTIF_SIZES, 0, &sizes) < 0) {
+	perror("seccomp");
+	_exit(1);
+    }
+    req = malloc(sizes.seccomp_notif);
+    resp = malloc(sizes.seccomp_notif_resp);
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    for (;;) {
+	if (poll(&pfd, 1, -1) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    break;
+	}
+	if (!(pfd.revents & POLLIN))
+	    break;             /* POLLHUP: nothing is left under the filter */
+	memset(req, 0, sizes.seccomp_notif);
+	if (ioctl(fd, SECCOMP_IOCTL_NOTIF_RECV, req) < 0)
+	    continue;          /* It went away before we got to it */
+
+	/* Say who it was by name, since PIDs differ from run to run */
+	strcpy(comm, "?");
+	sprintf(path, "/proc/%u/comm", req->pid);
+	if ((n = open(path, O_RDONLY)) >= 0) {
+	    len = read(n, comm, sizeof(comm) - 1);
+	    comm[len > 0 ? len - 1 : 0] = '\0';
+	    close(n);
+	}
+	n = snprintf(out, sizeof(out), "%s: Sandbox denied %s to %s\n",
+		     tracefile, syscall_name(req->data.nr), comm);
+	write(STDOUT_FILENO, out, n);
+	(*violations)++;
+
+	memset(resp, 0, sizes.seccomp_notif_resp);
+	resp->id = req->id;
+	resp->error = -EPERM;
+	ioctl(fd, SECCOMP_IOCTL_NOTIF_SEND, resp);
+    }
+}
+
+/*
+ * sandbox_check - Stop the supervisor and return how many syscalls
+ *     it denied. A syscall waits for the supervisor's answer, so every
+ *     one that the shell made before it exited has been counted; jobs
+ *     that outlive the shell are on their own.
+ */
+int sandbox_check(void)
+{
+    kill(supervisor_pid, SIGKILL);
+    waitpid(supervisor_pid, NULL, 0);
+    return *violations;
+}
+
+/*
+ * tl_open - Open the timeline log. It is closed at exit, however
+ *     runtrace exits, so that a timed-out run still leaves a log.
+ */
+void tl_open(char *filename)
+{
+    if ((logfp = fopen(filename, "w")) == NULL) {
+	perror(filename);
+	exit(1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &log_start);
+    atexit(tl_close);
+}
+
+/*
+ * tl_event - Append an event to the timeline log. fmt gives any extra
+ *     JSON members, without the leading comma.
+ */
+void tl_event(char *ev, char *fmt, ...)
+{
+    va_list ap;
+    struct timespec now;
+    long usecs;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    usecs = (now.tv_sec - log_start.tv_sec) * 1000000L + 
+	(now.tv_nsec - log_start.tv_nsec) / 1000;
+    fprintf(logfp, "{\"t\":%ld,\"line\":%d,\"ev\":\"%s\"", 
+	    usecs, lineno, ev);
+    if (fmt[0]) {
+	fputc(',', logfp);
+	va_start(ap, fmt);
+	vfprintf(logfp, fmt, ap);
+	va_end(ap);
+    }
+    fputs("}\n", logfp);
+}
+
+/*
+ * tl_close - Flush and close the timeline log
+ */
+void tl_close(void)
+{
+    if (logfp) {
+	fclose(logfp);
+	logfp = NULL;
+    }
+}
+
+/*
+ * jsonstr - Copy src into dst (of size bytes) as the inside of a JSON
+ *     string, escaping quotes, backslashes and control characters
+ */
+char *jsonstr(char *dst, char *src, int size)
+{
+    char *p = dst;
+
+    for (; *src && p - dst < size - 7; src++) {
+	if (*src == '"' || *src == '\\') {
+	    *p++ = '\\';
+	    *p++ = *src;
+	}
+	else if ((unsigned char)*src < 0x20)
+	    p += sprintf(p, "\\u%04x", (unsigned char)*src);
+	else
+	    *p++ = *src;
+    }
+    *p = '\0';
+    return dst;
 }
@@ -5,27 +5,98 @@
  *
  * Introduces non-determinism in the fork() function call to 
  * identify erroneous races in the student code.
+ *
+ * Given several -s shells, compares all of them against one run of
+ * the reference shell per trace and iteration, and prints a matrix of
+ * correctness and latency. Each iteration exports a FORK_SEED, so
+ * every candidate built with fork.c sees the same fork delays.
+ *
+ * Large suites can be split with --shard i/n, which deterministically
+ * keeps the traces whose name hashes to i mod n, so separate workers
+ * or machines can each run one shard with no coordination. --results
+ * writes one "<trace> pass|fail" line per trace, --rerun-failed reruns
+ * just the failures in such a file, and --merge combines the results
+ * files of several shards (or of a run and its reruns) into a single
+ * scoreboard.
  *  
  * Copyright (c) 2004-2011, R. Bryant and D. O'Hallaron
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <errno.h>
 #include <string.h>
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <glob.h>
+#include <libgen.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
 
 //#include "driverlib.h"
 #include "config.h"
 
+/* 
+ * A trace selected for testing, along with its optional per-trace
+ * metadata from a manifest file (0 or NULL means use the default) 
+ */
+struct trace_t {
+    char *name;                 /* Trace file name */
+    int timeout;                /* Runtrace timeout in secs */
+    int iters;                  /* How many times to test this trace */
+    char *tags;                 /* Comma-separated list of tags */
+    int correct;                /* True if the trace passed */
+};
+
+/* 
+ * Hash table from trace names to indices (of traces[] or of the lines
+ * of a results file), so that matching results to traces stays linear
+ */
+struct nameslot_t {
+    char *name;                 /* NULL for an empty slot */
+    int index;
+};
+struct nametab_t {
+    struct nameslot_t *slots;
+    int size;                   /* A power of 2 */
+    int count;
+};
+
+/* Temp filenames for one shell's raw and filtered output */
+struct outfiles_t {
+    char raw[MAXBUF];
+    char filtered[MAXBUF];
+    char diff_raw[MAXBUF];      /* Diffs against the reference */
+    char diff_filtered[MAXBUF];
+};
+
+/* Most test shells that can be compared at once (-s) */
+#define MAXSHELLS 16
+
 /* Prototypes */
 void usage(void);
-int runtrace(char *tracefile);
+int runtrace(struct trace_t *trace);
+int run_shell(char *shell, struct trace_t *trace, char *outfile, int sandbox);
+int run_reference(struct trace_t *trace);
+int compare_outputs(char *tracefile, struct outfiles_t *test, int report);
+void compare_shells(int first, int last, int num_iters_specified);
+void run_all(struct trace_t *trace, double *ms);
+double msecs_since(struct timeval *start);
 void delete_tmpfiles(void);
 void emit_file(char *filename);
+struct trace_t *addtrace(char *name);
+void add_trace_glob(char *pattern);
+void add_trace_manifest(char *manifest);
+int hastag(struct trace_t *trace, char *tags);
+unsigned int hashname(char *name);
+struct nameslot_t *nametab_find(struct nametab_t *tab, char *name);
+void nametab_put(struct nametab_t *tab, char *name, int index);
+int read_results(char *filename, char ***names, int **passed);
+void merge_results(int argc, char **files);
+void emit_autoresult(int num_correct);
 
 /* 
  * Perl program that filters a shell output file:
@@ -38,67 +109,121 @@ void emit_file(char *filename);
  */
 #define PERLPROG "while(<>){chomp; s/\\s+//g; s/\\(\\d+\\)/\\(PID\\)/g; print \"$_\"}"
 
+/*
+ * With -P, both shells run in fresh PID namespaces and print the same
+ * PIDs, so only the whitespace is elided and a wrong PID is a diff.
+ */
+#define PERLPROG_PIDNS "while(<>){chomp; s/\\s+//g; print \"$_\"}"
+
 /********************
  * Global variables
  *******************/
 int verbose = 0;            /* Global flag for verbose output (-V) */
 char *shellprog = "./tsh";  /* Name of test shell (-s) */
+char *shells[MAXSHELLS];    /* All the test shells, if more than one (-s) */
+int num_shells = 0;
 int sandboxing = 0;         /* Enable sandboxing (-x) */
+int virtual_clock = 0;      /* Run jobs on runtrace's virtual clock (-C) */
+int pid_namespaces = 0;     /* Run shells in their own PID namespaces (-P) */
 int autograded = 0;         /* Set only on the Autolab server (-A) */
 int num_iters=ITERS;        /* How many times to test each trace file */
 
 /* Null-terminated list of trace files */
 static char *default_tracefiles[] = {TRACEFILES, NULL};
 
+/* Growable array of the traces to test (-d, -m or the default list) */
+struct trace_t *traces = NULL;
+int num_traces = 0;
+int max_traces = 0;
+
+/* Long options, which have no single-letter equivalents */
+enum { OPT_SHARD = 256, OPT_RERUN_FAILED, OPT_RESULTS, OPT_MERGE };
+static struct option long_options[] = {
+    {"shard", required_argument, NULL, OPT_SHARD},
+    {"rerun-failed", required_argument, NULL, OPT_RERUN_FAILED},
+    {"results", required_argument, NULL, OPT_RESULTS},
+    {"merge", no_argument, NULL, OPT_MERGE},
+    {NULL, 0, NULL, 0}
+};
+
 /* Autolab buffers */
-char autoresult[MAXBUF]; /* Autolab autoresult string */  
+char *autoresult;        /* Autolab autoresult string */  
 char status[MAXBUF];
 
-/* Temp filenames for unfiltered shell output */
-char ref_raw_outfile[MAXBUF];
-char test_raw_outfile[MAXBUF];
-char diff_raw_outfile[MAXBUF];
-
-/* Temp filenames for filtered shell output */
-char ref_filtered_outfile[MAXBUF];
-char test_filtered_outfile[MAXBUF];
-char diff_filtered_outfile[MAXBUF];
+/* Temp files for the reference shell and each test shell */
+struct outfiles_t ref_files;
+struct outfiles_t test_files[MAXSHELLS];
 
 /**************
  * Main routine
  **************/
 int main(int argc, char **argv)
 {
-    int i, j;
-    char c;
+    int i, j, k;
+    int c;
     int pid;
     int current_time;
+    int iters;
 
-    int correct[MAXTRACES];    /* True if trace i is correct */
     int num_correct;           /* Number of correct traces */ 
 
-    char **tracefiles = NULL;  /* Null-terminated array of trace file names */
-    int num_tracefiles = 0;    /* The number of traces in that array */
-    int tracenum;              /* Number of trace file to test (-t) */
+    int tracenum = 0;          /* Number of trace file to test (-t) */
     int singletrace = 0;       /* Are we testing one trace or all? (-t) */
     int num_iters_specified = 0; /* True if the user specifed the i flag */
+    char *tags = NULL;         /* Only test traces with one of these tags */
+    int shard = 0, num_shards = 1; /* Only test shard i of n (--shard) */
+    char *rerun = NULL;        /* Only rerun the failures in this file */
+    char *results = NULL;      /* Write per-trace results to this file */
+    FILE *resultsfp = NULL;
+    int merge = 0;             /* Merge results files instead (--merge) */
+    char **names;
+    int *passed, n;
+    struct trace_t *trace;
+    struct nametab_t lastrun = {NULL, 0, 0}; /* Results to rerun, by name */
+    struct nameslot_t *slot;
 
     struct stat statbuf;
 
-    /* Set up the default list of tracefiles */
-    tracefiles = default_tracefiles;
-    num_tracefiles = sizeof(default_tracefiles) / sizeof(char *) - 1;
-
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "Ai:t:s:hVx")) != EOF) {
+    while ((c = getopt_long(argc, argv, "ACPi:t:s:hVxd:m:T:", 
+                            long_options, NULL)) != EOF) {
         switch (c) {
 
+        case OPT_SHARD: /* Only test shard i of n */
+            if (sscanf(optarg, "%d/%d", &shard, &num_shards) != 2 || 
+                num_shards < 1 || shard < 0 || shard >= num_shards) {
+                printf("Error: Invalid shard %s (--shard i/n, 0 <= i < n)\n", 
+                       optarg);
+                exit(1);
+            }
+            break;
+
+        case OPT_RERUN_FAILED: /* Only rerun the failures in a results file */
+            rerun = strdup(optarg);
+            break;
+
+        case OPT_RESULTS: /* Write per-trace results to a file */
+            results = strdup(optarg);
+            break;
+
+        case OPT_MERGE: /* Merge the results files named by the arguments */
+            merge = 1;
+            break;
+
         case 'A': /* hidden Autolab driver argument */
             autograded = 1;
             break;
 
+        case 'C': /* Run job timeouts on a virtual clock */
+            virtual_clock = 1;
+            break;
+
+        case 'P': /* Run shells in PID namespaces, compare PIDs as is */
+            pid_namespaces = 1;
+            break;
+
         case 'i': /* number of iterations to test each function */
             num_iters = atoi(optarg);
             if (num_iters < 1) {
@@ -108,20 +233,32 @@ int main(int argc, char **argv)
             num_iters_specified = 1;
             break;
 
-        case 's':  /* The name of the test shell (default ./tsh) */
-            shellprog = strdup(optarg);
+        case 's':  /* The name of a test shell (default ./tsh) */
+            if (num_shells == MAXSHELLS) {
+                printf("Error: Too many test shells (-s)\n");
+                exit(1);
+            }
+            shellprog = shells[num_shells++] = strdup(optarg);
             break;
 
         case 't': /* Trace number to test */
             tracenum = atoi(optarg);
             singletrace = 1;
-            if (tracenum < 0 || tracenum >= num_tracefiles) {
-                printf("Error: Invalid trace number (-t)\n");
-                usage();
-            }
             verbose++;
             break;
 
+        case 'd': /* Test the traces in a directory (or matching a glob) */
+            add_trace_glob(optarg);
+            break;
+
+        case 'm': /* Test the traces listed in a manifest file */
+            add_trace_manifest(optarg);
+            break;
+
+        case 'T': /* Only test traces with one of these tags */
+            tags = strdup(optarg);
+            break;
+
         case 'V': /* Increase verbosity level */
             verbose++;
             break;
@@ -140,55 +277,140 @@ int main(int argc, char **argv)
         }
     }
 		
-    /* Make sure the requested shell is executable */
-    if (stat(shellprog, &statbuf) < 0) {
-        fprintf(stderr, "%s: File not found\n", shellprog);
-        exit(1);
+    /* Merging results doesn't run any shells */
+    if (merge) {
+        merge_results(argc - optind, argv + optind);
+        exit(0);
+    }
+
+    /* Make sure the requested shells are executable */
+    if (num_shells == 0)
+        shells[num_shells++] = shellprog;
+    for (i = 0; i < num_shells; i++) {
+        if (stat(shells[i], &statbuf) < 0) {
+            fprintf(stderr, "%s: File not found\n", shells[i]);
+            exit(1);
+        }
+        if (!(statbuf.st_mode & S_IXUSR)) {
+            fprintf(stderr, "%s: File is not executable\n", shells[i]);
+            exit(1);
+        } 
     }
-    if (!(statbuf.st_mode & S_IXUSR)) {
-        fprintf(stderr, "%s: File is not executable\n", shellprog);
-        exit(1);
-    } 
 
     if (singletrace && autograded) {
         printf("Warning: -A flag is ignored when testing single traces\n");
     }
 
+    /* Fall back to the compiled-in list of tracefiles */
+    if (num_traces == 0) {
+        for (i = 0; default_tracefiles[i] != NULL; i++)
+            addtrace(default_tracefiles[i]);
+    }
+
+    /* Keep only the traces with a matching tag (-T) */
+    if (tags) {
+        for (i = 0, k = 0; i < num_traces; i++) {
+            if (hastag(&traces[i], tags))
+                traces[k++] = traces[i];
+        }
+        num_traces = k;
+        if (num_traces == 0) {
+            printf("Error: No traces are tagged with %s (-T)\n", tags);
+            exit(1);
+        }
+    }
+
+    /* Keep only the traces that failed last time (--rerun-failed) */
+    if (rerun) {
+        n = read_results(rerun, &names, &passed);
+        for (j = 0; j < n; j++)     /* the last result for a name wins */
+            nametab_put(&lastrun, names[j], j);
+        for (i = 0, k = 0; i < num_traces; i++) {
+            slot = nametab_find(&lastrun, traces[i].name);
+            if (slot->name && !passed[slot->index])
+                traces[k++] = traces[i];
+        }
+        num_traces = k;
+        if (num_traces == 0) {
+            printf("No failed traces to rerun in %s\n", rerun);
+            exit(0);
+        }
+    }
+
+    /* Keep only our shard of the traces (--shard) */
+    if (num_shards > 1) {
+        for (i = 0, k = 0; i < num_traces; i++) {
+            if (hashname(traces[i].name) % num_shards == shard)
+                traces[k++] = traces[i];
+        }
+        num_traces = k;
+        if (num_traces == 0) {
+            printf("Shard %d/%d has no traces\n", shard, num_shards);
+            exit(0);
+        }
+    }
+
+    if (results) {
+        if (num_shells > 1 || singletrace) {
+            printf("Error: --results needs one test shell and no -t\n");
+            exit(1);
+        }
+        if ((resultsfp = fopen(results, "w")) == NULL) {
+            perror(results);
+            exit(1);
+        }
+    }
+
+    if (singletrace && (tracenum < 0 || tracenum >= num_traces)) {
+        printf("Error: Invalid trace number (-t)\n");
+        usage();
+    }
+
     /* Get the current time stamp and PID */
     current_time = (int) time(NULL);
     pid = (int) getpid();
 
     /* Generate some (truly) unique filenames in /usr/tmp */
-    sprintf(test_raw_outfile, 
-            "/tmp/test_raw_outfile.%d.%d", current_time, pid);
-    sprintf(ref_raw_outfile, 
+    sprintf(ref_files.raw, 
             "/tmp/ref_raw_outfile.%d.%d", current_time, pid);
-    sprintf(diff_raw_outfile, 
-            "/tmp/diff_raw_outfile.%d.%d", current_time, pid);
-
-    sprintf(test_filtered_outfile, 
-            "/tmp/test_filtered_outfile.%d.%d", current_time, pid);
-    sprintf(ref_filtered_outfile, 
+    sprintf(ref_files.filtered, 
             "/tmp/ref_filtered_outfile.%d.%d", current_time, pid);
-    sprintf(diff_filtered_outfile, 
-            "/tmp/diff_filtered_outfile.%d.%d", current_time, pid);
+    for (i = 0; i < num_shells; i++) {
+        sprintf(test_files[i].raw, 
+                "/tmp/test_raw_outfile.%d.%d.%d", current_time, pid, i);
+        sprintf(test_files[i].filtered, 
+                "/tmp/test_filtered_outfile.%d.%d.%d", current_time, pid, i);
+        sprintf(test_files[i].diff_raw, 
+                "/tmp/diff_raw_outfile.%d.%d.%d", current_time, pid, i);
+        sprintf(test_files[i].diff_filtered, 
+                "/tmp/diff_filtered_outfile.%d.%d.%d", current_time, pid, i);
+    }
+
+    /* Compare several shells against the reference */
+    if (num_shells > 1) {
+        if (singletrace)
+            compare_shells(tracenum, tracenum + 1, num_iters_specified);
+        else
+            compare_shells(0, num_traces, num_iters_specified);
+    }
 
     /* Evaluate a single tracefile */
-    if (singletrace) {
+    else if (singletrace) {
+        trace = &traces[tracenum];
         num_correct = 0;
         num_iters = num_iters_specified ? num_iters : 1;
         if (num_iters_specified) {
-            printf("Running %d iters of %s\n", num_iters, tracefiles[tracenum]);
+            printf("Running %d iters of %s\n", num_iters, trace->name);
         }
         for (j = 0; j < num_iters; j++) {
             if (num_iters_specified) {
-                printf("%d. Running %s...\n", j+1, tracefiles[tracenum]);
+                printf("%d. Running %s...\n", j+1, trace->name);
             }
             else {
-                printf("Running %s...\n", tracefiles[tracenum]);
+                printf("Running %s...\n", trace->name);
             }
             fflush(stdout);
-            if (runtrace(tracefiles[tracenum])) {
+            if (runtrace(trace)) {
                 num_correct++;
             }
         }
@@ -199,46 +421,47 @@ int main(int argc, char **argv)
     /* Evaluate all trace files */
     else {
         num_correct = 0;
-        for (i = 0; i < num_tracefiles; i++) {
-            if (num_iters > 1) 
-                printf("Running %d iters of %s\n", num_iters, tracefiles[i]);
-            for (j = 0; j < num_iters; j++) {
-                if (num_iters > 1) 
-                    printf("%d. Running %s...\n", j+1, tracefiles[i]);
+        for (i = 0; i < num_traces; i++) {
+            trace = &traces[i];
+
+            /* -i overrides the manifest, which overrides the default */
+            iters = (trace->iters && !num_iters_specified) ? 
+                trace->iters : num_iters;
+            if (iters > 1) 
+                printf("Running %d iters of %s\n", iters, trace->name);
+            for (j = 0; j < iters; j++) {
+                if (iters > 1) 
+                    printf("%d. Running %s...\n", j+1, trace->name);
                 else
-                    printf("Running %s...\n", tracefiles[i]);
+                    printf("Running %s...\n", trace->name);
 
                 /* Run the trace interpreter on trace i */
-                correct[i] = runtrace(tracefiles[i]);
-                if (!correct[i]) {
+                trace->correct = runtrace(trace);
+                if (!trace->correct) {
                     break;
                 }
             }
 		    
-            if (correct[i])
+            if (trace->correct)
                 num_correct++;
+
+            /* Flush as we go, so a crash still leaves partial results */
+            if (resultsfp) {
+                fprintf(resultsfp, "%s %s\n", trace->name, 
+                        trace->correct ? "pass" : "fail");
+                fflush(resultsfp);
+            }
         }
+        if (resultsfp)
+            fclose(resultsfp);
 
-        printf("Score: %d/%d\n", num_correct*4, num_tracefiles*4);
+        printf("Score: %d/%d\n", num_correct*4, num_traces*4);
 
         /* 
          * Emit the JSON autoresult
          */
-        if (autograded) {
-            int first = 1;
-            sprintf(autoresult, "{\"scores\": {\"Correctness\": %d}, \"scoreboard\": [%d,", num_correct*4, num_correct*4);
-            for (i = 0; i < num_tracefiles; i++) {
-                if (first) {
-                    first = 0;
-                    strcat(autoresult, correct[i] ? "\"y\"" : "\"n\"");
-                }
-                else {
-                    strcat(autoresult, correct[i] ? ",\"y\"" : ",\"n\"");
-                }
-            }
-            strcat(autoresult, "]}");
-            printf("%s\n", autoresult);
-        }
+        if (autograded)
+            emit_autoresult(num_correct);
     }
 
     /* Clean up */
@@ -250,10 +473,9 @@ int main(int argc, char **argv)
  * runtrace - Run trace file on test and reference shells
  *            Return 0 if results are different, 1 if identical
  */
-int runtrace(char *tracefile)
+int runtrace(struct trace_t *trace)
 { 
-    int status;
-    char buf[MAXBUF];
+    char *tracefile = trace->name;
     struct stat statbuf;
 
     if (stat(tracefile, &statbuf) < 0) {
@@ -262,45 +484,102 @@ int runtrace(char *tracefile)
     }
 
     /* Run the student's test shell */
-    if (sandboxing)
-        sprintf(buf, "./runtrace -x -s %s -f %s > %s\n", 
-                shellprog, tracefile, test_raw_outfile);
-    else
-        sprintf(buf, "./runtrace -s %s -f %s > %s\n", 
-                shellprog, tracefile, test_raw_outfile);
-
-    if (system(buf) != 0) {
-        printf("sdriver unable to run %s\n", buf);
-    }
+    run_shell(shellprog, trace, test_files[0].raw, sandboxing);
     
     /* Run the reference shell */
-    sprintf(buf, "./runtrace -s ./tshref -f %s > %s\n", 
-            tracefile, ref_raw_outfile);
-    if (system(buf) != 0) {
-        emit_file(ref_raw_outfile);
-        printf("sdriver unable to run %s\n", buf);
+    if (run_reference(trace) != 0) {
+        emit_file(ref_files.raw);
         delete_tmpfiles();
         exit(1);
     }
     
+    return compare_outputs(tracefile, &test_files[0], 1);
+}
+
+/*
+ * run_shell - Run trace file on shell with runtrace, saving the output
+ *             in outfile. Returns the exit status of runtrace.
+ */
+int run_shell(char *shell, struct trace_t *trace, char *outfile, int sandbox)
+{
+    int status;
+    char buf[MAXBUF];
+    char opts[64];
+
+    /* Pass along our runtrace options and the trace's own timeout */
+    opts[0] = '\0';
+    if (sandbox)
+        strcat(opts, "-x ");
+    if (virtual_clock)
+        strcat(opts, "-C ");
+    if (pid_namespaces)
+        strcat(opts, "-P ");
+    if (trace->timeout)
+        sprintf(opts + strlen(opts), "-t %d ", trace->timeout);
+
+    sprintf(buf, "./runtrace %s-s %s -f %s > %s\n", 
+            opts, shell, trace->name, outfile);
+    if ((status = system(buf)) != 0) {
+        printf("sdriver unable to run %s\n", buf);
+    }
+    return status;
+}
+
+/*
+ * run_reference - Save the reference output for trace in ref_files.raw.
+ *     A trace that the reference shell can't run (it has no scripting)
+ *     comes with the output that it should produce in a file named
+ *     like the trace, but ending in .out instead of .txt. Returns 0 if
+ *     OK, nonzero otherwise.
+ */
+int run_reference(struct trace_t *trace)
+{
+    char buf[MAXBUF], expected[MAXBUF];
+    int len = strlen(trace->name);
+
+    if (len > 4 && !strcmp(trace->name + len - 4, ".txt"))
+        len -= 4;
+    sprintf(expected, "%.*s.out", len, trace->name);
+    if (access(expected, R_OK) < 0)
+        return run_shell("./tshref", trace, ref_files.raw, 0);
+
+    sprintf(buf, "cp %s %s", expected, ref_files.raw);
+    return system(buf);
+}
+
+/*
+ * compare_outputs - Compare the output of a test shell with that of the
+ *     reference shell. If report is set, print both outputs and the
+ *     diff when they differ. Return 0 if different, 1 if identical.
+ */
+int compare_outputs(char *tracefile, struct outfiles_t *test, int report)
+{
+    int status;
+    char buf[MAXBUF];
+
     /* Filter the test and reference outputs */
     sprintf(buf, "perl -e '%s' < %s | sort > %s", 
-            PERLPROG, test_raw_outfile, test_filtered_outfile);
+            pid_namespaces ? PERLPROG_PIDNS : PERLPROG, 
+            test->raw, test->filtered);
     system(buf);
     
     sprintf(buf, "perl -e '%s' < %s | sort > %s", 
-            PERLPROG, ref_raw_outfile, ref_filtered_outfile);
+            pid_namespaces ? PERLPROG_PIDNS : PERLPROG, 
+            ref_files.raw, ref_files.filtered);
     system(buf);
     
     /* Diff the filtered output files */
     sprintf(buf, "diff %s %s > %s\n", 
-            test_filtered_outfile, ref_filtered_outfile, diff_filtered_outfile);
+            test->filtered, ref_files.filtered, test->diff_filtered);
     status = system(buf);
     
     /* Filtered output files were different */
     if (status != 0) {
+        if (!report)
+            return 0;
+
         sprintf(buf, "diff %s %s > %s\n", 
-                test_raw_outfile, ref_raw_outfile, diff_raw_outfile);
+                test->raw, ref_files.raw, test->diff_raw);
         system(buf);
 
         printf("Oops: test and reference outputs for %s differed.\n", 
@@ -308,37 +587,472 @@ int runtrace(char *tracefile)
         printf("\n");
 
         printf("Test output:\n");
-        emit_file(test_raw_outfile);
+        emit_file(test->raw);
         printf("\n");
 
         printf("Reference output:\n");
-        emit_file(ref_raw_outfile);
+        emit_file(ref_files.raw);
         printf("\n");
 
         printf("Output of 'diff test reference':\n");
-        emit_file(diff_raw_outfile);
+        emit_file(test->diff_raw);
         printf("\n");
 
         return 0;
     }
     
     /* Filtered output files were identical */
-    if (verbose) {
+    if (verbose && report) {
         printf("Success: The test and reference outputs for %s matched!\n", tracefile);
     }
-    if (verbose > 1) {
+    if (verbose > 1 && report) {
         printf("Test output:\n");
-        emit_file(test_raw_outfile);
+        emit_file(test->raw);
         printf("\n");
         printf("Reference output:\n");
         fflush(stdout);
-        emit_file(ref_raw_outfile);
+        emit_file(ref_files.raw);
         printf("\n");
     }
 
     return 1;
 }
 
+/*
+ * compare_shells - Run traces first..last-1 on every test shell and
+ *     print a matrix with one row per trace and one column per shell.
+ *     Each (trace, iteration) runs the reference shell once, and every
+ *     test shell with the same FORK_SEED. A shell is correct on a trace
+ *     if it matched the reference on every iteration; its latency is
+ *     the mean wall-clock time of runtrace over the iterations.
+ */
+void compare_shells(int first, int last, int num_iters_specified)
+{
+    int i, j, k, iters;
+    int correct[MAXSHELLS], score[MAXSHELLS];
+    double ms[MAXSHELLS + 1], total[MAXSHELLS + 1];
+    char seed[32];
+    struct trace_t *trace;
+
+    printf("%-16s %10s", "Trace", "tshref");
+    for (k = 0; k < num_shells; k++) {
+        score[k] = 0;
+        printf("  %-16.16s", shells[k]);
+    }
+    printf("\n");
+
+    for (i = first; i < last; i++) {
+        trace = &traces[i];
+        iters = (trace->iters && !num_iters_specified) ? 
+            trace->iters : num_iters;
+
+        for (k = 0; k <= num_shells; k++) {
+            correct[k] = 1;
+            total[k] = 0;
+        }
+        for (j = 0; j < iters; j++) {
+            sprintf(seed, "%d", j + 1);
+            setenv("FORK_SEED", seed, 1);
+            run_all(trace, ms);
+            for (k = 0; k <= num_shells; k++)
+                total[k] += ms[k];
+            for (k = 0; k < num_shells; k++)
+                if (!compare_outputs(trace->name, &test_files[k], verbose))
+                    correct[k] = 0;
+        }
+
+        printf("%-16.16s %7.0f ms", basename(trace->name), 
+               total[num_shells] / iters);
+        for (k = 0; k < num_shells; k++) {
+            printf("  %-4s %8.0f ms", correct[k] ? "ok" : "FAIL", 
+                   total[k] / iters);
+            score[k] += correct[k];
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    printf("%-16s %10s", "Correct", "");
+    for (k = 0; k < num_shells; k++)
+        printf("  %7d/%-8d", score[k], last - first);
+    printf("\n");
+}
+
+/*
+ * run_all - Run trace on every test shell and then on the reference
+ *     shell, whose time goes in ms[num_shells]. The runs go in parallel
+ *     when each has its own PID namespace (-P); otherwise they would
+ *     see, and clean up, each other's processes.
+ */
+void run_all(struct trace_t *trace, double *ms)
+{
+    int k, status;
+    pid_t pid, pids[MAXSHELLS + 1];
+    struct timeval start;
+
+    for (k = 0; k <= num_shells; k++) {
+        char *shell = k < num_shells ? shells[k] : "./tshref";
+        char *outfile = k < num_shells ? test_files[k].raw : ref_files.raw;
+        int sandbox = k < num_shells ? sandboxing : 0;
+
+        if (!pid_namespaces) {
+            gettimeofday(&start, NULL);
+            status = k < num_shells ? run_shell(shell, trace, outfile, sandbox)
+                : run_reference(trace);
+            ms[k] = msecs_since(&start);
+            if (k == num_shells && status != 0) {
+                emit_file(ref_files.raw);
+                delete_tmpfiles();
+                exit(1);
+            }
+            continue;
+        }
+
+        fflush(stdout);
+        if (k == 0)
+            gettimeofday(&start, NULL);
+        if ((pids[k] = fork()) < 0) {
+            perror("fork");
+            exit(1);
+        }
+        if (pids[k] == 0)
+            exit((k < num_shells ? run_shell(shell, trace, outfile, sandbox)
+                  : run_reference(trace)) != 0);
+    }
+
+    if (!pid_namespaces)
+        return;
+
+    /* Reap the runs in the order that they finish */
+    while ((pid = wait(&status)) > 0) {
+        for (k = 0; k <= num_shells && pids[k] != pid; k++)
+            ;
+        if (k > num_shells)
+            continue;
+        ms[k] = msecs_since(&start);
+        if (k == num_shells && status != 0) {
+            emit_file(ref_files.raw);
+            delete_tmpfiles();
+            exit(1);
+        }
+    }
+}
+
+/*
+ * msecs_since - Milliseconds of wall-clock time since start
+ */
+double msecs_since(struct timeval *start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) * 1000.0 + 
+        (now.tv_usec - start->tv_usec) / 1000.0;
+}
+
+/*
+ * addtrace - Append a trace with default metadata to the trace list
+ */
+struct trace_t *addtrace(char *name)
+{
+    struct trace_t *trace;
+
+    if (num_traces == max_traces) {
+        max_traces = max_traces ? 2*max_traces : 64;
+        traces = realloc(traces, max_traces * sizeof(struct trace_t));
+        if (traces == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    trace = &traces[num_traces++];
+    memset(trace, 0, sizeof(struct trace_t));
+    trace->name = strdup(name);
+    return trace;
+}
+
+/*
+ * add_trace_glob - Add the traces in a directory, or all files that
+ *     match a glob pattern, in sorted order
+ */
+void add_trace_glob(char *pattern)
+{
+    char buf[MAXBUF];
+    glob_t g;
+    size_t i;
+    struct stat statbuf;
+
+    /* A plain directory means all of its trace files */
+    if (stat(pattern, &statbuf) == 0 && S_ISDIR(statbuf.st_mode)) {
+        sprintf(buf, "%.*s/*.txt", MAXBUF - 8, pattern);
+        pattern = buf;
+    }
+
+    if (glob(pattern, 0, NULL, &g) != 0) {
+        printf("Error: No trace files match %s (-d)\n", pattern);
+        exit(1);
+    }
+    for (i = 0; i < g.gl_pathc; i++)
+        addtrace(g.gl_pathv[i]);
+    globfree(&g);
+}
+
+/*
+ * add_trace_manifest - Add the traces listed in a manifest file. Each
+ *     non-blank, non-comment line names a trace file, relative to the
+ *     manifest's directory, followed by optional metadata:
+ *
+ *         trace42.txt timeout=8 iters=1 tags=signals,slow
+ */
+void add_trace_manifest(char *manifest)
+{
+    FILE *fp;
+    char line[MAXBUF];
+    char path[MAXBUF];
+    char *dir, *tok;
+    int lineno = 0;
+    struct trace_t *trace;
+
+    if ((fp = fopen(manifest, "r")) == NULL) {
+        printf("Error: Unable to open manifest %s (-m)\n", manifest);
+        exit(1);
+    }
+    strcpy(path, manifest);
+    dir = strdup(dirname(path));
+
+    while (fgets(line, MAXBUF, fp)) {
+        lineno++;
+        if ((tok = strtok(line, " \t\r\n")) == NULL || tok[0] == '#')
+            continue;
+
+        if (tok[0] == '/' || !strcmp(dir, "."))
+            trace = addtrace(tok);
+        else {
+            sprintf(path, "%.*s/%s", MAXBUF/2, dir, tok);
+            trace = addtrace(path);
+        }
+
+        while ((tok = strtok(NULL, " \t\r\n")) != NULL) {
+            if (!strncmp(tok, "timeout=", 8))
+                trace->timeout = atoi(tok + 8);
+            else if (!strncmp(tok, "iters=", 6))
+                trace->iters = atoi(tok + 6);
+            else if (!strncmp(tok, "tags=", 5))
+                trace->tags = strdup(tok + 5);
+            else {
+                printf("%s:%d: Unknown trace attribute '%s'\n", 
+                       manifest, lineno, tok);
+                exit(1);
+            }
+        }
+    }
+    fclose(fp);
+    free(dir);
+}
+
+/*
+ * hastag - Return true if the trace has any of the comma-separated tags
+ */
+int hastag(struct trace_t *trace, char *tags)
+{
+    char *tag, *p, *end;
+    int len;
+
+    if (trace->tags == NULL)
+        return 0;
+
+    for (tag = tags; *tag; tag = end + (*end == ',')) {
+        end = tag + strcspn(tag, ",");
+        len = end - tag;
+        for (p = trace->tags; *p; p += strcspn(p, ","), p += (*p == ',')) {
+            if ((int)strcspn(p, ",") == len && !strncmp(p, tag, len))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * hashname - FNV-1a hash of a trace name. Shards are picked by name
+ *     rather than by position, so that adding a trace to the suite
+ *     doesn't move the other traces to different shards.
+ */
+unsigned int hashname(char *name)
+{
+    unsigned int hash = 2166136261u;
+
+    for (; *name; name++) {
+        hash ^= (unsigned char)*name;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * nametab_find - Return the slot for name in tab: the one that holds
+ *     it, or else the empty slot where it would go
+ */
+struct nameslot_t *nametab_find(struct nametab_t *tab, char *name)
+{
+    static struct nameslot_t empty = {NULL, -1};
+    unsigned int i;
+
+    if (tab->size == 0)
+        return &empty;
+    for (i = hashname(name) & (tab->size - 1); tab->slots[i].name; 
+         i = (i + 1) & (tab->size - 1)) {
+        if (!strcmp(tab->slots[i].name, name))
+            break;
+    }
+    return &tab->slots[i];
+}
+
+/*
+ * nametab_put - Map name to index in tab, replacing any earlier index.
+ *     The table keeps a pointer to name, so it must stay allocated.
+ */
+void nametab_put(struct nametab_t *tab, char *name, int index)
+{
+    struct nameslot_t *old = tab->slots, *slot;
+    int i, oldsize = tab->size;
+
+    /* Keep it at most half full */
+    if (2*(tab->count + 1) > tab->size) {
+        tab->size = tab->size ? 2*tab->size : 64;
+        if ((tab->slots = calloc(tab->size, sizeof(*slot))) == NULL) {
+            perror("calloc");
+            exit(1);
+        }
+        tab->count = 0;
+        for (i = 0; i < oldsize; i++)
+            if (old[i].name)
+                nametab_put(tab, old[i].name, old[i].index);
+        free(old);
+    }
+
+    slot = nametab_find(tab, name);
+    if (slot->name == NULL) {
+        slot->name = name;
+        tab->count++;
+    }
+    slot->index = index;
+}
+
+/*
+ * read_results - Read a results file written by --results into growable
+ *     arrays of trace names and pass flags. Returns the number of lines.
+ *     Blank lines and lines that start with '#' are ignored.
+ */
+int read_results(char *filename, char ***names, int **passed)
+{
+    FILE *fp;
+    char line[MAXBUF], name[MAXBUF], result[MAXBUF];
+    int n = 0, max = 0;
+
+    if ((fp = fopen(filename, "r")) == NULL) {
+        perror(filename);
+        exit(1);
+    }
+    *names = NULL;
+    *passed = NULL;
+    while (fgets(line, MAXBUF, fp)) {
+        if (line[0] == '#' || sscanf(line, "%s %s", name, result) != 2)
+            continue;
+        if (n == max) {
+            max = max ? 2*max : 64;
+            *names = realloc(*names, max * sizeof(char *));
+            *passed = realloc(*passed, max * sizeof(int));
+            if (*names == NULL || *passed == NULL) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        (*names)[n] = strdup(name);
+        (*passed)[n] = !strcmp(result, "pass");
+        n++;
+    }
+    fclose(fp);
+    return n;
+}
+
+/*
+ * merge_results - Combine results files into one scoreboard. A trace
+ *     that appears in several files takes its result from the last
+ *     one, so "--merge all.txt rerun.txt" counts the reruns.
+ */
+void merge_results(int argc, char **files)
+{
+    int i, j, k, n, num_correct = 0;
+    char **names;
+    int *passed;
+    struct trace_t *trace;
+    struct nametab_t tab = {NULL, 0, 0};
+    struct nameslot_t *slot;
+
+    if (argc == 0) {
+        printf("Error: --merge needs at least one results file\n");
+        exit(1);
+    }
+
+    for (k = 0; k < num_traces; k++)
+        nametab_put(&tab, traces[k].name, k);
+    for (i = 0; i < argc; i++) {
+        n = read_results(files[i], &names, &passed);
+        for (j = 0; j < n; j++) {
+            slot = nametab_find(&tab, names[j]);
+            if (slot->name)
+                trace = &traces[slot->index];
+            else {
+                trace = addtrace(names[j]);
+                nametab_put(&tab, trace->name, trace - traces);
+            }
+            trace->correct = passed[j];
+            free(names[j]);
+        }
+        free(names);
+        free(passed);
+    }
+
+    for (k = 0; k < num_traces; k++) {
+        if (verbose)
+            printf("%s %s\n", traces[k].name, 
+                   traces[k].correct ? "pass" : "fail");
+        num_correct += traces[k].correct;
+    }
+    printf("Score: %d/%d\n", num_correct*4, num_traces*4);
+    if (autograded)
+        emit_autoresult(num_correct);
+}
+
+/*
+ * emit_autoresult - Print the JSON autoresult for the traces
+ */
+void emit_autoresult(int num_correct)
+{
+    int i, first = 1;
+    char *p;
+
+    /* Room for the header plus at most 4 bytes per trace */
+    if ((autoresult = malloc(MAXBUF + 4*num_traces)) == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    p = autoresult;
+    p += sprintf(p, "{\"scores\": {\"Correctness\": %d}, \"scoreboard\": [%d,", num_correct*4, num_correct*4);
+    for (i = 0; i < num_traces; i++) {
+        /* Append in place: strcat would make this quadratic */
+        if (first) {
+            first = 0;
+            p += sprintf(p, traces[i].correct ? "\"y\"" : "\"n\"");
+        }
+        else {
+            p += sprintf(p, traces[i].correct ? ",\"y\"" : ",\"n\"");
+        }
+    }
+    strcat(p, "]}");
+    printf("%s\n", autoresult);
+}
+
 /*
  * emit_file - prints an ascii file to stdout
  */
@@ -362,11 +1076,17 @@ void emit_file(char *filename)
  */
 void delete_tmpfiles()
 {
-    char buf[MAXBUF];
-    sprintf(buf, "rm -rf %s %s %s %s %s %s",
-            test_raw_outfile, ref_raw_outfile, diff_raw_outfile,
-            test_filtered_outfile, ref_filtered_outfile, diff_filtered_outfile);
+    int i;
+    char buf[5*MAXBUF];
+
+    sprintf(buf, "rm -rf %s %s", ref_files.raw, ref_files.filtered);
     system(buf);
+    for (i = 0; i < num_shells; i++) {
+        sprintf(buf, "rm -rf %s %s %s %s", 
+                test_files[i].raw, test_files[i].filtered, 
+                test_files[i].diff_raw, test_files[i].diff_filtered);
+        system(buf);
+    }
 }
 
 /* 
@@ -374,13 +1094,29 @@ void delete_tmpfiles()
  */
 void usage(void) 
 {
-    printf("Usage: sdriver [-hV] [-s <shell> -t <tracenum> -i <iters>]\n");
+    printf("Usage: sdriver [-hCPV] [-s <shell> -t <tracenum> -i <iters>]\n");
+    printf("               [-d <dir|glob>] [-m <manifest>] [-T <tags>]\n");
+    printf("               [--shard i/n] [--results <file>] [--rerun-failed <file>]\n");
+    printf("       sdriver [-AV] --merge <file>...\n");
     printf("Options\n");
     printf("\t-h           Print this message.\n");
     printf("\t-i <iters>   Run each trace <iters> times (default %d)\n", 
            num_iters);
-    printf("\t-s <shell>   Name of test shell (default ./tsh)\n");
+    printf("\t-s <shell>   Name of test shell (default ./tsh); repeat to\n");
+    printf("\t             compare several shells side by side\n");
     printf("\t-t <n>       Run trace <n> only (default all)\n");
+    printf("\t-d <dir>     Test the *.txt traces in <dir> (or matching a glob)\n");
+    printf("\t-m <file>    Test the traces listed in manifest <file>\n");
+    printf("\t-T <tags>    Only test traces with one of these tags\n");
+    printf("\t-C           Run job timeouts on a virtual clock\n");
+    printf("\t-P           Run shells in PID namespaces and compare PIDs\n");
+    printf("\t--shard i/n  Only test the traces in shard i of n (0 <= i < n)\n");
+    printf("\t--results <file>\n");
+    printf("\t             Write a pass/fail line per trace to <file>\n");
+    printf("\t--rerun-failed <file>\n");
+    printf("\t             Only test the traces that failed in results <file>\n");
+    printf("\t--merge <file>...\n");
+    printf("\t             Print the scoreboard for merged results files\n");
     printf("\t-V           Be more verbose.\n");
     exit(0);
 }
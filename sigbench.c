@@ -0,0 +1,202 @@
+/*
+ * sigbench.c - Shell lab signal-forwarding latency benchmark
+ *
+ * Measures how long a shell takes to forward SIGINT (or SIGTSTP) to
+ * its foreground job, as background load grows. For each load level,
+ * it writes a trace that starts that many "myprobe burn" jobs in the
+ * background to keep the CPUs busy, then runs "myprobe int <rounds>"
+ * in the foreground. myprobe signals the shell, times how long the
+ * signal takes to come back, and reports each round trip to runtrace,
+ * which logs them in its timeline log; sigbench reads them from there.
+ *
+ * Usage: ./sigbench [-hP] [-s <shell>] [-r <rounds>] [-l <load>]
+ *                   [-m int|tstp]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "config.h"
+
+#define MAXLOAD 15             /* The shell's job list holds 16 jobs */
+#define MAXROUNDS 4096         /* JOBSYNC_SAMPLES */
+
+/* Modified by command line args */
+char *shellprog = "./tsh";
+int rounds = 200;
+int max_load = 8;
+char *mode = "int";
+int pid_namespaces = 0;
+
+/* Temp files */
+char tracefile[MAXBUF];
+char outfile[MAXBUF];
+char logfile[MAXBUF];
+
+/* Prototypes */
+void usage(void);
+void write_trace(int load);
+int run_probe(int load, int *nsecs, int *missed);
+int cmpint(const void *a, const void *b);
+void delete_tmpfiles(void);
+
+int main(int argc, char **argv)
+{
+    int c, load, n, missed;
+    static int nsecs[MAXROUNDS];
+
+    while ((c = getopt(argc, argv, "hPs:r:l:m:")) != EOF) {
+	switch (c) {
+	case 's':             /* The shell to test (default ./tsh) */
+	    shellprog = optarg;
+	    break;
+	case 'r':             /* Round trips per load level */
+	    rounds = atoi(optarg);
+	    if (rounds < 1 || rounds > MAXROUNDS) {
+		printf("sigbench: -r must be between 1 and %d\n", MAXROUNDS);
+		exit(1);
+	    }
+	    break;
+	case 'l':             /* Highest load level */
+	    max_load = atoi(optarg);
+	    if (max_load < 0 || max_load > MAXLOAD) {
+		printf("sigbench: -l must be between 0 and %d\n", MAXLOAD);
+		exit(1);
+	    }
+	    break;
+	case 'm':             /* Which signal to forward */
+	    mode = optarg;
+	    if (strcmp(mode, "int") && strcmp(mode, "tstp"))
+		usage();
+	    break;
+	case 'P':             /* Run the shell in its own PID namespace */
+	    pid_namespaces = 1;
+	    break;
+	case 'h':
+	default:
+	    usage();
+	}
+    }
+
+    sprintf(tracefile, "/tmp/sigbench_trace.%d", getpid());
+    sprintf(outfile, "/tmp/sigbench_out.%d", getpid());
+    sprintf(logfile, "/tmp/sigbench_log.%d", getpid());
+    atexit(delete_tmpfiles);
+
+    printf("%s, SIG%s forwarding, %d round trips per load level\n",
+	   shellprog, !strcmp(mode, "int") ? "INT" : "TSTP", rounds);
+    printf("%5s %10s %10s %10s %10s %7s\n", "load", "min", "median", "p99",
+	   "max", "missed");
+    for (load = 0; load <= max_load; load = load ? 2*load : 1) {
+	write_trace(load);
+	n = run_probe(load, nsecs, &missed);
+	if (n == 0) {
+	    printf("%5d %10s %10s %10s %10s %7d\n", load, "-", "-", "-", "-",
+		   missed);
+	    continue;
+	}
+	qsort(nsecs, n, sizeof(int), cmpint);
+	printf("%5d %8.1fus %8.1fus %8.1fus %8.1fus %7d\n", load,
+	       nsecs[0] / 1000.0, nsecs[n / 2] / 1000.0,
+	       nsecs[(n * 99) / 100] / 1000.0, nsecs[n - 1] / 1000.0, missed);
+	fflush(stdout);
+    }
+    exit(0);
+}
+
+/*
+ * write_trace - Write the trace for one load level
+ */
+void write_trace(int load)
+{
+    FILE *fp;
+    int i;
+
+    if ((fp = fopen(tracefile, "w")) == NULL) {
+	perror(tracefile);
+	exit(1);
+    }
+    fprintf(fp, "# sigbench: load %d\n", load);
+    for (i = 0; i < load; i++)
+	fprintf(fp, "./myprobe burn &\nNEXT\nWAIT\n");
+    fprintf(fp, "./myprobe %s %d\nNEXT\nquit\n", mode, rounds);
+    fclose(fp);
+}
+
+/*
+ * run_probe - Run the trace for one load level. Stores the latencies
+ *     that myprobe reported in nsecs and the signals that never came
+ *     back in *missed, and returns the number of latencies.
+ */
+int run_probe(int load, int *nsecs, int *missed)
+{
+    FILE *fp;
+    char cmd[4*MAXBUF], line[MAXBUF], *p;
+    int n = 0, t;
+
+    *missed = 0;
+    sprintf(cmd, "./runtrace %s-s %s -f %s -L %s > %s",
+	    pid_namespaces ? "-P " : "", shellprog, tracefile, logfile, outfile);
+    if (system(cmd) != 0) {
+	printf("sigbench: runtrace failed at load %d\n", load);
+	return 0;
+    }
+
+    if ((fp = fopen(logfile, "r")) == NULL) {
+	perror(logfile);
+	exit(1);
+    }
+    while (fgets(line, MAXBUF, fp)) {
+	if (!strstr(line, "\"ev\":\"probe\"") ||
+	    (p = strstr(line, "\"nsecs\":")) == NULL)
+	    continue;
+	t = atoi(p + 8);
+	if (t < 0)
+	    (*missed)++;
+	else if (n < MAXROUNDS)
+	    nsecs[n++] = t;
+    }
+    fclose(fp);
+    return n;
+}
+
+/*
+ * cmpint - Compare two ints for qsort
+ */
+int cmpint(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+/*
+ * delete_tmpfiles - Remove our temp files
+ */
+void delete_tmpfiles(void)
+{
+    unlink(tracefile);
+    unlink(outfile);
+    unlink(logfile);
+}
+
+/*
+ * usage - Print help message and terminate
+ */
+void usage(void)
+{
+    printf("Usage: sigbench [-hP] [-s <shell>] [-r <rounds>] [-l <load>] "
+	   "[-m int|tstp]\n");
+    printf("Times how long a shell takes to forward a signal to its\n");
+    printf("foreground job, with 0, 1, 2, 4, ... up to <load> busy jobs\n");
+    printf("in the background.\n");
+    printf("Options:\n");
+    printf("  -h            Print this message\n");
+    printf("  -s <shell>    Shell program to test (default ./tsh)\n");
+    printf("  -r <rounds>   Round trips per load level (default 200)\n");
+    printf("  -l <load>     Highest number of busy background jobs "
+	   "(default 8)\n");
+    printf("  -m <mode>     Forward SIGINT (int, default) or SIGTSTP (tstp)\n");
+    printf("  -P            Run the shell in its own PID namespace\n");
+    exit(1);
+}
@@ -0,0 +1,430 @@
+/*
+ * soak.c - Shell lab soak test
+ *
+ * Drives a shell for a long time (an hour by default) with a random
+ * but seeded mix of command patterns: foreground and background jobs,
+ * builtins, and I/O redirection on both. Every interval it samples
+ * the shell's open descriptors (/proc/<pid>/fd), its resident set size
+ * and its zombie children, along with the commands it ran per second.
+ *
+ * It fails if any of the three resources trends upward, that is, if
+ * every sample in the second half of a window of recent samples is
+ * above every sample in the first half, or if throughput over the
+ * last half window falls below half of what it was over the first.
+ * On a leak, it runs each pattern on its own a number of times and
+ * reports the ones that the resource grows with.
+ *
+ * The shell talks to us over a socket, as under runtrace, and its
+ * jobs run standalone (there is no jobsync), so only helpers that do
+ * something sensible on their own are used.
+ *
+ * Usage: ./soak [-h] [-s <shell>] [-d <secs>] [-i <secs>] [-w <n>]
+ *               [-r <seed>]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+#include "config.h"
+
+extern char **environ;
+
+#define MAXSAMPLES 4096
+#define BISECT_ITERS 50        /* Runs of each pattern when bisecting */
+
+/* A command pattern; %s, if present, is replaced by a scratch file */
+struct pattern_t {
+    char *name;
+    char *cmd;
+    long runs;
+};
+
+static struct pattern_t patterns[] = {
+    {"fg",              "/bin/true", 0},
+    {"fg-out",          "/bin/echo soak > %s", 0},
+    {"fg-in",           "./mycat < config.h > /dev/null", 0},
+    {"fg-in-out",       "./mycat < config.h > %s", 0},
+    {"fg-notfound",     "./nosuchcommand", 0},
+    {"bg",              "./mystorm &", 0},
+    {"bg-out",          "./mystorm > %s &", 0},
+    {"builtin",         "jobs", 0},
+    {"builtin-out",     "jobs > %s", 0},
+    {"builtin-in",      "jobs < /dev/null", 0},
+    {"builtin-in-out",  "jobs < /dev/null > %s", 0},
+    {NULL,              NULL, 0}
+};
+
+/* One sample of the shell's resources */
+struct sample_t {
+    int fds;                   /* Open descriptors */
+    long rss;                  /* Resident set size in KB */
+    int zombies;               /* Children that nobody has reaped */
+    double rate;               /* Commands per second since the last one */
+};
+
+static char *metrics[] = {"open fds", "RSS (KB)", "zombies"};
+
+/* Modified by command line args */
+char *shellprog = "./tsh";
+int duration = 3600;
+int interval = 10;
+int window = 12;
+unsigned int seed = 1;
+
+/* The shell */
+pid_t shell_pid;
+int shellfd = -1;
+char scratch[MAXBUF];
+
+/* Prototypes */
+void usage(void);
+void sigalrm_handler(int sig);
+void start_shell(void);
+void run_command(struct pattern_t *p);
+void read_prompt(char *what);
+void take_sample(struct sample_t *s, long commands, double secs);
+long metric(struct sample_t *s, int m);
+int trending(struct sample_t *samples, int n, int m);
+double rate(struct sample_t *samples, int from, int to);
+void bisect(int m);
+double now(void);
+void cleanup(void);
+
+int main(int argc, char **argv)
+{
+    int c, i, m, n = 0, num_patterns, failed = 0;
+    long commands = 0, last_commands = 0;
+    double start, last, t;
+    static struct sample_t samples[MAXSAMPLES];
+
+    while ((c = getopt(argc, argv, "hs:d:i:w:r:")) != EOF) {
+	switch (c) {
+	case 's':             /* The shell to soak (default ./tsh) */
+	    shellprog = optarg;
+	    break;
+	case 'd':             /* How long to run */
+	    duration = atoi(optarg);
+	    break;
+	case 'i':             /* Secs between samples */
+	    interval = atoi(optarg);
+	    break;
+	case 'w':             /* Samples that make a trend */
+	    window = atoi(optarg);
+	    break;
+	case 'r':             /* Seed for the mix of commands */
+	    seed = atoi(optarg);
+	    break;
+	case 'h':
+	default:
+	    usage();
+	}
+    }
+    if (duration < 1 || interval < 1 || window < 4)
+	usage();
+
+    for (num_patterns = 0; patterns[num_patterns].name; num_patterns++)
+	;
+    srand(seed);
+    signal(SIGALRM, sigalrm_handler);
+    sprintf(scratch, "/tmp/soak_scratch.%d", getpid());
+    atexit(cleanup);
+    start_shell();
+
+    printf("Soaking %s for %d secs, seed %u\n", shellprog, duration, seed);
+    printf("%8s %8s %10s %8s %12s\n", "secs", "fds", "rss", "zombies",
+	   "cmds/sec");
+    start = last = now();
+    take_sample(&samples[n++], 0, 1);
+
+    while ((t = now()) - start < duration) {
+	run_command(&patterns[rand() % num_patterns]);
+	commands++;
+	if (t - last < interval)
+	    continue;
+
+	take_sample(&samples[n], commands - last_commands, t - last);
+	printf("%8.0f %8d %10ld %8d %12.0f\n", t - start, samples[n].fds,
+	       samples[n].rss, samples[n].zombies, samples[n].rate);
+	fflush(stdout);
+	last = t;
+	last_commands = commands;
+	n++;
+
+	/* Throughput must hold up over the whole run */
+	if (n > window && rate(samples, n - window/2, n) <
+	    rate(samples, 1, 1 + window/2) / 2) {
+	    printf("soak: throughput fell from %.0f to %.0f commands/sec\n",
+		   rate(samples, 1, 1 + window/2), rate(samples, n - window/2, n));
+	    failed = 1;
+	    break;
+	}
+	for (m = 0; m < 3; m++) {
+	    if (trending(samples, n, m)) {
+		printf("soak: %s trending upward over the last %d samples\n",
+		       metrics[m], window);
+		bisect(m);
+		failed = 1;
+	    }
+	}
+	if (failed || n == MAXSAMPLES)
+	    break;
+    }
+
+    printf("%ld commands:", commands);
+    for (i = 0; i < num_patterns; i++)
+	printf(" %s=%ld", patterns[i].name, patterns[i].runs);
+    printf("\n%s\n", failed ? "FAIL" : "PASS");
+    exit(failed);
+}
+
+/*
+ * start_shell - Start the shell with its stdin and stdout on a socket
+ */
+void start_shell(void)
+{
+    int fds[2];
+    char *argv[] = {shellprog, NULL};
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+	perror("socketpair");
+	exit(1);
+    }
+    if ((shell_pid = fork()) < 0) {
+	perror("fork");
+	exit(1);
+    }
+    if (shell_pid == 0) {
+	close(fds[0]);
+	dup2(fds[1], 0);
+	dup2(fds[1], 1);
+	close(fds[1]);
+	setpgid(0, 0);
+	execve(argv[0], argv, environ);
+	perror(argv[0]);
+	exit(1);
+    }
+    close(fds[1]);
+    shellfd = fds[0];
+    read_prompt("startup");
+}
+
+/*
+ * run_command - Send one command to the shell and wait for the prompt
+ */
+void run_command(struct pattern_t *p)
+{
+    char cmd[MAXBUF];
+
+    snprintf(cmd, MAXBUF - 1, p->cmd, scratch);
+    strcat(cmd, "\n");
+    if (write(shellfd, cmd, strlen(cmd)) < 0) {
+	perror("write to shell");
+	exit(1);
+    }
+    p->runs++;
+    read_prompt(p->cmd);
+}
+
+/*
+ * read_prompt - Read the shell's output up to its next prompt. The
+ *     prompt ends the output, though it may be split across reads.
+ */
+void read_prompt(char *what)
+{
+    char buf[MAXBUF];
+    int n, len = 0;
+
+    alarm(DRIVER_TIMEOUT);
+    while (1) {
+	if ((n = read(shellfd, buf + len, MAXBUF - 1 - len)) <= 0) {
+	    printf("soak: shell died at \"%s\"\n", what);
+	    exit(1);
+	}
+	len += n;
+	buf[len] = '\0';
+	if (len >= strlen(PROMPT) &&
+	    !strcmp(buf + len - strlen(PROMPT), PROMPT))
+	    break;
+	if (len > MAXBUF / 2) {
+	    memmove(buf, buf + len - strlen(PROMPT), strlen(PROMPT));
+	    len = strlen(PROMPT);
+	}
+    }
+    alarm(0);
+}
+
+/*
+ * take_sample - Sample the shell's descriptors, RSS and zombies
+ */
+void take_sample(struct sample_t *s, long commands, double secs)
+{
+    char path[64], line[MAXBUF], *p, *end;
+    DIR *dir;
+    FILE *fp;
+    pid_t child;
+
+    memset(s, 0, sizeof(struct sample_t));
+    s->rate = commands / secs;
+
+    sprintf(path, "/proc/%d/fd", shell_pid);
+    if ((dir = opendir(path)) != NULL) {
+	while (readdir(dir) != NULL)
+	    s->fds++;
+	s->fds -= 2;  /* . and .. */
+	closedir(dir);
+    }
+
+    sprintf(path, "/proc/%d/status", shell_pid);
+    if ((fp = fopen(path, "r")) != NULL) {
+	while (fgets(line, MAXBUF, fp))
+	    if (!strncmp(line, "VmRSS:", 6))
+		s->rss = atol(line + 6);
+	fclose(fp);
+    }
+
+    sprintf(path, "/proc/%d/task/%d/children", shell_pid, shell_pid);
+    if ((fp = fopen(path, "r")) == NULL)
+	return;
+    if (fgets(line, MAXBUF, fp) == NULL)
+	line[0] = '\0';
+    fclose(fp);
+    for (p = line; (child = strtol(p, &end, 10)) > 0; p = end) {
+	char stat[MAXBUF], *q;
+
+	sprintf(path, "/proc/%d/stat", child);
+	if ((fp = fopen(path, "r")) == NULL)
+	    continue;
+	if (fgets(stat, MAXBUF, fp) && (q = strrchr(stat, ')')) && q[1] &&
+	    q[2] == 'Z')
+	    s->zombies++;
+	fclose(fp);
+    }
+}
+
+/*
+ * metric - Return resource m of sample s
+ */
+long metric(struct sample_t *s, int m)
+{
+    return m == 0 ? s->fds : m == 1 ? s->rss : s->zombies;
+}
+
+/*
+ * trending - Return true if resource m went up over the last window
+ *     samples: each of the newer half is above each of the older half
+ */
+int trending(struct sample_t *samples, int n, int m)
+{
+    int i, half = window / 2;
+    long old_max = -1, new_min = -1, v;
+
+    if (n <= window)  /* The first sample is from before the warmup */
+	return 0;
+    for (i = n - window; i < n; i++) {
+	v = metric(&samples[i], m);
+	if (i < n - half)
+	    old_max = (old_max < 0 || v > old_max) ? v : old_max;
+	else
+	    new_min = (new_min < 0 || v < new_min) ? v : new_min;
+    }
+    return new_min > old_max;
+}
+
+/*
+ * rate - Return the mean throughput of samples from to to-1
+ */
+double rate(struct sample_t *samples, int from, int to)
+{
+    double sum = 0;
+    int i;
+
+    for (i = from; i < to; i++)
+	sum += samples[i].rate;
+    return sum / (to - from);
+}
+
+/*
+ * bisect - Run each pattern on its own and report the ones that make
+ *     resource m grow
+ */
+void bisect(int m)
+{
+    struct sample_t before, after;
+    struct pattern_t *p;
+    int i, found = 0;
+
+    printf("soak: running each pattern %d times to find the leak\n",
+	   BISECT_ITERS);
+    for (p = patterns; p->name; p++) {
+	take_sample(&before, 0, 1);
+	for (i = 0; i < BISECT_ITERS; i++)
+	    run_command(p);
+	usleep(100000);  /* Give background jobs time to be reaped */
+	take_sample(&after, 0, 1);
+	if (metric(&after, m) > metric(&before, m)) {
+	    printf("soak:   %-16s \"%s\": %s %ld -> %ld\n", p->name, p->cmd,
+		   metrics[m], metric(&before, m), metric(&after, m));
+	    found = 1;
+	}
+    }
+    if (!found)
+	printf("soak:   no single pattern leaks; it takes a mix\n");
+}
+
+/*
+ * now - Return the time in secs on the monotonic clock
+ */
+double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * sigalrm_handler - The shell never came back with a prompt
+ */
+void sigalrm_handler(int sig)
+{
+    printf("soak: timed out waiting for the shell\n");
+    exit(1);
+}
+
+/*
+ * cleanup - Kill the shell and its jobs and remove the scratch file
+ */
+void cleanup(void)
+{
+    if (shell_pid > 0) {
+	kill(-shell_pid, SIGKILL);
+	kill(shell_pid, SIGKILL);
+    }
+    unlink(scratch);
+}
+
+/*
+ * usage - Print help message and terminate
+ */
+void usage(void)
+{
+    printf("Usage: soak [-h] [-s <shell>] [-d <secs>] [-i <secs>] [-w <n>] "
+	   "[-r <seed>]\n");
+    printf("Drives a shell with a random mix of commands and fails if its\n");
+    printf("descriptors, memory or zombies grow or its throughput drops.\n");
+    printf("Options:\n");
+    printf("  -h            Print this message\n");
+    printf("  -s <shell>    Shell program to soak (default ./tsh)\n");
+    printf("  -d <secs>     How long to run (default 3600)\n");
+    printf("  -i <secs>     Secs between samples (default 10)\n");
+    printf("  -w <n>        Samples that make a trend (default 12)\n");
+    printf("  -r <seed>     Seed for the mix of commands (default 1)\n");
+    exit(1);
+}
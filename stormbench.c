@@ -0,0 +1,266 @@
+/*
+ * stormbench.c - Shell lab SIGCHLD storm benchmark
+ *
+ * Measures how fast a shell reaps a burst of background jobs that all
+ * exit or stop at once, and checks that it loses none of them. For
+ * each job count n, it writes a trace that starts n mystorm jobs in
+ * the background, releases them all with a single "SIGNAL all", and
+ * waits for the shell to SETTLE, that is, to reap every job it can and
+ * go back to sleep. It then lists the jobs and quits.
+ *
+ * The time to settle comes from runtrace's timeline log, so it is
+ * only as fine as runtrace's polling (see SETTLE_USECS in runtrace.c).
+ * From the shell's output it checks each job: one that exited must be
+ * gone from the job list, one that stopped must be listed as Stopped
+ * and reported exactly once. A job that is neither is "lost"; one
+ * reported more than once is "dup".
+ *
+ * Usage: ./stormbench [-hP] [-s <shell>] [-n <jobs>] [-i <iters>]
+ *                     [-m exit|stop|mixed]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "config.h"
+
+#define MAXSTORM 15            /* The shell's job list holds 16 jobs */
+#define MAXITERS 100
+
+/* One job of a storm, as seen in the shell's output */
+struct stormjob_t {
+    int pid;
+    int stop;                  /* True if the job stops, false if it exits */
+    int reported;              /* "stopped by signal" messages */
+    int listed;                /* Listed by the jobs builtin */
+};
+
+/* Modified by command line args */
+char *shellprog = "./tsh";
+int max_jobs = MAXSTORM;
+int iters = 5;
+char *mode = "mixed";
+int pid_namespaces = 0;
+
+/* Temp files */
+char tracefile[MAXBUF];
+char outfile[MAXBUF];
+char logfile[MAXBUF];
+
+/* Prototypes */
+void usage(void);
+void write_trace(int n);
+long run_storm(int n, int *lost, int *dup);
+int stops(int i);
+int cmplong(const void *a, const void *b);
+void delete_tmpfiles(void);
+
+int main(int argc, char **argv)
+{
+    int c, n, i, lost, dup, total_lost = 0, total_dup = 0;
+    long usecs[MAXITERS];
+    long med;
+
+    while ((c = getopt(argc, argv, "hPs:n:i:m:")) != EOF) {
+	switch (c) {
+	case 's':             /* The shell to test (default ./tsh) */
+	    shellprog = optarg;
+	    break;
+	case 'n':             /* Largest storm */
+	    max_jobs = atoi(optarg);
+	    if (max_jobs < 1 || max_jobs > MAXSTORM) {
+		printf("stormbench: -n must be between 1 and %d\n", MAXSTORM);
+		exit(1);
+	    }
+	    break;
+	case 'i':             /* Runs per storm size */
+	    iters = atoi(optarg);
+	    if (iters < 1 || iters > MAXITERS) {
+		printf("stormbench: -i must be between 1 and %d\n", MAXITERS);
+		exit(1);
+	    }
+	    break;
+	case 'm':             /* What the jobs do */
+	    mode = optarg;
+	    if (strcmp(mode, "exit") && strcmp(mode, "stop") &&
+		strcmp(mode, "mixed"))
+		usage();
+	    break;
+	case 'P':             /* Run the shell in its own PID namespace */
+	    pid_namespaces = 1;
+	    break;
+	case 'h':
+	default:
+	    usage();
+	}
+    }
+
+    sprintf(tracefile, "/tmp/stormbench_trace.%d", getpid());
+    sprintf(outfile, "/tmp/stormbench_out.%d", getpid());
+    sprintf(logfile, "/tmp/stormbench_log.%d", getpid());
+    atexit(delete_tmpfiles);
+
+    printf("%s, %s storms, median of %d runs\n", shellprog, mode, iters);
+    printf("%5s %12s %12s %6s %6s\n", "jobs", "settle", "reaps/sec",
+	   "lost", "dup");
+    for (n = 1; n <= max_jobs; n++) {
+	write_trace(n);
+	lost = dup = 0;
+	for (i = 0; i < iters; i++)
+	    usecs[i] = run_storm(n, &lost, &dup);
+	qsort(usecs, iters, sizeof(long), cmplong);
+	med = usecs[iters / 2];
+	if (med < 0)
+	    printf("%5d %12s %12s %6d %6d\n", n, "timeout", "-", lost, dup);
+	else
+	    printf("%5d %10.3fms %12.0f %6d %6d\n", n, med / 1000.0,
+		   med ? n * 1e6 / med : 0.0, lost, dup);
+	fflush(stdout);
+	total_lost += lost;
+	total_dup += dup;
+    }
+    exit(total_lost || total_dup);
+}
+
+/*
+ * stops - Return true if job i of a storm stops rather than exits
+ */
+int stops(int i)
+{
+    if (!strcmp(mode, "mixed"))
+	return i % 2;
+    return !strcmp(mode, "stop");
+}
+
+/*
+ * write_trace - Write the trace for a storm of n jobs
+ */
+void write_trace(int n)
+{
+    FILE *fp;
+    int i;
+
+    if ((fp = fopen(tracefile, "w")) == NULL) {
+	perror(tracefile);
+	exit(1);
+    }
+    fprintf(fp, "# stormbench: %d jobs\n", n);
+    for (i = 0; i < n; i++)
+	fprintf(fp, "./mystorm %s &\nNEXT\nWAIT\n", stops(i) ? "stop" : "exit");
+    fprintf(fp, "SIGNAL all\nSETTLE\njobs\nNEXT\nquit\n");
+    fclose(fp);
+}
+
+/*
+ * run_storm - Run the storm trace once. Adds the jobs it lost and
+ *     reported twice to *lost and *dup, and returns the usecs that the
+ *     shell took to settle, or -1 if runtrace failed.
+ */
+long run_storm(int n, int *lost, int *dup)
+{
+    FILE *fp;
+    char cmd[4*MAXBUF], line[MAXBUF], *p;
+    struct stormjob_t jobs[MAXSTORM];
+    int i, num_jobs = 0, jid, pid, status;
+    long usecs = -1;
+
+    sprintf(cmd, "./runtrace %s-s %s -f %s -L %s > %s",
+	    pid_namespaces ? "-P " : "", shellprog, tracefile, logfile, outfile);
+    status = system(cmd);
+    if (status != 0) {
+	printf("stormbench: runtrace failed on %d jobs\n", n);
+	*lost += n;
+	return -1;
+    }
+
+    /* Match the shell's output up with the jobs */
+    if ((fp = fopen(outfile, "r")) == NULL) {
+	perror(outfile);
+	exit(1);
+    }
+    while (fgets(line, MAXBUF, fp)) {
+	if (sscanf(line, "Job [%d] (%d) stopped by signal", &jid, &pid) == 2) {
+	    for (i = 0; i < num_jobs && jobs[i].pid != pid; i++)
+		;
+	    if (i < num_jobs)
+		jobs[i].reported++;
+	}
+	else if (sscanf(line, "[%d] (%d)", &jid, &pid) == 2) {
+	    for (i = 0; i < num_jobs && jobs[i].pid != pid; i++)
+		;
+	    if (i < num_jobs)
+		jobs[i].listed += (strstr(line, "Stopped") ||
+				   strstr(line, "Running"));
+	    else if (num_jobs < MAXSTORM) {
+		memset(&jobs[num_jobs], 0, sizeof(struct stormjob_t));
+		jobs[num_jobs].pid = pid;
+		jobs[num_jobs].stop = strstr(line, "stop") != NULL;
+		num_jobs++;
+	    }
+	}
+    }
+    fclose(fp);
+
+    *lost += n - num_jobs;
+    for (i = 0; i < num_jobs; i++) {
+	if (jobs[i].stop ? (!jobs[i].listed || !jobs[i].reported)
+	                 : jobs[i].listed)
+	    (*lost)++;
+	if (jobs[i].reported > 1)
+	    (*dup)++;
+    }
+
+    /* The settle event has the time */
+    if ((fp = fopen(logfile, "r")) == NULL) {
+	perror(logfile);
+	exit(1);
+    }
+    while (fgets(line, MAXBUF, fp))
+	if (strstr(line, "\"ev\":\"settle\"") &&
+	    (p = strstr(line, "\"usecs\":")) != NULL)
+	    usecs = atol(p + 8);
+    fclose(fp);
+    return usecs;
+}
+
+/*
+ * cmplong - Compare two longs for qsort
+ */
+int cmplong(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * delete_tmpfiles - Remove our temp files
+ */
+void delete_tmpfiles(void)
+{
+    unlink(tracefile);
+    unlink(outfile);
+    unlink(logfile);
+}
+
+/*
+ * usage - Print help message and terminate
+ */
+void usage(void)
+{
+    printf("Usage: stormbench [-hP] [-s <shell>] [-n <jobs>] [-i <iters>] "
+	   "[-m exit|stop|mixed]\n");
+    printf("Times how fast a shell reaps background jobs that exit or stop\n");
+    printf("all at once, for storms of 1 to <jobs> jobs.\n");
+    printf("Options:\n");
+    printf("  -h            Print this message\n");
+    printf("  -s <shell>    Shell program to test (default ./tsh)\n");
+    printf("  -n <jobs>     Largest storm (default and max %d)\n", MAXSTORM);
+    printf("  -i <iters>    Runs per storm size, of which we take the "
+	   "median (default 5)\n");
+    printf("  -m <mode>     Jobs exit, stop, or alternate (default mixed)\n");
+    printf("  -P            Run the shell in its own PID namespace\n");
+    exit(1);
+}
@@ -0,0 +1,501 @@
+/*
+ * tracelog.c - Shell lab timeline log viewer
+ *
+ * Renders the timeline logs that "runtrace -L <file>" writes. Given
+ * one log, prints a per-directive breakdown of where the time went:
+ * how long each directive took, when the shell's first output and the
+ * next prompt arrived, and how much was sent and received. Given two
+ * logs of the same trace (say tsh and tshref, or before and after a
+ * change), prints their directives side by side with the difference.
+ *
+ * With -y, it instead prints the syscalls that "runtrace -T" counted
+ * for each command, with the time the shell spent in them, or for two
+ * logs, both counts and their difference, so that two shells can be
+ * compared call by call.
+ *
+ * The log is NDJSON with one flat object per line, as written by
+ * runtrace, so a few string searches are all the parsing it needs.
+ *
+ * Usage: ./tracelog [-hy] <log> [<log2>]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "config.h"
+
+#define MAXCALLS 64            /* Different syscalls per directive */
+
+/* What one directive's command spent in one syscall (runtrace -T) */
+struct syscall_t {
+    char name[32];
+    int count;
+    long usecs;
+};
+
+/* One directive of the trace, with the events that it caused */
+struct directive_t {
+    int line;                  /* Line number in the trace file */
+    char text[MAXBUF];         /* The directive itself */
+    long start;                /* Usecs since the start of the run */
+    long end;
+    long first;                /* Usecs to the first output, or -1 */
+    long prompt;               /* Usecs to the next prompt, or -1 */
+    int sent;                  /* Bytes sent to the shell */
+    int received;              /* Bytes received from the shell */
+    int syncs;                 /* Job syncs */
+    int releases;              /* Job releases */
+    int signals;               /* Signals sent to the shell */
+    int vjumps;                /* Virtual clock advances */
+    int timeout;               /* True if runtrace timed out here */
+    struct syscall_t calls[MAXCALLS];
+    int num_calls;
+};
+
+/* A whole log */
+struct log_t {
+    char *file;                /* Log file name */
+    char trace[MAXBUF];        /* Trace file that runtrace ran */
+    struct directive_t *dirs;
+    int num_dirs;
+    int max_dirs;
+};
+
+/* Prototypes */
+void usage(void);
+void read_log(char *filename, struct log_t *log);
+struct directive_t *adddirective(struct log_t *log, int line, char *text, long t);
+struct directive_t *finddirective(struct log_t *log, int line, char *text);
+void addsyscall(struct directive_t *d, char *name, int count, long usecs);
+struct syscall_t *findsyscall(struct directive_t *d, char *name);
+long getnum(char *json, char *key, long dflt);
+int getstr(char *json, char *key, char *dst, int size);
+void print_log(struct log_t *log);
+void compare_logs(struct log_t *a, struct log_t *b);
+void print_syscalls(struct log_t *log);
+void compare_syscalls(struct log_t *a, struct log_t *b);
+char *usecs(char *dst, long t);
+char *delta(char *dst, long t);
+
+int main(int argc, char **argv)
+{
+    int c, syscalls = 0;
+    struct log_t a, b;
+
+    while ((c = getopt(argc, argv, "hy")) != EOF) {
+	switch (c) {
+	case 'y':             /* Show the syscalls that runtrace -T counted */
+	    syscalls = 1;
+	    break;
+	case 'h':
+	default:
+	    usage();
+	}
+    }
+
+    if (argc - optind == 1) {
+	read_log(argv[optind], &a);
+	if (syscalls)
+	    print_syscalls(&a);
+	else
+	    print_log(&a);
+    }
+    else if (argc - optind == 2) {
+	read_log(argv[optind], &a);
+	read_log(argv[optind + 1], &b);
+	if (syscalls)
+	    compare_syscalls(&a, &b);
+	else
+	    compare_logs(&a, &b);
+    }
+    else
+	usage();
+    exit(0);
+}
+
+/*
+ * read_log - Read a timeline log and split it into directives. The
+ *     time before the first directive shows up as "(startup)", and the
+ *     time from EOF to the shell's exit as "(shutdown)".
+ */
+void read_log(char *filename, struct log_t *log)
+{
+    FILE *fp;
+    char json[4*MAXBUF], ev[32], text[MAXBUF], name[32];
+    long t = 0;
+    struct directive_t *d, *sd;
+
+    if ((fp = fopen(filename, "r")) == NULL) {
+	perror(filename);
+	exit(1);
+    }
+    memset(log, 0, sizeof(struct log_t));
+    log->file = filename;
+    strcpy(log->trace, "?");
+    d = adddirective(log, 0, "(startup)", 0);
+
+    while (fgets(json, sizeof(json), fp)) {
+	if (!getstr(json, "ev", ev, sizeof(ev)))
+	    continue;
+	t = getnum(json, "t", t);
+
+	if (!strcmp(ev, "start"))
+	    getstr(json, "trace", log->trace, MAXBUF);
+	else if (!strcmp(ev, "directive")) {
+	    d->end = t;
+	    getstr(json, "text", text, MAXBUF);
+	    d = adddirective(log, getnum(json, "line", 0), text, t);
+	}
+	else if (!strcmp(ev, "eof")) {
+	    d->end = t;
+	    d = adddirective(log, 0, "(shutdown)", t);
+	}
+	else if (!strcmp(ev, "send"))
+	    d->sent += getnum(json, "bytes", 0);
+	else if (!strcmp(ev, "recv")) {
+	    d->received += getnum(json, "bytes", 0);
+	    if (d->first < 0)
+		d->first = t - d->start;
+	}
+	else if (!strcmp(ev, "prompt"))
+	    d->prompt = t - d->start;
+	else if (!strcmp(ev, "sync"))
+	    d->syncs++;
+	else if (!strcmp(ev, "release"))
+	    d->releases++;
+	else if (!strcmp(ev, "signal"))
+	    d->signals++;
+	else if (!strcmp(ev, "vclock"))
+	    d->vjumps++;
+	else if (!strcmp(ev, "timeout"))
+	    d->timeout = 1;
+
+	/* These come at the end, each for the command on its line */
+	else if (!strcmp(ev, "syscall")) {
+	    getstr(json, "cmd", text, MAXBUF);
+	    getstr(json, "name", name, sizeof(name));
+	    if ((sd = finddirective(log, getnum(json, "line", 0), text)))
+		addsyscall(sd, name, getnum(json, "count", 0),
+			   getnum(json, "usecs", 0));
+	}
+    }
+    d->end = t;
+    fclose(fp);
+}
+
+/*
+ * adddirective - Append a directive that starts at time t to the log
+ */
+struct directive_t *adddirective(struct log_t *log, int line, char *text, long t)
+{
+    struct directive_t *d;
+
+    if (log->num_dirs == log->max_dirs) {
+	log->max_dirs = log->max_dirs ? 2*log->max_dirs : 64;
+	log->dirs = realloc(log->dirs,
+			    log->max_dirs * sizeof(struct directive_t));
+	if (log->dirs == NULL) {
+	    perror("realloc");
+	    exit(1);
+	}
+    }
+    d = &log->dirs[log->num_dirs++];
+    memset(d, 0, sizeof(struct directive_t));
+    d->line = line;
+    strncpy(d->text, text, MAXBUF - 1);
+    d->start = d->end = t;
+    d->first = d->prompt = -1;
+    return d;
+}
+
+/*
+ * finddirective - Return the directive on the given line of the trace
+ *     with the given text, or NULL. (startup) and (shutdown) are both
+ *     on line 0.
+ */
+struct directive_t *finddirective(struct log_t *log, int line, char *text)
+{
+    int i;
+
+    for (i = 0; i < log->num_dirs; i++)
+	if (log->dirs[i].line == line && !strcmp(log->dirs[i].text, text))
+	    return &log->dirs[i];
+    return NULL;
+}
+
+/*
+ * addsyscall - Add count calls to syscall name, taking usecs in all,
+ *     to directive d
+ */
+void addsyscall(struct directive_t *d, char *name, int count, long usecs)
+{
+    struct syscall_t *sc;
+
+    if ((sc = findsyscall(d, name)) == NULL) {
+	if (d->num_calls == MAXCALLS)
+	    return;
+	sc = &d->calls[d->num_calls++];
+	strncpy(sc->name, name, sizeof(sc->name) - 1);
+	sc->name[sizeof(sc->name) - 1] = '\0';
+	sc->count = 0;
+	sc->usecs = 0;
+    }
+    sc->count += count;
+    sc->usecs += usecs;
+}
+
+/*
+ * findsyscall - Return directive d's entry for syscall name, or NULL
+ */
+struct syscall_t *findsyscall(struct directive_t *d, char *name)
+{
+    int i;
+
+    for (i = 0; i < d->num_calls; i++)
+	if (!strcmp(d->calls[i].name, name))
+	    return &d->calls[i];
+    return NULL;
+}
+
+/*
+ * getnum - Return the value of numeric member key, or dflt if the
+ *          object has no such member
+ */
+long getnum(char *json, char *key, long dflt)
+{
+    char pattern[64];
+    char *p;
+
+    sprintf(pattern, "\"%.50s\":", key);
+    if ((p = strstr(json, pattern)) == NULL)
+	return dflt;
+    return atol(p + strlen(pattern));
+}
+
+/*
+ * getstr - Copy the value of string member key into dst, undoing the
+ *          escapes that runtrace writes. Returns 0 if there is none.
+ */
+int getstr(char *json, char *key, char *dst, int size)
+{
+    char pattern[64];
+    char *p, *q = dst;
+
+    sprintf(pattern, "\"%.50s\":\"", key);
+    if ((p = strstr(json, pattern)) == NULL)
+	return 0;
+    for (p += strlen(pattern); *p && *p != '"' && q - dst < size - 1; p++) {
+	if (*p == '\\' && p[1] == 'u') {
+	    *q++ = strtol(p + 2, NULL, 16);
+	    p += 5;
+	}
+	else if (*p == '\\' && p[1])
+	    *q++ = *++p;
+	else
+	    *q++ = *p;
+    }
+    *q = '\0';
+    return 1;
+}
+
+/*
+ * print_log - Print the per-directive breakdown of a log
+ */
+void print_log(struct log_t *log)
+{
+    int i;
+    long total = 0;
+    char t1[32], t2[32], t3[32];
+    struct directive_t *d;
+
+    printf("%s (%s)\n", log->file, log->trace);
+    printf("%5s  %-32s %10s %10s %10s %6s %6s  %s\n", "line", "directive",
+	   "total", "output", "prompt", "sent", "recv", "events");
+    for (i = 0; i < log->num_dirs; i++) {
+	d = &log->dirs[i];
+	total += d->end - d->start;
+	printf("%5d  %-32.32s %10s %10s %10s %6d %6d ", d->line, d->text,
+	       usecs(t1, d->end - d->start), usecs(t2, d->first),
+	       usecs(t3, d->prompt), d->sent, d->received);
+	if (d->syncs)
+	    printf(" sync=%d", d->syncs);
+	if (d->releases)
+	    printf(" release=%d", d->releases);
+	if (d->signals)
+	    printf(" signal=%d", d->signals);
+	if (d->vjumps)
+	    printf(" vclock=%d", d->vjumps);
+	if (d->timeout)
+	    printf(" TIMEOUT");
+	printf("\n");
+    }
+    printf("%5s  %-32s %10s\n", "", "Total", usecs(t1, total));
+}
+
+/*
+ * compare_logs - Print two logs side by side, one directive per row.
+ *     Rows whose directives don't match are flagged with a '!'.
+ */
+void compare_logs(struct log_t *a, struct log_t *b)
+{
+    int i, n;
+    long ta = 0, tb = 0, da, db;
+    char t1[32], t2[32], t3[32];
+    struct directive_t *x, *y;
+
+    n = a->num_dirs > b->num_dirs ? a->num_dirs : b->num_dirs;
+    printf("A: %s (%s)\nB: %s (%s)\n", a->file, a->trace, b->file, b->trace);
+    printf("%5s  %-32s %10s %10s %10s\n", "line", "directive",
+	   "A", "B", "B-A");
+    for (i = 0; i < n; i++) {
+	x = i < a->num_dirs ? &a->dirs[i] : NULL;
+	y = i < b->num_dirs ? &b->dirs[i] : NULL;
+	da = x ? x->end - x->start : -1;
+	db = y ? y->end - y->start : -1;
+	ta += da > 0 ? da : 0;
+	tb += db > 0 ? db : 0;
+	printf("%5d%c %-32.32s %10s %10s %10s\n", x ? x->line : y->line,
+	       (x && y && !strcmp(x->text, y->text)) ? ' ' : '!',
+	       x ? x->text : y->text, usecs(t1, da), usecs(t2, db),
+	       (x && y) ? delta(t3, db - da) : "-");
+    }
+    printf("%5s  %-32s %10s %10s %10s\n", "", "Total",
+	   usecs(t1, ta), usecs(t2, tb), delta(t3, tb - ta));
+}
+
+/*
+ * print_syscalls - Print the syscalls of each command in a log, and
+ *     their totals over the run
+ */
+void print_syscalls(struct log_t *log)
+{
+    int i, j, n = 0;
+    char t1[32];
+    struct directive_t *d;
+    static struct directive_t total;
+
+    printf("%s (%s)\n", log->file, log->trace);
+    printf("%5s  %-32s %-20s %6s %10s\n", "line", "command", "syscall",
+	   "count", "time");
+    for (i = 0; i < log->num_dirs; i++) {
+	d = &log->dirs[i];
+	for (j = 0; j < d->num_calls; j++) {
+	    printf("%5d  %-32.32s %-20s %6d %10s\n", d->line,
+		   j ? "" : d->text, d->calls[j].name, d->calls[j].count,
+		   usecs(t1, d->calls[j].usecs));
+	    addsyscall(&total, d->calls[j].name, d->calls[j].count,
+		       d->calls[j].usecs);
+	    n += d->calls[j].count;
+	}
+    }
+    if (n == 0) {
+	printf("No syscalls in the log (run runtrace with -T)\n");
+	return;
+    }
+    for (j = 0; j < total.num_calls; j++)
+	printf("%5s  %-32s %-20s %6d %10s\n", "", j ? "" : "Total",
+	       total.calls[j].name, total.calls[j].count,
+	       usecs(t1, total.calls[j].usecs));
+    printf("%5s  %-32s %-20s %6d\n", "", "", "all", n);
+}
+
+/*
+ * compare_syscalls - Print the syscalls of each command in two logs
+ *     side by side, with the difference in count and time. Like
+ *     compare_logs, it pairs the logs' directives up in order.
+ */
+void compare_syscalls(struct log_t *a, struct log_t *b)
+{
+    int i, j, k, n, first, na = 0, nb = 0;
+    char t1[32], t2[32], t3[32];
+    struct directive_t *x, *y, *d;
+    struct syscall_t *p, *q, none = { "", 0, 0 };
+    static struct directive_t ta, tb;
+
+    n = a->num_dirs > b->num_dirs ? a->num_dirs : b->num_dirs;
+    printf("A: %s (%s)\nB: %s (%s)\n", a->file, a->trace, b->file, b->trace);
+    printf("%5s  %-32s %-20s %6s %6s %6s %10s %10s %10s\n", "line", "command",
+	   "syscall", "A", "B", "B-A", "A time", "B time", "B-A");
+    for (i = 0; i <= n; i++) {
+	/* The last time round, compare the totals */
+	if (i == n) {
+	    x = &ta;
+	    y = &tb;
+	}
+	else {
+	    x = i < a->num_dirs ? &a->dirs[i] : NULL;
+	    y = i < b->num_dirs ? &b->dirs[i] : NULL;
+	}
+
+	/* All of A's syscalls, then those that only B made */
+	first = 1;
+	for (k = 0; k < 2; k++) {
+	    d = k ? y : x;
+	    for (j = 0; d && j < d->num_calls; j++) {
+		p = k ? findsyscall(x, d->calls[j].name) : &d->calls[j];
+		q = k ? &d->calls[j] : (y ? findsyscall(y, d->calls[j].name) : NULL);
+		if (k && p)
+		    continue;
+		p = p ? p : &none;
+		q = q ? q : &none;
+		printf("%5d%c %-32.32s %-20s %6d %6d %+6d %10s %10s %10s\n",
+		       i == n ? 0 : (x ? x->line : y->line),
+		       (i == n || (x && y && !strcmp(x->text, y->text))) ? ' ' : '!',
+		       !first ? "" : (i == n ? "Total" : (x ? x->text : y->text)),
+		       d->calls[j].name, p->count, q->count, q->count - p->count,
+		       usecs(t1, p->usecs), usecs(t2, q->usecs),
+		       delta(t3, q->usecs - p->usecs));
+		first = 0;
+		if (i < n) {
+		    if (!k) {
+			addsyscall(&ta, p->name, p->count, p->usecs);
+			na += p->count;
+		    }
+		    if (q != &none) {
+			addsyscall(&tb, q->name, q->count, q->usecs);
+			nb += q->count;
+		    }
+		}
+	    }
+	}
+    }
+    printf("%5s  %-32s %-20s %6d %6d %+6d\n", "", "", "all", na, nb, nb - na);
+}
+
+/*
+ * usecs - Format a time in usecs as msecs, or "-" if it is negative
+ *         (i.e., unknown)
+ */
+char *usecs(char *dst, long t)
+{
+    if (t < 0)
+	strcpy(dst, "-");
+    else
+	sprintf(dst, "%.3fms", t / 1000.0);
+    return dst;
+}
+
+/*
+ * delta - Format a difference of two times in usecs as signed msecs
+ */
+char *delta(char *dst, long t)
+{
+    sprintf(dst, "%+.3fms", t / 1000.0);
+    return dst;
+}
+
+/*
+ * usage - Print help message and terminate
+ */
+void usage(void)
+{
+    printf("Usage: tracelog [-hy] <log> [<log2>]\n");
+    printf("Prints a per-directive breakdown of a runtrace -L log, or\n");
+    printf("compares two logs side by side.\n");
+    printf("Options:\n");
+    printf("  -h            Print this message\n");
+    printf("  -y            Show the shell's syscalls per command instead\n");
+    printf("                (from runtrace -T)\n");
+    exit(1);
+}
@@ -5,6 +5,11 @@
  * Shell can handle i/o redirection but no support for pipes
  *
  * Native builtin commands are (Jobs, bg, fg and quit)
+ *
+ * Also runs small scripts: variables, $(( )) arithmetic, {a,b} and
+ * {1..N} brace expansion, if/while/until/for, functions, and the
+ * builtins echo, test ([), true, false, unset, export and source (.).
+ * Those are compiled to bytecode and run without forking.
  * 
  * Timothy Kaboya - tkaboya
  */
@@ -14,11 +19,13 @@
 #include <unistd.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 #include <signal.h>
 #include <sys/types.h>
 #include <fcntl.h>
 #include <sys/wait.h>
 #include <errno.h>
+#include <sys/stat.h>
 
 /* Misc manifest constants */
 #define MAXLINE    1024   /* max line size */
@@ -50,6 +57,7 @@
 /* Global variables */
 extern char **environ;      /* defined in libc */
 char prompt[] = "tsh> ";    /* command line prompt (DO NOT CHANGE) */
+char prompt2[] = "> ";      /* prompt for the rest of a command */
 int verbose = 0;            /* if true, print additional output */
 int nextjid = 1;            /* next job ID to allocate */
 char sbuf[MAXLINE];         /* for composing sprintf messages */
@@ -73,13 +81,84 @@ struct cmdline_tokens {
         BUILTIN_QUIT,
         BUILTIN_JOBS,
         BUILTIN_BG,
-        BUILTIN_FG} builtins;
+        BUILTIN_FG,
+        BUILTIN_ECHO,       /* these only compute, so they run in line */
+        BUILTIN_TRUE,
+        BUILTIN_FALSE,
+        BUILTIN_TEST,
+        BUILTIN_UNSET,
+        BUILTIN_EXPORT,
+        BUILTIN_SOURCE} builtins;
+};
+
+/* Script state */
+int last_status = 0;        /* exit status of the last command ($?) */
+volatile sig_atomic_t fg_status = 0;   /* set when the fg job ends */
+volatile sig_atomic_t interrupted = 0; /* ctrl-c stops the script */
+
+/* The lines of an unfinished command, that eval has been given so far */
+char *pending = NULL;
+int pending_len = 0, pending_cap = 0;
+
+/*
+ * Compound commands (if, while, until, for and functions) are compiled
+ * to bytecode, which a small VM runs. Each instruction has an opcode
+ * and up to two operands.
+ */
+enum opcode_t {
+    OP_CMD,                 /* run simple command a */
+    OP_JMP,                 /* jump to a */
+    OP_JFALSE,              /* jump to a if $? is nonzero */
+    OP_JTRUE,               /* jump to a if $? is zero */
+    OP_STATUS,              /* set $? to a */
+    OP_FORINIT,             /* push a loop over the words of command a */
+    OP_FORNEXT,             /* set variable a to the next word, or jump to b */
+    OP_FORPOP,              /* pop the innermost loop */
+    OP_DEFUN,               /* define function a with the body that
+                               follows, then jump to b */
+    OP_RET,                 /* return from a function with the status
+                               in command a (or $? if a < 0) */
+    OP_HALT                 /* end of the script */
+};
+
+struct insn_t {
+    unsigned char op;
+    int a, b;
+};
+
+/* A simple command, with its words as they were typed */
+struct simple_t {
+    int argc;
+    char **words;           /* the words, not yet expanded */
+    char *plain;            /* true if the word needs no expansion */
+    char *infile;           /* the input file, or NULL */
+    char *outfile;          /* the output file, or NULL */
+    int bg;                 /* true if it ends with & */
+    int builtin;            /* builtins_t of argv[0], or -1 if unknown */
+    char *text;             /* the source text, for the job list */
+};
+
+/* A compiled command line or script: its code, and the simple commands
+ * that the code runs, all in one block. A block that was malloc'd is
+ * freed once nothing refers to it any more. */
+struct prog_t {
+    struct insn_t *code;
+    int len;
+    struct simple_t *simples;
+    int num_simples;
+    int refs;               /* runs, functions and caches that use it */
+    int owned;              /* true if malloc'd, false if the line block */
 };
 
+#define PARSE_OK     0      /* compiled */
+#define PARSE_ERROR -1      /* syntax error, already reported */
+#define PARSE_MORE  -2      /* the command goes on in the next line */
+
 /* End global variables */
 
 /* Function prototypes */
-void eval(char *cmdline);
+int eval(char *cmdline);
+int run_command(struct cmdline_tokens *tok, int bg, char *cmdline);
 
 void sigchld_handler(int sig);
 void sigtstp_handler(int sig);
@@ -90,6 +169,21 @@ int builtin_command(struct cmdline_tokens *tok);
 int execbg(struct cmdline_tokens *tok);
 int execfg(struct cmdline_tokens *tok);
 
+/* Scripting */
+void script_init(void);
+int compile(char *src, struct prog_t **prog, int keep);
+void release(struct prog_t *prog);
+void vm_run(struct prog_t *prog, int pc);
+int source(int argc, char **argv);
+int builtin_type(char *name);
+int run_builtin(int type, int argc, char **argv);
+int eval_test(int argc, char **argv);
+int valid_name(char *s, int len);
+int intern(char *name, int len);
+void setvar(int i, const char *value);
+char *getvar(char *name, int len);
+void expand(char **words, char *plain, int n);
+
 /* Here are helper routines that we've provided for you */
 int parseline(const char *cmdline, struct cmdline_tokens *tok); 
 void sigquit_handler(int sig);
@@ -154,6 +248,7 @@ main(int argc, char **argv)
     char c;
     char cmdline[MAXLINE];    /* cmdline for fgets */
     int emit_prompt = 1; /* emit prompt (default) */
+    int more = 0;        /* in the middle of a compound command */
 
     /* Redirect stderr to stdout (so that driver will get all output
      * on the pipe connected to stdout) */
@@ -190,18 +285,21 @@ main(int argc, char **argv)
 
     /* Initialize the job list */
     initjobs(job_list);
+    script_init();
 
     /* Execute the shell's read/eval loop */
     while (1) {
 
         if (emit_prompt) {
-            printf("%s", prompt);
+            printf("%s", more ? prompt2 : prompt);
             fflush(stdout);
         }
         if ((fgets(cmdline, MAXLINE, stdin) == NULL) && ferror(stdin))
             app_error("fgets error");
         if (feof(stdin)) { 
             /* End of file (ctrl-d) */
+            if (more)
+                fprintf(stderr, "Error: syntax error: unexpected end of file\n");
             printf ("\n");
             fflush(stdout);
             fflush(stderr);
@@ -212,7 +310,7 @@ main(int argc, char **argv)
         cmdline[strlen(cmdline)-1] = '\0';
 
         /* Evaluate the command line */
-        eval(cmdline);
+        more = eval(cmdline);
 
         fflush(stdout);
         fflush(stdout);
@@ -224,6 +322,46 @@ main(int argc, char **argv)
 /* 
  * eval - Evaluate the command line that the user has just typed in
  * 
+ * The line is compiled (see the scripting section below) and run. A
+ * line that opens an if, while, until, for or function definition
+ * without closing it is kept, and eval returns 1 to ask for the next
+ * line; the lines are compiled together once the command is complete.
+ * Returns 0 otherwise.
+ */
+    int 
+eval(char *cmdline) 
+{
+    int len = strlen(cmdline), rc;
+    struct prog_t *prog;
+
+    if (pending_len + len + 2 > pending_cap) {
+        pending_cap = 2 * (pending_len + len + 2);
+        if ((pending = realloc(pending, pending_cap)) == NULL)
+            unix_error("realloc error");
+    }
+    if (pending_len > 0)
+        pending[pending_len++] = '\n';
+    memcpy(pending + pending_len, cmdline, len + 1);
+    pending_len += len;
+
+    if ((rc = compile(pending, &prog, 0)) == PARSE_MORE)
+        return 1;
+    pending_len = 0;
+    if (rc == PARSE_ERROR) {
+        last_status = 2;
+        return 0;
+    }
+
+    interrupted = 0;
+    vm_run(prog, 0);
+    fflush(stdout);
+    release(prog);
+    return 0;
+}
+
+/* 
+ * run_command - Run a builtin or a job, and return its exit status
+ * 
  * If the user has requested a built-in command (quit, jobs, bg or fg)
  * then execute it immediately. Otherwise, fork a child process and
  * run the job in the context of the child. If the job is running in
@@ -232,13 +370,11 @@ main(int argc, char **argv)
  * background children don't receive SIGINT (SIGTSTP) from the kernel
  * when we type ctrl-c (ctrl-z) at the keyboard.  
  */
-    void 
-eval(char *cmdline) 
+    int 
+run_command(struct cmdline_tokens *tok, int bg, char *cmdline) 
 {
-    int bg;              /* should the job run in bg or fg? */
     int state;           /* define states for job */
     int infd, outfd;     /* File Descriptors for Std I/O */
-    struct cmdline_tokens tok;
     pid_t pid;
 
     sigset_t mask, prev;
@@ -250,18 +386,14 @@ eval(char *cmdline)
     Signal(SIGTTIN, SIG_IGN);
     Signal(SIGTTOU, SIG_IGN);
 
-    /* Parse command line */
-    bg = parseline(cmdline, &tok);
-    if (bg == -1) /* parsing error */
-        return;
-    if (tok.argv[0] == NULL) /* ignore empty lines */
-        return;
-
-    /* Save STDOUT file descriptor for reuse */
-    if (tok.infile != NULL)
-        infd = dup(STDIN_FILENO);
-    if (tok.outfile != NULL)
-        outfd = dup(STDOUT_FILENO);
+    /* 
+     * Save STDIN and STDOUT file descriptors for reuse. The copies are
+     * close-on-exec, so the job doesn't inherit them
+     */
+    if (tok->infile != NULL)
+        infd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+    if (tok->outfile != NULL)
+        outfd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
 
     /* map token state to job structure */
     if(bg)    
@@ -272,22 +404,25 @@ eval(char *cmdline)
     Sigprocmask(SIG_BLOCK, &mask, &prev);   /* Block SIGCHLD */
 
     /* Handling Normal Commands */
-    if (!builtin_command(&tok)) {
+    if (!builtin_command(tok)) {
+        fg_status = 0;
         if ((pid = Fork()) == 0) { 
             setpgid(0, 0);
             Sigprocmask(SIG_SETMASK, &prev, NULL);  /* Unblock SigCHLD */
             /* Handling I/O redirection in child */
-            if (tok.infile != NULL) {
+            if (tok->infile != NULL) {
                 /* Use Open instead of "open"!!! This one handles errors */
-                int childinfd = open(tok.infile, O_RDONLY); 
+                int childinfd = open(tok->infile, O_RDONLY); 
                 dup2(childinfd,0); 
+                close(childinfd);
             }
-            if (tok.outfile != NULL) {
-                int childoutfd = open(tok.outfile, O_CREAT | O_WRONLY);
+            if (tok->outfile != NULL) {
+                int childoutfd = open(tok->outfile, O_CREAT | O_WRONLY, 0644);
                 dup2(childoutfd,1); 
+                close(childoutfd);
             }
-            if (execve(tok.argv[0], tok.argv, environ) < 0) {
-                printf("%s: Command not found\n", tok.argv[0]);
+            if (execve(tok->argv[0], tok->argv, environ) < 0) {
+                printf("%s: Command not found\n", tok->argv[0]);
                 exit(1);
             }
         }
@@ -300,43 +435,58 @@ eval(char *cmdline)
         if (!bg) {
             while (fgpid(job_list)) 
                 Sigsuspend(&prev);
-        }else 
+            last_status = fg_status;
+        }else {
             printf("[%d] (%d) %s \n", pid2jid(pid), pid, cmdline);
+            last_status = 0;
+        }
 
     } else
         Sigprocmask(SIG_SETMASK, &prev, NULL);
 
-            if (tok.infile != NULL) {
+            /* Restore STDIN and STDOUT and drop the saved copies */
+            fflush(stdout);
+            if (tok->infile != NULL) {
                 dup2(infd,0); 
+                close(infd);
             }
-            if (tok.outfile != NULL) {
+            if (tok->outfile != NULL) {
                 dup2(outfd,1); 
+                close(outfd);
             }
-    return;
+    return last_status;
 }
 
 /*===========Tim's helper functions ===================================*/
 /* if first arg is built in command, run it and return 1 */    
 int builtin_command(struct cmdline_tokens *tok) 
 {
-
-    if (tok->infile != NULL) {
+    /* Only builtins run in the shell itself, so only they redirect it */
+    if (tok->builtins != BUILTIN_NONE && tok->infile != NULL) {
         int childinfd = open(tok->infile, O_RDONLY);
         dup2(childinfd,0); 
+        close(childinfd);
     }
-    if (tok->outfile != NULL) {
-        int childoutfd = open(tok->outfile, O_CREAT | O_WRONLY);
+    if (tok->builtins != BUILTIN_NONE && tok->outfile != NULL) {
+        int childoutfd = open(tok->outfile, O_CREAT | O_WRONLY, 0644);
         dup2(childoutfd,1); 
+        close(childoutfd);
     }
     if (tok->builtins == BUILTIN_QUIT) {                 /* quit command */
         exit(0);
     } else if (tok->builtins == BUILTIN_JOBS) {          /* jobs command */
         listjobs(job_list, 1);
+        last_status = 0;
         return 1;
     } else if (tok->builtins == BUILTIN_BG) {            /* bg command */
+        last_status = 0;
         return execbg(tok);
     } else if (tok->builtins == BUILTIN_FG) {            /* fg command */
+        last_status = 0;
         return execfg(tok);
+    } else if (tok->builtins >= BUILTIN_ECHO) {          /* echo, test... */
+        last_status = run_builtin(tok->builtins, tok->argc, tok->argv);
+        return 1;
     }
     if (!strcmp(tok->argv[0], "&"))
         return 1;
@@ -568,17 +718,7 @@ parseline(const char *cmdline, struct cmdline_tokens *tok)
     if (tok->argc == 0)  /* ignore blank line */
         return 1;
 
-    if (!strcmp(tok->argv[0], "quit")) {                 /* quit command */
-        tok->builtins = BUILTIN_QUIT;
-    } else if (!strcmp(tok->argv[0], "jobs")) {          /* jobs command */
-        tok->builtins = BUILTIN_JOBS;
-    } else if (!strcmp(tok->argv[0], "bg")) {            /* bg command */
-        tok->builtins = BUILTIN_BG;
-    } else if (!strcmp(tok->argv[0], "fg")) {            /* fg command */
-        tok->builtins = BUILTIN_FG;
-    } else {
-        tok->builtins = BUILTIN_NONE;
-    }
+    tok->builtins = builtin_type(tok->argv[0]);
 
     /* Should the job run in the background? */
     if ((is_bg = (*tok->argv[tok->argc-1] == '&')) != 0)
@@ -587,195 +727,2284 @@ parseline(const char *cmdline, struct cmdline_tokens *tok)
     return is_bg;
 }
 
+/*============== Scripting: compiler and VM ==============*/
 
-/*****************
- * Signal handlers
- *****************/
+/*
+ * A line that starts an if, while, until or for, or defines a function,
+ * may go on over several lines (eval asks for more until the compound
+ * command is complete). The whole of it is compiled once, into a
+ * prog_t of instructions and simple commands, and then run by vm_run.
+ * Only external commands fork: builtins, assignments, loops, tests and
+ * function calls all run in the shell itself. A function keeps the
+ * prog_t that defined it, and source keeps the progs of the scripts
+ * it has run, so that it need not read them again.
+ *
+ * Grammar (";" and newlines separate commands; keywords are only
+ * recognized where a command starts):
+ *
+ *   if LIST then LIST [elif LIST then LIST]... [else LIST] fi
+ *   while LIST do LIST done          until LIST do LIST done
+ *   for NAME [in WORD...] ; do LIST done
+ *   NAME() { LIST }                  function NAME { LIST }
+ *   break   continue   return [N]    NAME=VALUE...
+ *
+ * Unquoted words first have brace expansion: a{b,c}d gives abd acd,
+ * and {1..5}, {5..1}, {a..e} and {1..10..2} give sequences. Then they
+ * expand $NAME, ${NAME}, $?, $#, $$, $0-$9, $@ and $(( EXPR )), except
+ * in single quotes. Unquoted expansions are split on white space.
+ */
 
-/* 
- * sigchld_handler - The kernel sends a SIGCHLD to the shell whenever
- *     a child job terminates (becomes a zombie), or stops because it
- *     received a SIGSTOP, SIGTSTP, SIGTTIN or SIGTTOU signal. The 
- *     handler reaps all available zombie children, but doesn't wait 
- *     for any other currently running children to terminate.  
+#define MAXNEST     64      /* loops nested in one function */
+#define MAXBREAKS   64      /* breaks out of one loop */
+#define MAXCALLS  1000      /* function call depth */
+#define VARHASH    256      /* variable hash buckets (power of 2) */
+#define MAXSCRIPTS  32      /* compiled scripts that source keeps */
+#define MAXSOURCE   64      /* source nesting depth */
+#define MAXWORDS (1 << 20)  /* words that one command expands to */
+
+/* The code being compiled, and its simple commands. Until compile
+ * copies them out, their words and text are slices of the source. */
+struct slice_t {
+    char *s;                /* NULL if none */
+    int len;
+};
+struct psimple_t {
+    int word;               /* its first word in pwords */
+    int argc;
+    struct slice_t infile, outfile, text;
+    int bg;
+};
+struct insn_t *code = NULL;
+int code_len = 0, code_cap = 0;
+struct psimple_t *simples = NULL;
+int num_simples = 0, max_simples = 0;
+struct slice_t *pwords = NULL;
+int num_pwords = 0, max_pwords = 0;
+
+/* A line that defines no functions is only run once, so it is compiled
+ * into this block, which every line reuses, rather than a malloc'd one */
+char *line_block = NULL;
+int line_cap = 0;
+
+/* Tokens */
+enum { T_EOF, T_SEP, T_AMP, T_LT, T_GT, T_WORD };
+
+/* Parser state */
+struct parser_t {
+    char *p;                /* next character of the source */
+    int tok;                /* current token */
+    char *word;             /* its text, if a T_WORD */
+    int wordlen;
+    char *start, *end;      /* where the token is in the source */
+    int nest;               /* open compound commands */
+    int loops;              /* enclosing loops (in this function) */
+    int cont[MAXNEST];      /* where continue goes, per loop */
+    int breaks[MAXNEST][MAXBREAKS]; /* breaks to patch, per loop */
+    int num_breaks[MAXNEST];
+};
+
+/* Shell variables */
+struct var_t {
+    char *name;
+    char *value;
+    int cap;
+    int exported;           /* assignments go to the environment too */
+    int next;               /* next variable in the hash chain */
+};
+struct var_t *vars = NULL;
+int num_vars = 0, max_vars = 0;
+int var_hash[VARHASH];
+
+/* Functions */
+struct func_t {
+    char *name;
+    struct prog_t *prog;    /* the code that defined it */
+    int entry;
+};
+struct func_t *funcs = NULL;
+int num_funcs = 0, max_funcs = 0;
+
+/* Loops that the VM is running */
+struct loop_t {
+    char **items;           /* the words, in one block */
+    int n, i;
+};
+struct loop_t *loops = NULL;
+int num_loops = 0, max_loops = 0;
+
+/* Function calls, and the positional parameters */
+struct frame_t {
+    struct prog_t *prog;    /* the caller's code */
+    int ret;                /* where to return to in it */
+    int loops;              /* loops that were running at the call */
+    char **params;          /* the caller's parameters */
+    int num_params;
+    int infd, outfd;        /* the caller's stdin and stdout, if the
+                               call redirected them, or -1 */
+};
+struct frame_t frames[MAXCALLS];
+int num_frames = 0;
+char **params = NULL;
+int num_params = 0;
+
+/* Scripts that source has compiled, by which version of which file */
+struct script_t {
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    off_t size;
+    struct prog_t *prog;
+    unsigned long used;     /* when it last ran, to evict the LRU one */
+};
+struct script_t scripts[MAXSCRIPTS];
+int num_scripts = 0;
+unsigned long script_clock = 0;
+
+/* Expansion arena. Each command's words are expanded into xbuf, one
+ * after another, and xoff records where each starts. It is rewound, not
+ * freed, for the next command, so it only grows to the largest one. */
+char *xbuf = NULL;
+int xlen = 0, xcap = 0;
+int *xoff = NULL;
+int xargc = 0, xargcap = 0;
+char **xargv = NULL;
+int xargv_cap = 0;
+int xerror = 0;             /* an expansion failed, and said why */
+
+/*
+ * grow - Make room for n more elements of size in *array
  */
-    void 
-sigchld_handler(int sig) 
+static void grow(void *array, int *max, int n, int size)
 {
-    int olderrno = errno;
-    int status;
-    sigset_t mask, prev;
-    pid_t pid; 
+    void **a = array;
 
-    Sigemptyset(&mask);
-    Sigaddset(&mask, SIGCHLD);
-    Sigaddset(&mask, SIGINT);
-    Sigaddset(&mask, SIGTSTP);
+    if (n <= *max)
+        return;
+    while (*max < n)
+        *max = *max ? 2 * *max : 64;
+    if ((*a = realloc(*a, (size_t)*max * size)) == NULL)
+        unix_error("realloc error");
+}
 
-    if(verbose) 
-        printf("sigchld_handler: entering\n");
+/*
+ * emit - Append an instruction, and return its address
+ */
+static int emit(int op, int a, int b)
+{
+    grow(&code, &code_cap, code_len + 1, sizeof(struct insn_t));
+    code[code_len].op = op;
+    code[code_len].a = a;
+    code[code_len].b = b;
+    return code_len++;
+}
 
-    while ((pid = waitpid(-1, &status, WNOHANG|WUNTRACED|WCONTINUED)) > 0) {
-        Sigprocmask(SIG_BLOCK, &mask, &prev);
-        /* Handling children exit status */
-        if(verbose)
-            printf("sigchld_handler: Job [%d] (%d) in handler \n",
-                    pid2jid(pid), pid);
-        if (WIFEXITED(status))  {
-            if (verbose) {
-                printf("sigchld_handler: ");
-                // fflush(stdout);
-                printf("Job [%d] (%d) terminates OK (status %d)\n",
-                        pid2jid(pid), pid, WSTOPSIG(status));
+/*
+ * next_token - Read the next token. Words are delimited by white space
+ *     and ";", except inside quotes, and keep their quotes until they
+ *     are expanded.
+ */
+static int next_token(struct parser_t *ps)
+{
+    char *p = ps->p, *q;
+    int depth;
+
+    while (*p == ' ' || *p == '\t' || *p == '\r')
+        p++;
+    if (*p == '#')                      /* comment */
+        while (*p && *p != '\n')
+            p++;
+    ps->start = p;
+    if (*p == '\0')
+        ps->tok = T_EOF;
+    else if (*p == ';' || *p == '\n')
+        ps->tok = T_SEP, p++;
+    else if (*p == '<')
+        ps->tok = T_LT, p++;
+    else if (*p == '>')
+        ps->tok = T_GT, p++;
+    else if (*p == '&' && (p[1] == '\0' || strchr(" \t\r\n;", p[1])))
+        ps->tok = T_AMP, p++;
+    else {
+        ps->tok = T_WORD;
+        ps->word = p;
+        while (*p && !strchr(" \t\r\n;", *p)) {
+            if (*p == '\'' || *p == '\"') {
+                if ((q = strchr(p + 1, *p)) == NULL) {
+                    fprintf(stderr, "Error: unmatched %c.\n", *p);
+                    return ps->tok = -1;
+                }
+                p = q;
             }
-            deletejob(job_list, pid);   /* Child terminated, remove job */
-        }
-        if (WIFSIGNALED(status))  {
-            printf("Job [%d] (%d) terminated by signal %d\n", pid2jid(pid),
-                    pid, WTERMSIG(status));
-            deletejob(job_list, pid);   /* Child terminated, remove job*/
-        }
-        if (WIFSTOPPED(status))  {
-            printf("Job [%d] (%d) stopped by signal %d\n", pid2jid(pid),
-                    pid, WSTOPSIG(status));
-            stopjob(job_list, pid);   /* Child stopped */
-        }
-        if (WIFCONTINUED(status)) { 
-            if (verbose)
-                printf("Job [%d] (%d) restarted by signal %d\n",
-                        pid2jid(pid), pid, SIGCONT);
+            else if (p[0] == '$' && p[1] == '(' && p[2] == '(') {
+                for (depth = 0, q = p + 1; *q; q++)
+                    if (*q == '(')
+                        depth++;
+                    else if (*q == ')' && --depth == 0)
+                        break;
+                if (*q == '\0') {
+                    fprintf(stderr, "Error: unmatched $((.\n");
+                    return ps->tok = -1;
+                }
+                p = q;
+            }
+            p++;
         }
-        // fflush(stdout);
-        Sigprocmask(SIG_SETMASK, &prev, NULL);
+        ps->wordlen = p - ps->word;
     }
+    ps->end = p;
+    ps->p = p;
+    return ps->tok;
+}
 
-    errno = olderrno;
-
-    if(verbose) 
-        printf("sigchld_handler: exiting\n");
-    return;
+/*
+ * is_word - True if the current token is the unquoted word kw
+ */
+static int is_word(struct parser_t *ps, char *kw)
+{
+    return ps->tok == T_WORD && (int)strlen(kw) == ps->wordlen &&
+        !strncmp(ps->word, kw, ps->wordlen);
 }
 
-/* 
- * sigint_handler - The kernel sends a SIGINT to the shell whenever the
- *    user types ctrl-c at the keyboard.  Catch it and send it along
- *    to the foreground job.  
+/*
+ * is_stop - True if the current token ends a list: a keyword in stops
+ *     (a space-separated list), or the end of the source
  */
-    void 
-sigint_handler(int sig) 
+static int is_stop(struct parser_t *ps, char *stops)
 {
-    pid_t pid;  /* stores the pid of fg job */
+    char kw[16];
+    int n;
 
-    if(verbose) 
-        printf("sigint_handler: entering\n");
-    /* if job found, delete it, otherwise do nothing */
-    if ((pid = fgpid(job_list)) > 0) {
-        Kill(-pid, SIGINT);
-        if(verbose)
-            printf("sigint_handler: Job [%d] (%d) killed \n",
-                    pid2jid(pid), pid);
+    if (ps->tok == T_EOF)
+        return 1;
+    while (stops && sscanf(stops, "%15s%n", kw, &n) == 1) {
+        if (is_word(ps, kw))
+            return 1;
+        stops += n;
     }
-    if(verbose) 
-        printf("sigint_handler: exiting\n");
-    return;
+    return 0;
 }
 
 /*
- * sigtstp_handler - The kernel sends a SIGTSTP to the shell whenever
- *     the user types ctrl-z at the keyboard. Catch it and suspend the
- *     foreground job by sending it a SIGTSTP.  
+ * syntax_error - Report an unexpected token. At the end of the source
+ *     inside a compound command, ask for more lines instead.
  */
-    void 
-sigtstp_handler(int sig) 
+static int syntax_error(struct parser_t *ps)
 {
-    pid_t pid;
+    if (ps->tok == T_EOF && ps->nest > 0)
+        return PARSE_MORE;
+    if (ps->tok == T_EOF)
+        fprintf(stderr, "Error: syntax error at end of line\n");
+    else
+        fprintf(stderr, "Error: syntax error near '%.*s'\n",
+                (int)(ps->end - ps->start), ps->start);
+    return PARSE_ERROR;
+}
 
-    if(verbose) 
-        printf("sigtstp_handler: entering\n");
-    /* For each process in foreground, place job in stopped state */
-    if ((pid = fgpid(job_list)) > 0) {
-        Kill(-pid, SIGTSTP);
-        if(verbose)
-            printf("sigtstp_handler: Job [%d] (%d) stopped \n",
-                    pid2jid(pid), pid);
-    }
+/*
+ * skip_seps - Skip separators, as between the commands of a list
+ */
+static int skip_seps(struct parser_t *ps)
+{
+    while (ps->tok == T_SEP)
+        if (next_token(ps) < 0)
+            return PARSE_ERROR;
+    return PARSE_OK;
+}
 
+/*
+ * expect - Consume the keyword kw, or fail
+ */
+static int expect(struct parser_t *ps, char *kw)
+{
+    if (!is_word(ps, kw))
+        return syntax_error(ps);
+    return next_token(ps) < 0 ? PARSE_ERROR : PARSE_OK;
+}
 
-    if(verbose) 
-        printf("sigtstp_handler: entering\n");
-    return;
+/*
+ * newsimple - Start a new simple command, and return its index
+ */
+static int newsimple(void)
+{
+    grow(&simples, &max_simples, num_simples + 1, sizeof(struct psimple_t));
+    memset(&simples[num_simples], 0, sizeof(struct psimple_t));
+    return num_simples++;
 }
 
 /*
- * sigquit_handler - The driver program can gracefully terminate the
- *    child shell by sending it a SIGQUIT signal.
+ * slice - Make a slice of the source, or of a string that stays put
  */
-    void 
-sigquit_handler(int sig) 
+static struct slice_t slice(char *s, int len)
 {
-    if(verbose) 
-        sio_puts("sigquit_handler: entering\n");
+    struct slice_t sl;
 
-    sio_error("Terminating after receipt of SIGQUIT signal\n");
+    sl.s = s;
+    sl.len = len;
+    return sl;
 }
 
+/*
+ * addword - Add the current token's word to a simple command. A
+ *     command's words are added one after another, with no other
+ *     command's in between.
+ */
+static void addword(struct psimple_t *cmd, struct parser_t *ps)
+{
+    grow(&pwords, &max_pwords, num_pwords + 1, sizeof(struct slice_t));
+    if (cmd->argc++ == 0)
+        cmd->word = num_pwords;
+    pwords[num_pwords++] = slice(ps->word, ps->wordlen);
+}
 
+static int parse_list(struct parser_t *ps, char *stops);
 
-/*********************
- * End signal handlers
- *********************/
-
-/***********************************************
- * Helper routines that manipulate the job list
- **********************************************/
+/*
+ * parse_simple - Compile a simple command: words, with redirections and
+ *     a trailing &, up to a separator
+ */
+static int parse_simple(struct parser_t *ps)
+{
+    int i = newsimple(), state = ST_NORMAL;
+    struct psimple_t *cmd;
+    char *start = ps->start, *end = ps->start;
+
+    while (ps->tok == T_WORD || ps->tok == T_LT || ps->tok == T_GT) {
+        cmd = &simples[i];
+        if (ps->tok == T_LT || ps->tok == T_GT) {
+            if (ps->tok == T_LT ? cmd->infile.s != NULL : cmd->outfile.s != NULL) {
+                fprintf(stderr, "Error: Ambiguous I/O redirection\n");
+                return PARSE_ERROR;
+            }
+            state |= (ps->tok == T_LT) ? ST_INFILE : ST_OUTFILE;
+        }
+        else if (state == ST_NORMAL) {
+            if (cmd->argc < MAXARGS - 1)
+                addword(cmd, ps);
+        }
+        else if (state == ST_INFILE || state == ST_OUTFILE) {
+            if (state == ST_INFILE)
+                cmd->infile = slice(ps->word, ps->wordlen);
+            else
+                cmd->outfile = slice(ps->word, ps->wordlen);
+            state = ST_NORMAL;
+        }
+        else {
+            fprintf(stderr, "Error: Ambiguous I/O redirection\n");
+            return PARSE_ERROR;
+        }
+        end = ps->end;
+        if (next_token(ps) < 0)
+            return PARSE_ERROR;
+    }
+    if (state != ST_NORMAL) {
+        fprintf(stderr, "Error: must provide file name for redirection\n");
+        return PARSE_ERROR;
+    }
 
-/* clearjob - Clear the entries in a job struct */
-void 
-clearjob(struct job_t *job) {
-    job->pid = 0;
-    job->jid = 0;
-    job->state = UNDEF;
-    job->cmdline[0] = '\0';
+    cmd = &simples[i];
+    if (ps->tok == T_AMP) {
+        cmd->bg = 1;
+        end = ps->end;
+        if (next_token(ps) < 0)
+            return PARSE_ERROR;
+    }
+    cmd->text = slice(start, end - start);
+    if (cmd->argc > 0 || cmd->bg)
+        emit(OP_CMD, i, 0);
+    return PARSE_OK;
 }
 
-/* initjobs - Initialize the job list */
-void 
-initjobs(struct job_t *job_list) {
-    int i;
-
-    for (i = 0; i < MAXJOBS; i++)
-        clearjob(&job_list[i]);
+/*
+ * parse_if - Compile if LIST then LIST [elif LIST then LIST]... [else LIST] fi
+ */
+static int parse_if(struct parser_t *ps)
+{
+    int rc, jfalse, ends[MAXBREAKS], num_ends = 0, i;
+
+    do {                                /* "if" or "elif" */
+        if (next_token(ps) < 0)
+            return PARSE_ERROR;
+        if ((rc = parse_list(ps, "then")) < 0 || (rc = expect(ps, "then")) < 0)
+            return rc;
+        jfalse = emit(OP_JFALSE, 0, 0);
+        if ((rc = parse_list(ps, "elif else fi")) < 0)
+            return rc;
+        if (num_ends == MAXBREAKS) {
+            fprintf(stderr, "Error: too many elifs\n");
+            return PARSE_ERROR;
+        }
+        ends[num_ends++] = emit(OP_JMP, 0, 0);
+        code[jfalse].a = code_len;
+    } while (is_word(ps, "elif"));
+
+    if (is_word(ps, "else")) {
+        if (next_token(ps) < 0)
+            return PARSE_ERROR;
+        if ((rc = parse_list(ps, "fi")) < 0)
+            return rc;
+    }
+    else
+        emit(OP_STATUS, 0, 0);          /* no branch ran */
+    if ((rc = expect(ps, "fi")) < 0)
+        return rc;
+    for (i = 0; i < num_ends; i++)
+        code[ends[i]].a = code_len;
+    return PARSE_OK;
 }
 
-/* maxjid - Returns largest allocated job ID */
-    int 
-maxjid(struct job_t *job_list) 
+/*
+ * open_loop, close_loop - Track the loops that break and continue
+ *     refer to. close_loop patches the breaks to jump to end.
+ */
+static int open_loop(struct parser_t *ps, int cont)
 {
-    int i, max=0;
-
-    for (i = 0; i < MAXJOBS; i++)
-        if (job_list[i].jid > max)
-            max = job_list[i].jid;
-    return max;
+    if (ps->loops == MAXNEST) {
+        fprintf(stderr, "Error: loops nested too deeply\n");
+        return PARSE_ERROR;
+    }
+    ps->cont[ps->loops] = cont;
+    ps->num_breaks[ps->loops] = 0;
+    ps->loops++;
+    return PARSE_OK;
 }
 
-/* addjob - Add a job to the job list */
-    int 
-addjob(struct job_t *job_list, pid_t pid, int state, char *cmdline) 
+static void close_loop(struct parser_t *ps, int end)
 {
     int i;
 
-    if (pid < 1)
-        return 0;
+    ps->loops--;
+    for (i = 0; i < ps->num_breaks[ps->loops]; i++)
+        code[ps->breaks[ps->loops][i]].a = end;
+}
 
-    for (i = 0; i < MAXJOBS; i++) {
-        if (job_list[i].pid == 0) {
-            job_list[i].pid = pid;
-            job_list[i].state = state;
-            job_list[i].jid = nextjid++;
+/*
+ * parse_while - Compile while (or until) LIST do LIST done. The loop
+ *     ends with status 0, rather than that of the last body command
+ *     as in sh, since nothing keeps that once the test has run.
+ */
+static int parse_while(struct parser_t *ps)
+{
+    int rc, top = code_len, exit, until = is_word(ps, "until");
+
+    if (next_token(ps) < 0)
+        return PARSE_ERROR;
+    if ((rc = parse_list(ps, "do")) < 0 || (rc = expect(ps, "do")) < 0)
+        return rc;
+    exit = emit(until ? OP_JTRUE : OP_JFALSE, 0, 0);
+    if ((rc = open_loop(ps, top)) < 0)
+        return rc;
+    if ((rc = parse_list(ps, "done")) < 0 || (rc = expect(ps, "done")) < 0)
+        return rc;
+    emit(OP_JMP, top, 0);
+    code[exit].a = code_len;
+    emit(OP_STATUS, 0, 0);
+    close_loop(ps, code_len);
+    return PARSE_OK;
+}
+
+/*
+ * parse_for - Compile for NAME [in WORD...] ; do LIST done
+ */
+static int parse_for(struct parser_t *ps)
+{
+    int rc, words, next, var;
+
+    if (next_token(ps) < 0)
+        return PARSE_ERROR;
+    if (ps->tok != T_WORD || !valid_name(ps->word, ps->wordlen))
+        return syntax_error(ps);
+    var = intern(ps->word, ps->wordlen);
+    words = newsimple();
+    if (next_token(ps) < 0)
+        return PARSE_ERROR;
+    if (is_word(ps, "in")) {
+        if (next_token(ps) < 0)
+            return PARSE_ERROR;
+        while (ps->tok == T_WORD) {
+            addword(&simples[words], ps);
+            if (next_token(ps) < 0)
+                return PARSE_ERROR;
+        }
+    }
+    else {                              /* for NAME; is for NAME in "$@" */
+        ps->word = "\"$@\"";
+        ps->wordlen = 4;
+        addword(&simples[words], ps);
+    }
+    simples[words].text = slice("for", 3);
+    if ((rc = skip_seps(ps)) < 0 || (rc = expect(ps, "do")) < 0)
+        return rc;
+
+    emit(OP_FORINIT, words, 0);
+    next = emit(OP_FORNEXT, var, 0);
+    if ((rc = open_loop(ps, next)) < 0)
+        return rc;
+    if ((rc = parse_list(ps, "done")) < 0 || (rc = expect(ps, "done")) < 0)
+        return rc;
+    emit(OP_JMP, next, 0);
+    code[next].b = code_len;
+    close_loop(ps, code_len);
+    emit(OP_FORPOP, 0, 0);
+    return PARSE_OK;
+}
+
+/*
+ * parse_function - Compile NAME() { LIST } or function NAME { LIST }.
+ *     The body is compiled in line, and OP_DEFUN jumps over it.
+ */
+static int parse_function(struct parser_t *ps, char *name, int len)
+{
+    int rc, name_cmd, defun, saved_loops = ps->loops;
+
+    if (next_token(ps) < 0)
+        return PARSE_ERROR;
+    if ((rc = skip_seps(ps)) < 0 || (rc = expect(ps, "{")) < 0)
+        return rc;
+    name_cmd = newsimple();
+    simples[name_cmd].text = slice(name, len);
+    defun = emit(OP_DEFUN, name_cmd, 0);
+
+    ps->loops = 0;                      /* break can't leave a function */
+    if ((rc = parse_list(ps, "}")) < 0 || (rc = expect(ps, "}")) < 0)
+        return rc;
+    ps->loops = saved_loops;
+    emit(OP_RET, -1, 0);
+    code[defun].b = code_len;
+    return PARSE_OK;
+}
+
+/*
+ * parse_command - Compile one command, simple or compound
+ */
+static int parse_command(struct parser_t *ps)
+{
+    int rc, n, cmd;
+    char *name;
+
+    if (ps->tok != T_WORD)
+        return parse_simple(ps);
+
+    ps->nest++;
+    if (is_word(ps, "if"))
+        rc = parse_if(ps);
+    else if (is_word(ps, "while") || is_word(ps, "until"))
+        rc = parse_while(ps);
+    else if (is_word(ps, "for"))
+        rc = parse_for(ps);
+    else if (is_word(ps, "function")) {
+        if (next_token(ps) < 0)
+            return PARSE_ERROR;
+        if (ps->tok != T_WORD)
+            return syntax_error(ps);
+        name = ps->word;
+        n = ps->wordlen;
+        if (n > 2 && !strncmp(name + n - 2, "()", 2))
+            n -= 2;
+        rc = parse_function(ps, name, n);
+    }
+    else if (ps->wordlen > 2 && !strncmp(ps->word + ps->wordlen - 2, "()", 2))
+        rc = parse_function(ps, ps->word, ps->wordlen - 2);
+    else if (is_word(ps, "break") || is_word(ps, "continue")) {
+        if (ps->loops == 0) {
+            fprintf(stderr, "Error: %.*s outside a loop\n", ps->wordlen,
+                    ps->word);
+            return PARSE_ERROR;
+        }
+        n = ps->loops - 1;
+        if (is_word(ps, "continue"))
+            emit(OP_JMP, ps->cont[n], 0);
+        else if (ps->num_breaks[n] == MAXBREAKS) {
+            fprintf(stderr, "Error: too many breaks\n");
+            return PARSE_ERROR;
+        }
+        else
+            ps->breaks[n][ps->num_breaks[n]++] = emit(OP_JMP, 0, 0);
+        rc = next_token(ps) < 0 ? PARSE_ERROR : PARSE_OK;
+    }
+    else if (is_word(ps, "return")) {
+        if (next_token(ps) < 0)
+            return PARSE_ERROR;
+        cmd = -1;
+        if (ps->tok == T_WORD) {
+            cmd = newsimple();
+            addword(&simples[cmd], ps);
+            simples[cmd].text = slice("return", 6);
+            if (next_token(ps) < 0)
+                return PARSE_ERROR;
+        }
+        emit(OP_RET, cmd, 0);
+        rc = PARSE_OK;
+    }
+    else if (is_stop(ps, "then elif else fi do done }"))
+        rc = syntax_error(ps);         /* a keyword out of place */
+    else
+        rc = parse_simple(ps);
+    ps->nest--;
+    return rc;
+}
+
+/*
+ * parse_list - Compile commands up to one of the keywords in stops
+ */
+static int parse_list(struct parser_t *ps, char *stops)
+{
+    int rc;
+
+    if ((rc = skip_seps(ps)) < 0)
+        return rc;
+    while (!is_stop(ps, stops)) {
+        if ((rc = parse_command(ps)) < 0)
+            return rc;
+        if (ps->tok != T_SEP && !is_stop(ps, stops))
+            return syntax_error(ps);
+        if ((rc = skip_seps(ps)) < 0)
+            return rc;
+    }
+    if (ps->tok == T_EOF && ps->nest > 0)
+        return PARSE_MORE;
+    return PARSE_OK;
+}
+
+/*
+ * copy_slice - Copy a slice to *s as a string, and advance *s past it.
+ *     Returns the string, or NULL for no slice.
+ */
+static char *copy_slice(char **s, struct slice_t sl)
+{
+    char *str = *s;
+
+    if (sl.s == NULL)
+        return NULL;
+    memcpy(str, sl.s, sl.len);
+    str[sl.len] = '\0';
+    *s += sl.len + 1;
+    return str;
+}
+
+/* Round n up so that pointers can follow it */
+#define ALIGNED(n) (((n) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+/*
+ * copy_out - Copy the code just compiled, with its simple commands, into
+ *     one block: a malloc'd one if keep is set, or else the line block.
+ *     The block holds the prog_t, the code, the simple commands, their
+ *     word lists and then all of the strings.
+ */
+static struct prog_t *copy_out(int keep)
+{
+    struct prog_t *p;
+    struct psimple_t *ps;
+    struct simple_t *cmd;
+    size_t size, chars = 0;
+    char **w, *s;
+    int i, j;
+
+    for (i = 0; i < num_pwords; i++)
+        chars += pwords[i].len + 2;     /* with its plain flag */
+    for (i = 0; i < num_simples; i++) {
+        ps = &simples[i];
+        chars += (ps->infile.s ? ps->infile.len + 1 : 0) +
+            (ps->outfile.s ? ps->outfile.len + 1 : 0) +
+            (ps->text.s ? ps->text.len + 1 : 0);
+    }
+    size = ALIGNED(sizeof(struct prog_t)) +
+        ALIGNED(code_len * sizeof(struct insn_t)) +
+        num_simples * sizeof(struct simple_t) +
+        (num_pwords + num_simples) * sizeof(char *) + chars;
+
+    if (!keep) {
+        grow(&line_block, &line_cap, size, 1);
+        p = (struct prog_t *)line_block;
+    }
+    else if ((p = malloc(size)) == NULL)
+        unix_error("malloc error");
+    p->code = (struct insn_t *)((char *)p + ALIGNED(sizeof(struct prog_t)));
+    p->simples = (struct simple_t *)
+        ((char *)p->code + ALIGNED(code_len * sizeof(struct insn_t)));
+    w = (char **)(p->simples + num_simples);
+    s = (char *)(w + num_pwords + num_simples);
+
+    memcpy(p->code, code, code_len * sizeof(struct insn_t));
+    for (i = 0; i < num_simples; i++) {
+        ps = &simples[i];
+        cmd = &p->simples[i];
+        cmd->argc = ps->argc;
+        cmd->words = w;
+        for (j = 0; j < ps->argc; j++)
+            *w++ = copy_slice(&s, pwords[ps->word + j]);
+        *w++ = NULL;
+        cmd->plain = s;
+        for (j = 0; j < ps->argc; j++)
+            *s++ = !strpbrk(cmd->words[j], "$\'\"{");
+        cmd->infile = copy_slice(&s, ps->infile);
+        cmd->outfile = copy_slice(&s, ps->outfile);
+        cmd->text = copy_slice(&s, ps->text);
+        cmd->bg = ps->bg;
+        cmd->builtin = (cmd->argc > 0 && cmd->plain[0]) ?
+            builtin_type(cmd->words[0]) : -1;
+    }
+    p->len = code_len;
+    p->num_simples = num_simples;
+    p->refs = 1;
+    p->owned = keep;
+    return p;
+}
+
+/*
+ * compile - Compile src into a prog_t, with one reference, in *prog.
+ *     A program that is kept (keep is set, or it defines a function)
+ *     gets a block of its own, and any other one the line block, which
+ *     the next compile that isn't kept reuses. Returns PARSE_OK,
+ *     PARSE_ERROR, or PARSE_MORE if src ends in the middle of a
+ *     compound command.
+ */
+int compile(char *src, struct prog_t **prog, int keep)
+{
+    struct parser_t ps;
+    int rc, i;
+
+    memset(&ps, 0, sizeof(ps));
+    ps.p = src;
+    code_len = num_simples = num_pwords = 0;
+    if (next_token(&ps) < 0)
+        rc = PARSE_ERROR;
+    else if ((rc = parse_list(&ps, NULL)) == PARSE_OK && ps.tok != T_EOF)
+        rc = syntax_error(&ps);
+    if (rc != PARSE_OK)
+        return rc;
+    emit(OP_HALT, 0, 0);
+
+    for (i = 0; i < code_len && !keep; i++)
+        keep = (code[i].op == OP_DEFUN);
+    *prog = copy_out(keep);
+    return PARSE_OK;
+}
+
+/*
+ * release - Drop a reference to a prog_t, and free it with the last one
+ */
+void release(struct prog_t *prog)
+{
+    if (--prog->refs == 0 && prog->owned)
+        free(prog);
+}
+
+/*
+ * script_init - Make room up front for what compiling and running an
+ *     ordinary command line needs, so that doing so allocates nothing
+ */
+void script_init(void)
+{
+    grow(&pending, &pending_cap, 2 * MAXLINE, 1);
+    grow(&code, &code_cap, 256, sizeof(struct insn_t));
+    grow(&simples, &max_simples, 64, sizeof(struct psimple_t));
+    grow(&pwords, &max_pwords, 256, sizeof(struct slice_t));
+    grow(&line_block, &line_cap, 4 * MAXLINE, 1);
+    grow(&xbuf, &xcap, MAXLINE, 1);
+    grow(&xoff, &xargcap, 256, sizeof(int));
+    grow(&xargv, &xargv_cap, 256, sizeof(char *));
+}
+
+/*
+ * valid_name - True if s[0..len) is a variable name
+ */
+int valid_name(char *s, int len)
+{
+    int i;
+
+    if (len == 0 || !(isalpha((unsigned char)s[0]) || s[0] == '_'))
+        return 0;
+    for (i = 1; i < len; i++)
+        if (!(isalnum((unsigned char)s[i]) || s[i] == '_'))
+            return 0;
+    return 1;
+}
+
+/*
+ * intern - Return the slot of variable name[0..len), creating it
+ *     (unset) if need be
+ */
+int intern(char *name, int len)
+{
+    unsigned int h = 0;
+    int i;
+
+    for (i = 0; i < len; i++)
+        h = h * 31 + (unsigned char)name[i];
+    h &= VARHASH - 1;
+    if (num_vars == 0)
+        memset(var_hash, -1, sizeof(var_hash));
+    for (i = var_hash[h]; i >= 0; i = vars[i].next)
+        if (!strncmp(vars[i].name, name, len) && vars[i].name[len] == '\0')
+            return i;
+
+    grow(&vars, &max_vars, num_vars + 1, sizeof(struct var_t));
+    vars[num_vars].name = strndup(name, len);
+    vars[num_vars].value = NULL;
+    vars[num_vars].cap = 0;
+    vars[num_vars].exported = 0;
+    vars[num_vars].next = var_hash[h];
+    var_hash[h] = num_vars;
+    return num_vars++;
+}
+
+/*
+ * setvar - Set variable slot i to value (NULL unsets it, and stops it
+ *     being exported)
+ */
+void setvar(int i, const char *value)
+{
+    int len;
+
+    if (value == NULL) {
+        free(vars[i].value);
+        vars[i].value = NULL;
+        vars[i].cap = 0;
+        vars[i].exported = 0;
+        return;
+    }
+    if (vars[i].exported)
+        setenv(vars[i].name, value, 1);
+    len = strlen(value);
+    if (len + 1 > vars[i].cap) {
+        vars[i].cap = len + 1 > 16 ? len + 1 : 16;
+        if ((vars[i].value = realloc(vars[i].value, vars[i].cap)) == NULL)
+            unix_error("realloc error");
+    }
+    memcpy(vars[i].value, value, len + 1);
+}
+
+/*
+ * getvar - Return the value of name[0..len): a shell variable, or else
+ *     an environment variable, or NULL
+ */
+char *getvar(char *name, int len)
+{
+    char buf[MAXLINE];
+    int i = intern(name, len);
+
+    if (vars[i].value)
+        return vars[i].value;
+    if (len >= MAXLINE)
+        return NULL;
+    memcpy(buf, name, len);
+    buf[len] = '\0';
+    return getenv(buf);
+}
+
+/*
+ * xput - Append len bytes of s to the expansion buffer
+ */
+static void xput(const char *s, int len)
+{
+    grow(&xbuf, &xcap, xlen + len + 1, 1);
+    memcpy(xbuf + xlen, s, len);
+    xlen += len;
+}
+
+/*
+ * xword - End the word that starts at offset start of the buffer, and
+ *     add it to the expanded words
+ */
+static void xword(int start)
+{
+    if (xargc == MAXWORDS) {
+        if (!xerror)
+            fprintf(stderr, "Error: more than %d words\n", MAXWORDS);
+        xerror = 1;
+        xlen = start;
+        return;
+    }
+    xput("", 1);
+    grow(&xoff, &xargcap, xargc + 2, sizeof(int));
+    xoff[xargc++] = start;
+}
+
+/*
+ * Arithmetic: $(( EXPR )) evaluates EXPR as C would, on longs. It has
+ * numbers (decimal, 0x hex and 0 octal), variables (with or without a
+ * $, and 0 if unset), $-expansions, ( ), unary + - ! ~, the binary
+ * operators * / % + - << >> < <= > >= == != & ^ | && ||, ?: and the
+ * assignments = += -= *= /= %=. It is evaluated as it is parsed.
+ */
+struct arith_t {
+    char *p;                /* next character of the expression */
+    int noeval;             /* in an operand that isn't evaluated */
+    char *err;              /* what went wrong, or NULL */
+};
+
+enum { A_OR, A_AND, A_BOR, A_XOR, A_BAND, A_EQ, A_NE, A_LE, A_GE, A_LT,
+       A_GT, A_SHL, A_SHR, A_ADD, A_SUB, A_MUL, A_DIV, A_MOD };
+
+static struct {
+    char *op;
+    int prec;               /* higher binds tighter */
+    int id;
+} binops[] = {              /* two-character operators first */
+    {"||", 1, A_OR}, {"&&", 2, A_AND}, {"==", 6, A_EQ}, {"!=", 6, A_NE},
+    {"<=", 7, A_LE}, {">=", 7, A_GE}, {"<<", 8, A_SHL}, {">>", 8, A_SHR},
+    {"|", 3, A_BOR}, {"^", 4, A_XOR}, {"&", 5, A_BAND}, {"<", 7, A_LT},
+    {">", 7, A_GT}, {"+", 9, A_ADD}, {"-", 9, A_SUB}, {"*", 10, A_MUL},
+    {"/", 10, A_DIV}, {"%", 10, A_MOD}, {NULL, 0, 0}
+};
+
+static int expand_dollar(char *s);
+static long arith_expr(struct arith_t *ar, int minprec);
+
+static void arith_space(struct arith_t *ar)
+{
+    while (isspace((unsigned char)*ar->p))
+        ar->p++;
+}
+
+static long arith_fail(struct arith_t *ar, char *err)
+{
+    if (ar->err == NULL)
+        ar->err = err;
+    return 0;
+}
+
+/*
+ * arith_number - The value of a variable or expansion: a number, or 0
+ *     if it is empty
+ */
+static long arith_number(struct arith_t *ar, char *s)
+{
+    char *end;
+    long v;
+
+    if (s == NULL)
+        return 0;
+    v = strtol(s, &end, 0);
+    while (isspace((unsigned char)*end))
+        end++;
+    if (*end != '\0')
+        return arith_fail(ar, "not a number");
+    return v;
+}
+
+/*
+ * arith_binary - Apply binary operator id
+ */
+static long arith_binary(struct arith_t *ar, int id, long x, long y)
+{
+    switch (id) {
+        case A_OR:   return x || y;
+        case A_AND:  return x && y;
+        case A_BOR:  return x | y;
+        case A_XOR:  return x ^ y;
+        case A_BAND: return x & y;
+        case A_EQ:   return x == y;
+        case A_NE:   return x != y;
+        case A_LE:   return x <= y;
+        case A_GE:   return x >= y;
+        case A_LT:   return x < y;
+        case A_GT:   return x > y;
+        case A_SHL:  return (unsigned long)x << (y & 63);
+        case A_SHR:  return x >> (y & 63);
+        case A_ADD:  return (unsigned long)x + y;
+        case A_SUB:  return (unsigned long)x - y;
+        case A_MUL:  return (unsigned long)x * y;
+    }
+    if (y == 0)                         /* A_DIV, A_MOD */
+        return ar->noeval ? 0 : arith_fail(ar, "division by zero");
+    if (y == -1)                        /* LONG_MIN / -1 traps */
+        return id == A_DIV ? -(unsigned long)x : 0;
+    return id == A_DIV ? x / y : x % y;
+}
+
+/*
+ * arith_unary - Evaluate a unary expression: an operand, with any
+ *     prefix operators, or an assignment
+ */
+static long arith_unary(struct arith_t *ar)
+{
+    char *name, *end, num[32];
+    int len, mark, id;
+    long x, y;
+
+    arith_space(ar);
+    switch (*ar->p) {
+        case '+':
+            ar->p++;
+            return arith_unary(ar);
+        case '-':
+            ar->p++;
+            return -(unsigned long)arith_unary(ar);
+        case '!':
+            ar->p++;
+            return !arith_unary(ar);
+        case '~':
+            ar->p++;
+            return ~arith_unary(ar);
+        case '(':
+            ar->p++;
+            x = arith_expr(ar, 0);
+            arith_space(ar);
+            if (*ar->p != ')')
+                return arith_fail(ar, "missing )");
+            ar->p++;
+            return x;
+        case '$':                       /* $NAME, $1, $((...)) and so on */
+            mark = xlen;
+            ar->p += expand_dollar(ar->p);
+            xput("", 1);
+            x = arith_number(ar, xbuf + mark);
+            xlen = mark;
+            return x;
+    }
+    if (isdigit((unsigned char)*ar->p)) {
+        x = strtol(ar->p, &end, 0);
+        if (isalnum((unsigned char)*end) || *end == '_')
+            return arith_fail(ar, "bad number");
+        ar->p = end;
+        return x;
+    }
+    if (!isalpha((unsigned char)*ar->p) && *ar->p != '_')
+        return arith_fail(ar, "syntax error");
+
+    /* A variable, perhaps being assigned to */
+    name = ar->p;
+    for (len = 1; isalnum((unsigned char)name[len]) || name[len] == '_'; len++)
+        ;
+    ar->p += len;
+    arith_space(ar);
+    if (ar->p[0] == '=' && ar->p[1] != '=')
+        id = -1, ar->p += 1;
+    else if (ar->p[0] && strchr("+-*/%", ar->p[0]) && ar->p[1] == '=') {
+        id = strchr("+-*/%", ar->p[0]) - "+-*/%" + A_ADD;
+        ar->p += 2;
+    }
+    else
+        return arith_number(ar, getvar(name, len));
+
+    y = arith_expr(ar, 0);
+    if (id >= 0)
+        y = arith_binary(ar, id, arith_number(ar, getvar(name, len)), y);
+    if (!ar->noeval && !ar->err) {
+        sprintf(num, "%ld", y);
+        setvar(intern(name, len), num);
+    }
+    return y;
+}
+
+/*
+ * arith_expr - Evaluate binary operators of precedence minprec and up
+ *     (by precedence climbing), and at minprec 0, ?: as well
+ */
+static long arith_expr(struct arith_t *ar, int minprec)
+{
+    long x = arith_unary(ar), y, z;
+    int i, skip;
+
+    while (ar->err == NULL) {
+        arith_space(ar);
+        if (*ar->p == '?' && minprec == 0) {
+            ar->p++;
+            ar->noeval += !x;
+            y = arith_expr(ar, 0);
+            ar->noeval -= !x;
+            arith_space(ar);
+            if (*ar->p != ':')
+                return arith_fail(ar, "missing :");
+            ar->p++;
+            ar->noeval += !!x;
+            z = arith_expr(ar, 0);
+            ar->noeval -= !!x;
+            return x ? y : z;
+        }
+        for (i = 0; binops[i].op; i++)
+            if (!strncmp(ar->p, binops[i].op, strlen(binops[i].op)))
+                break;
+        if (binops[i].op == NULL || binops[i].prec < minprec)
+            return x;
+        ar->p += strlen(binops[i].op);
+
+        /* && and || don't evaluate what they don't need */
+        skip = (binops[i].id == A_AND && !x) || (binops[i].id == A_OR && x);
+        ar->noeval += skip;
+        y = arith_expr(ar, binops[i].prec + 1);
+        ar->noeval -= skip;
+        x = arith_binary(ar, binops[i].id, x, y);
+    }
+    return 0;
+}
+
+/*
+ * arith_end - Return the end of the $((...)) at s, just past its "))",
+ *     or NULL if it isn't closed
+ */
+static char *arith_end(char *s)
+{
+    int depth = 0;
+
+    for (s++; *s; s++)
+        if (*s == '(')
+            depth++;
+        else if (*s == ')' && --depth == 0)
+            return s + 1;
+    return NULL;
+}
+
+/*
+ * expand_arith - Expand the $((...)) at s into the buffer, and return
+ *     the number of characters of s that it used
+ */
+static int expand_arith(char *s)
+{
+    struct arith_t ar;
+    char num[32], *end = arith_end(s);
+    long v;
+
+    if (end == NULL) {
+        fprintf(stderr, "Error: unmatched $((.\n");
+        xerror = 1;
+        return strlen(s);
+    }
+    ar.p = s + 3;
+    ar.noeval = 0;
+    ar.err = NULL;
+    v = arith_expr(&ar, 0);
+    arith_space(&ar);
+    if (ar.err == NULL && ar.p != end - 2)
+        ar.err = "syntax error";
+    if (ar.err != NULL) {
+        fprintf(stderr, "Error: %.*s: %s\n", (int)(end - s), s, ar.err);
+        xerror = 1;
+    }
+    else
+        xput(num, sprintf(num, "%ld", v));
+    return end - s;
+}
+
+/*
+ * expand_dollar - Expand the $ expression at s into the buffer, and
+ *     return the number of characters of s that it used
+ */
+static int expand_dollar(char *s)
+{
+    char num[32], *v, *end;
+    int i, n;
+
+    if (s[1] == '(' && s[2] == '(')
+        return expand_arith(s);
+    if (s[1] == '{' && (end = strchr(s + 2, '}')) != NULL) {
+        if ((v = getvar(s + 2, end - s - 2)) != NULL)
+            xput(v, strlen(v));
+        return end - s + 1;
+    }
+    if (isalpha((unsigned char)s[1]) || s[1] == '_') {
+        for (n = 2; isalnum((unsigned char)s[n]) || s[n] == '_'; n++)
+            ;
+        if ((v = getvar(s + 1, n - 1)) != NULL)
+            xput(v, strlen(v));
+        return n;
+    }
+    switch (s[1]) {
+    case '?':
+        xput(num, sprintf(num, "%d", last_status));
+        return 2;
+    case '#':
+        xput(num, sprintf(num, "%d", num_params));
+        return 2;
+    case '$':
+        xput(num, sprintf(num, "%d", (int)getpid()));
+        return 2;
+    case '@':
+        for (i = 0; i < num_params; i++) {
+            if (i > 0)
+                xput(" ", 1);
+            xput(params[i], strlen(params[i]));
+        }
+        return 2;
+    }
+    if (isdigit((unsigned char)s[1])) {
+        n = s[1] - '0';
+        if (n == 0)
+            xput("tsh", 3);
+        else if (n <= num_params)
+            xput(params[n - 1], strlen(params[n - 1]));
+        return 2;
+    }
+    xput("$", 1);
+    return 1;
+}
+
+/*
+ * expand_word - Expand one word into zero or more words. Quotes come
+ *     off, and what unquoted expansions give is split on white space
+ *     (unless nosplit, as in an assignment). "$@" gives one word per
+ *     parameter.
+ */
+static void expand_word(char *w, int nosplit)
+{
+    int start = xlen, have = 0, quoted = 0, mark, r, end, i;
+    char *s = w, *q;
+
+    if (!strcmp(w, "\"$@\"")) {
+        for (i = 0; i < num_params; i++) {
+            start = xlen;
+            xput(params[i], strlen(params[i]));
+            xword(start);
+        }
+        return;
+    }
+    while (*s) {
+        if (*s == '\'' && !quoted) {
+            q = strchr(s + 1, '\'');
+            xput(s + 1, q - s - 1);
+            have = 1;
+            s = q + 1;
+        }
+        else if (*s == '\"') {
+            quoted = !quoted;
+            have = 1;
+            s++;
+        }
+        else if (*s == '$' && (quoted || nosplit))
+            s += expand_dollar(s);
+        else if (*s == '$') {
+            /* Split the value, in place, where it has white space */
+            mark = xlen;
+            s += expand_dollar(s);
+            end = xlen;
+            xlen = mark;
+            for (r = mark; r < end; r++) {
+                if (!isspace((unsigned char)xbuf[r]))
+                    xbuf[xlen++] = xbuf[r];
+                else if (xlen > start || have) {
+                    xword(start);
+                    start = xlen;
+                    have = 0;
+                }
+            }
+        }
+        else {
+            i = 1 + strcspn(s + 1, "$\'\"");
+            xput(s, i);
+            s += i;
+        }
+    }
+    if (xlen > start || have)
+        xword(start);
+}
+
+/*
+ * skip_quoted - Return the end of the quoted string, ${...} or $((...))
+ *     that starts at s, or s itself if none does
+ */
+static char *skip_quoted(char *s)
+{
+    char *q = NULL;
+
+    if (*s == '\'' || *s == '\"')
+        q = strchr(s + 1, *s);
+    else if (s[0] == '$' && s[1] == '{')
+        q = strchr(s + 2, '}');
+    else if (s[0] == '$' && s[1] == '(' && s[2] == '(' &&
+             (q = arith_end(s)) != NULL)
+        q--;
+    return q ? q : s;
+}
+
+/*
+ * seq_end - Return the end of the sequence (from..to or from..to..step)
+ *     at s, or NULL if it isn't one
+ */
+static char *seq_number(char *s)
+{
+    char *end;
+
+    if (!isdigit((unsigned char)s[*s == '-']))
+        return NULL;
+    strtol(s, &end, 10);
+    return end;
+}
+
+static char *seq_end(char *s)
+{
+    if (isalpha((unsigned char)s[0]) && s[1] == '.' && s[2] == '.' &&
+        isalpha((unsigned char)s[3]))
+        s += 4;
+    else if ((s = seq_number(s)) == NULL || strncmp(s, "..", 2) ||
+             (s = seq_number(s + 2)) == NULL)
+        return NULL;
+    if (!strncmp(s, "..", 2))
+        s = seq_number(s + 2);
+    return s;
+}
+
+/*
+ * find_braces - Find the first brace group in w that brace expansion
+ *     applies to: unquoted, with a comma at its top level or else a
+ *     sequence in it. Sets *open and *close to its braces, and *seq if
+ *     it is a sequence. Returns 0 if there is none.
+ */
+static int find_braces(char *w, char **open, char **close, int *seq)
+{
+    char *s, *t;
+    int depth, comma;
+
+    for (s = w; *s; s = skip_quoted(s) + 1) {
+        if (*s != '{')
+            continue;
+        depth = comma = 0;
+        for (t = s; *t; t = skip_quoted(t) + 1) {
+            if (*t == '{')
+                depth++;
+            else if (*t == '}' && --depth == 0)
+                break;
+            else if (*t == ',' && depth == 1)
+                comma = 1;
+        }
+        if (*t == '\0')
+            continue;
+        *open = s;
+        *close = t;
+        *seq = !comma;
+        if (comma || seq_end(s + 1) == t)
+            return 1;
+    }
+    return 0;
+}
+
+static void expand_braces(char *w);
+
+/*
+ * brace_alt - Expand the word made of w up to open, alt[0..len), and
+ *     what follows close
+ */
+static void brace_alt(char *w, char *open, char *alt, int len, char *close)
+{
+    char buf[MAXLINE];
+    int pre = open - w, post = strlen(close + 1);
+
+    if (pre + len + post >= MAXLINE) {
+        fprintf(stderr, "Error: brace expansion too long\n");
+        xerror = 1;
+        return;
+    }
+    memcpy(buf, w, pre);
+    memcpy(buf + pre, alt, len);
+    memcpy(buf + pre + len, close + 1, post + 1);
+    expand_braces(buf);
+}
+
+/*
+ * expand_braces - Brace-expand w, and expand each word that gives
+ */
+static void expand_braces(char *w)
+{
+    char *open, *close, *s, *alt, num[32];
+    long from, to, step = 1, v;
+    int seq, depth, letters;
+
+    if (!find_braces(w, &open, &close, &seq)) {
+        expand_word(w, 0);
+        return;
+    }
+
+    if (!seq) {                         /* {a,b,c} */
+        depth = 0;
+        for (alt = s = open + 1; s <= close && !xerror; s = skip_quoted(s) + 1) {
+            if (*s == '{')
+                depth++;
+            else if (*s == '}' && depth > 0)
+                depth--;
+            else if ((*s == ',' && depth == 0) || s == close) {
+                brace_alt(w, open, alt, s - alt, close);
+                alt = s + 1;
+            }
+        }
+        return;
+    }
+
+    /* {from..to} or {from..to..step}, of numbers or letters */
+    letters = isalpha((unsigned char)open[1]);
+    if (letters) {
+        from = open[1];
+        to = open[4];
+        sscanf(open + 5, "..%ld", &step);
+    }
+    else
+        sscanf(open + 1, "%ld..%ld..%ld", &from, &to, &step);
+    if (step < 0)
+        step = -step;
+    if (step == 0)
+        step = 1;
+    if (from > to)
+        step = -step;
+    for (v = from; (step > 0 ? v <= to : v >= to) && !xerror; v += step) {
+        if (letters)
+            num[0] = v, num[1] = '\0';
+        else
+            sprintf(num, "%ld", v);
+        brace_alt(w, open, num, strlen(num), close);
+        if ((step > 0 && v > LONG_MAX - step) ||
+            (step < 0 && v < LONG_MIN - step))
+            break;
+    }
+}
+
+/*
+ * expand - Expand the first n words of a command into xargv, with
+ *     xargc words. Words that need no expansion aren't copied. The
+ *     results stay valid until the next expand.
+ */
+void expand(char **words, char *plain, int n)
+{
+    int i;
+
+    xlen = xargc = xerror = 0;
+    for (i = 0; i < n; i++) {
+        if (plain[i]) {                 /* no copy: mark it with -1-i */
+            grow(&xoff, &xargcap, xargc + 2, sizeof(int));
+            xoff[xargc++] = -1 - i;
+        }
+        else
+            expand_braces(words[i]);
+    }
+
+    grow(&xargv, &xargv_cap, xargc + 1, sizeof(char *));
+    for (i = 0; i < xargc; i++)
+        xargv[i] = xoff[i] < 0 ? words[-1 - xoff[i]] : xbuf + xoff[i];
+    xargv[xargc] = NULL;
+}
+
+/*
+ * expand1 - Expand a word into buf, as a single word, as for a
+ *     redirection or an assignment
+ */
+static char *expand1(char *w, char *buf, int size)
+{
+    xlen = xargc = xerror = 0;
+    expand_word(w, 1);
+    snprintf(buf, size, "%s", xargc > 0 ? xbuf + xoff[0] : "");
+    return buf;
+}
+
+/*
+ * copy_words - Copy n words into one block: the pointers, then the
+ *     strings. One free frees it all.
+ */
+static char **copy_words(int n, char **words)
+{
+    int i, size = (n + 1) * sizeof(char *);
+    char **block, *p;
+
+    for (i = 0; i < n; i++)
+        size += strlen(words[i]) + 1;
+    if ((block = malloc(size)) == NULL)
+        unix_error("malloc error");
+    p = (char *)(block + n + 1);
+    for (i = 0; i < n; i++) {
+        block[i] = p;
+        p = stpcpy(p, words[i]) + 1;
+    }
+    block[n] = NULL;
+    return block;
+}
+
+/*
+ * is_assignment - True if the word is NAME=VALUE
+ */
+static int is_assignment(char *w)
+{
+    char *eq = strchr(w, '=');
+
+    return eq != NULL && valid_name(w, eq - w);
+}
+
+/*
+ * findfunc - Return the index of function name, or -1
+ */
+static int findfunc(char *name)
+{
+    int i;
+
+    for (i = 0; i < num_funcs; i++)
+        if (!strcmp(funcs[i].name, name))
+            return i;
+    return -1;
+}
+
+/*
+ * redirect - Point the shell's own stdin and stdout at infile and
+ *     outfile (either may be NULL) for a command that runs in the
+ *     shell, saving the old ones in *infd and *outfd (-1 if unchanged).
+ *     Returns 0 if OK, or -1, with nothing changed, if a file can't be
+ *     opened.
+ */
+static int redirect(char *infile, char *outfile, int *infd, int *outfd)
+{
+    int fd0 = -1, fd1 = -1;
+
+    *infd = *outfd = -1;
+    if (infile && (fd0 = open(infile, O_RDONLY)) < 0) {
+        fprintf(stderr, "Error: %s: %s\n", infile, strerror(errno));
+        return -1;
+    }
+    if (outfile && (fd1 = open(outfile, O_CREAT | O_WRONLY, 0644)) < 0) {
+        fprintf(stderr, "Error: %s: %s\n", outfile, strerror(errno));
+        if (fd0 >= 0)
+            close(fd0);
+        return -1;
+    }
+    fflush(stdout);
+    if (fd0 >= 0) {
+        *infd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+        dup2(fd0, STDIN_FILENO);
+        close(fd0);
+    }
+    if (fd1 >= 0) {
+        *outfd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+        dup2(fd1, STDOUT_FILENO);
+        close(fd1);
+    }
+    return 0;
+}
+
+/*
+ * unredirect - Put back the stdin and stdout that redirect saved
+ */
+static void unredirect(int infd, int outfd)
+{
+    fflush(stdout);
+    if (infd >= 0) {
+        dup2(infd, STDIN_FILENO);
+        close(infd);
+    }
+    if (outfd >= 0) {
+        dup2(outfd, STDOUT_FILENO);
+        close(outfd);
+    }
+}
+
+/*
+ * call - Call function f with the words in xargv, and its stdin and
+ *     stdout redirected to infile and outfile (if not NULL) until it
+ *     returns. Switches *prog to the function's code, and returns
+ *     where the function starts.
+ */
+static int call(int f, struct prog_t **prog, int pc, char *infile,
+                char *outfile)
+{
+    struct frame_t *fr;
+    int infd, outfd;
+
+    if (num_frames == MAXCALLS) {
+        fprintf(stderr, "Error: %s: too many nested calls\n", xargv[0]);
+        last_status = 1;
+        interrupted = 1;
+        return pc;
+    }
+    if (redirect(infile, outfile, &infd, &outfd) < 0) {
+        last_status = 1;
+        return pc;
+    }
+    fr = &frames[num_frames++];
+    fr->infd = infd;
+    fr->outfd = outfd;
+    fr->prog = *prog;
+    fr->ret = pc;
+    fr->loops = num_loops;
+    fr->params = params;
+    fr->num_params = num_params;
+    params = copy_words(xargc - 1, xargv + 1);
+    num_params = xargc - 1;
+    *prog = funcs[f].prog;
+    (*prog)->refs++;            /* in case the function is redefined */
+    return funcs[f].entry;
+}
+
+/*
+ * pop_loop, pop_frame - Leave the innermost loop, or function call
+ */
+static void pop_loop(void)
+{
+    free(loops[--num_loops].items);
+}
+
+static int pop_frame(struct prog_t **prog)
+{
+    struct frame_t *fr = &frames[--num_frames];
+
+    while (num_loops > fr->loops)
+        pop_loop();
+    free(params);
+    params = fr->params;
+    num_params = fr->num_params;
+    unredirect(fr->infd, fr->outfd);
+    release(*prog);
+    *prog = fr->prog;
+    return fr->ret;
+}
+
+/*
+ * exec_simple - Run a simple command, and return the address of the
+ *     next instruction (in a function's code, if it calls one)
+ */
+static int exec_simple(struct simple_t *cmd, struct prog_t **prog, int pc)
+{
+    struct cmdline_tokens tok;
+    char infile[MAXLINE], outfile[MAXLINE], value[MAXLINE];
+    char *eq;
+    int i, f, b, failed, infd, outfd;
+
+    /* NAME=VALUE... sets shell variables */
+    for (i = 0; i < cmd->argc && is_assignment(cmd->words[i]); i++)
+        ;
+    if (i > 0 && i == cmd->argc) {
+        last_status = 0;
+        for (i = 0; i < cmd->argc; i++) {
+            eq = strchr(cmd->words[i], '=');
+            expand1(eq + 1, value, MAXLINE);
+            if (xerror)
+                last_status = 1;
+            else
+                setvar(intern(cmd->words[i], eq - cmd->words[i]), value);
+        }
+        return pc;
+    }
+
+    tok.infile = tok.outfile = NULL;
+    failed = 0;
+    if (cmd->infile) {
+        tok.infile = expand1(cmd->infile, infile, MAXLINE);
+        failed = xerror;
+    }
+    if (cmd->outfile) {
+        tok.outfile = expand1(cmd->outfile, outfile, MAXLINE);
+        failed |= xerror;
+    }
+    expand(cmd->words, cmd->plain, cmd->argc);
+    if (failed || xerror) {             /* already reported */
+        last_status = 1;
+        return pc;
+    }
+    if (xargc == 0) {
+        last_status = 0;
+        return pc;
+    }
+
+    /* Functions come before builtins */
+    if (num_funcs > 0 && (f = findfunc(xargv[0])) >= 0)
+        return call(f, prog, pc, tok.infile, tok.outfile);
+
+    /* 
+     * Builtins that only compute, or run a script, need no signal
+     * juggling, and mustn't have any: source runs jobs of its own,
+     * which need SIGCHLD to be delivered
+     */
+    b = cmd->builtin >= 0 ? cmd->builtin : builtin_type(xargv[0]);
+    if (b >= BUILTIN_ECHO) {
+        if (redirect(tok.infile, tok.outfile, &infd, &outfd) < 0) {
+            last_status = 1;
+            return pc;
+        }
+        last_status = run_builtin(b, xargc, xargv);
+        unredirect(infd, outfd);
+        return pc;
+    }
+
+    /* Everything else runs the way eval has always run commands */
+    if (xargc >= MAXARGS) {
+        fprintf(stderr, "Error: %s: too many arguments\n", xargv[0]);
+        last_status = 1;
+        return pc;
+    }
+    tok.argc = xargc;
+    memcpy(tok.argv, xargv, (xargc + 1) * sizeof(char *));
+    tok.builtins = b;
+    fflush(stdout);
+    run_command(&tok, cmd->bg, cmd->text);
+    return pc;
+}
+
+/*
+ * vm_run - Run the code of prog from pc until it halts, or returns at
+ *     the top. A ctrl-c with no foreground job stops it after the
+ *     command, or at the jump back, that it comes in.
+ */
+void vm_run(struct prog_t *prog, int pc)
+{
+    struct prog_t *p = prog;
+    struct insn_t *ip;
+    struct simple_t *cmd;
+    struct loop_t *l;
+    int i, base_frames = num_frames, base_loops = num_loops;
+    char value[MAXLINE];
+
+    p->refs++;
+    while (1) {
+        ip = &p->code[pc++];
+        switch (ip->op) {
+            case OP_CMD:
+                pc = exec_simple(&p->simples[ip->a], &p, pc);
+                if (interrupted)
+                    goto stop;
+                break;
+            case OP_JMP:
+                if (interrupted && ip->a < pc)
+                    goto stop;
+                pc = ip->a;
+                break;
+            case OP_JFALSE:
+                if (last_status != 0)
+                    pc = ip->a;
+                break;
+            case OP_JTRUE:
+                if (last_status == 0)
+                    pc = ip->a;
+                break;
+            case OP_STATUS:
+                last_status = ip->a;
+                break;
+            case OP_FORINIT:
+                cmd = &p->simples[ip->a];
+                expand(cmd->words, cmd->plain, cmd->argc);
+                if (xerror) {
+                    xargc = 0;          /* skip the loop */
+                    last_status = 1;
+                }
+                grow(&loops, &max_loops, num_loops + 1, sizeof(struct loop_t));
+                l = &loops[num_loops++];
+                l->items = copy_words(xargc, xargv);
+                l->n = xargc;
+                l->i = 0;
+                break;
+            case OP_FORNEXT:
+                l = &loops[num_loops - 1];
+                if (interrupted)
+                    goto stop;
+                if (l->i == l->n)
+                    pc = ip->b;
+                else
+                    setvar(ip->a, l->items[l->i++]);
+                break;
+            case OP_FORPOP:
+                pop_loop();
+                break;
+            case OP_DEFUN:
+                cmd = &p->simples[ip->a];
+                if ((i = findfunc(cmd->text)) < 0) {
+                    grow(&funcs, &max_funcs, num_funcs + 1,
+                         sizeof(struct func_t));
+                    i = num_funcs++;
+                    funcs[i].name = strdup(cmd->text);
+                }
+                else
+                    release(funcs[i].prog);
+                funcs[i].prog = p;
+                p->refs++;
+                funcs[i].entry = pc;
+                pc = ip->b;
+                last_status = 0;
+                break;
+            case OP_RET:
+                if (ip->a >= 0)
+                    last_status = atoi(expand1(p->simples[ip->a].words[0],
+                                               value, MAXLINE));
+                if (num_frames == base_frames)
+                    goto stop;
+                pc = pop_frame(&p);
+                break;
+            case OP_HALT:
+                goto stop;
+        }
+    }
+
+stop:
+    while (num_frames > base_frames)
+        pop_frame(&p);
+    while (num_loops > base_loops)
+        pop_loop();
+    release(p);
+    if (interrupted)
+        last_status = 128 + SIGINT;
+}
+
+/*
+ * load_script - Return the compiled code of the file at path, with a
+ *     reference for the caller. The file is only read and compiled if
+ *     the cache has no copy of its current version. Returns NULL, with
+ *     the error reported, if it can't be read or doesn't compile.
+ */
+static struct prog_t *load_script(char *path)
+{
+    struct stat sb;
+    struct script_t *sc;
+    struct prog_t *prog;
+    char *src, *p;
+    int fd, i, n, rc, len;
+
+    if (stat(path, &sb) < 0) {
+        fprintf(stderr, "source: %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    for (i = 0; i < num_scripts; i++) {
+        sc = &scripts[i];
+        if (sc->dev != sb.st_dev || sc->ino != sb.st_ino)
+            continue;
+        if (sc->size == sb.st_size &&
+            sc->mtime.tv_sec == sb.st_mtim.tv_sec &&
+            sc->mtime.tv_nsec == sb.st_mtim.tv_nsec) {
+            sc->used = ++script_clock;      /* unchanged: no I/O at all */
+            sc->prog->refs++;
+            return sc->prog;
+        }
+        release(sc->prog);                  /* stale: drop it */
+        *sc = scripts[--num_scripts];
+        break;
+    }
+
+    /* Read the file, keyed by what fstat says about what we read */
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &sb) < 0) {
+        fprintf(stderr, "source: %s: %s\n", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+    if (!S_ISREG(sb.st_mode)) {
+        fprintf(stderr, "source: %s: not a regular file\n", path);
+        close(fd);
+        return NULL;
+    }
+    if ((src = malloc(sb.st_size + 1)) == NULL)
+        unix_error("malloc error");
+    for (len = 0; len < sb.st_size; len += n)
+        if ((n = read(fd, src + len, sb.st_size - len)) <= 0)
+            break;
+    close(fd);
+    src[len] = '\0';
+
+    /* Lines can't be longer than main would read, as jobs keep them */
+    for (p = src, i = 1; ; p += n + 1, i++) {
+        if ((n = strcspn(p, "\n")) >= MAXLINE - 1) {
+            fprintf(stderr, "source: %s: line %d is too long\n", path, i);
+            free(src);
+            return NULL;
+        }
+        if (p[n] == '\0')
+            break;
+    }
+    rc = compile(src, &prog, 1);
+    free(src);
+    if (rc == PARSE_MORE)
+        fprintf(stderr, "source: %s: unexpected end of file\n", path);
+    if (rc != PARSE_OK)
+        return NULL;
+
+    /* Cache it, in place of the least recently used script if need be */
+    if (num_scripts < MAXSCRIPTS)
+        sc = &scripts[num_scripts++];
+    else {
+        sc = &scripts[0];
+        for (i = 1; i < MAXSCRIPTS; i++)
+            if (scripts[i].used < sc->used)
+                sc = &scripts[i];
+        release(sc->prog);
+    }
+    sc->dev = sb.st_dev;
+    sc->ino = sb.st_ino;
+    sc->mtime = sb.st_mtim;
+    sc->size = sb.st_size;
+    sc->prog = prog;
+    sc->used = ++script_clock;
+    prog->refs++;
+    return prog;
+}
+
+/*
+ * source - The source (.) builtin: run a file in this shell, with any
+ *     more arguments as its positional parameters
+ */
+int source(int argc, char **argv)
+{
+    static int depth = 0;
+    struct prog_t *prog;
+    char **saved_params = params;
+    int saved_num = num_params;
+
+    if (argc < 2) {
+        fprintf(stderr, "%s: filename argument required\n", argv[0]);
+        return 2;
+    }
+    if (depth == MAXSOURCE) {
+        fprintf(stderr, "%s: %s: too deeply nested\n", argv[0], argv[1]);
+        return 1;
+    }
+    if ((prog = load_script(argv[1])) == NULL)
+        return 1;
+
+    if (argc > 2) {
+        params = copy_words(argc - 2, argv + 2);
+        num_params = argc - 2;
+    }
+    depth++;
+    last_status = 0;
+    vm_run(prog, 0);
+    depth--;
+    release(prog);
+    if (argc > 2) {
+        free(params);
+        params = saved_params;
+        num_params = saved_num;
+    }
+    return last_status;
+}
+
+/*
+ * builtin_type - Return the builtins_t of a command name
+ */
+int builtin_type(char *name)
+{
+    static struct {
+        char *name;
+        int type;
+    } names[] = {
+        {"quit", BUILTIN_QUIT}, {"jobs", BUILTIN_JOBS}, {"bg", BUILTIN_BG},
+        {"fg", BUILTIN_FG}, {"echo", BUILTIN_ECHO}, {"true", BUILTIN_TRUE},
+        {":", BUILTIN_TRUE}, {"false", BUILTIN_FALSE}, {"test", BUILTIN_TEST},
+        {"[", BUILTIN_TEST}, {"unset", BUILTIN_UNSET},
+        {"export", BUILTIN_EXPORT}, {"source", BUILTIN_SOURCE},
+        {".", BUILTIN_SOURCE}, {NULL, BUILTIN_NONE}
+    };
+    int i;
+
+    for (i = 0; names[i].name; i++)
+        if (!strcmp(name, names[i].name))
+            return names[i].type;
+    return BUILTIN_NONE;
+}
+
+/*
+ * run_builtin - Run one of the builtins that only compute (echo and
+ *     on), and return its exit status
+ */
+int run_builtin(int type, int argc, char **argv)
+{
+    int i, j, newline = 1, len;
+    char *eq;
+
+    switch (type) {
+        case BUILTIN_ECHO:
+            i = 1;
+            if (argc > 1 && !strcmp(argv[1], "-n")) {
+                newline = 0;
+                i++;
+            }
+            for (; i < argc; i++) {
+                fputs(argv[i], stdout);
+                if (i < argc - 1)
+                    putchar(' ');
+            }
+            if (newline)
+                putchar('\n');
+            return 0;
+        case BUILTIN_TRUE:
+            return 0;
+        case BUILTIN_FALSE:
+            return 1;
+        case BUILTIN_TEST:
+            if (!strcmp(argv[0], "[")) {
+                if (strcmp(argv[argc - 1], "]")) {
+                    fprintf(stderr, "[: missing ]\n");
+                    return 2;
+                }
+                argc--;
+            }
+            return eval_test(argc - 1, argv + 1);
+        case BUILTIN_UNSET:
+            for (i = 1; i < argc; i++) {
+                setvar(intern(argv[i], strlen(argv[i])), NULL);
+                unsetenv(argv[i]);
+            }
+            return 0;
+        case BUILTIN_EXPORT:
+            for (i = 1; i < argc; i++) {
+                eq = strchr(argv[i], '=');
+                len = eq ? eq - argv[i] : (int)strlen(argv[i]);
+                if (!valid_name(argv[i], len)) {
+                    fprintf(stderr, "export: %s: bad name\n", argv[i]);
+                    return 1;
+                }
+                j = intern(argv[i], len);
+                vars[j].exported = 1;
+                if (eq)
+                    setvar(j, eq + 1);
+                else if (vars[j].value != NULL)
+                    setenv(vars[j].name, vars[j].value, 1);
+            }
+            return 0;
+        case BUILTIN_SOURCE:
+            return source(argc, argv);
+    }
+    return 1;
+}
+
+/*
+ * eval_test - Evaluate the expression of test (or [), and return 0 if
+ *     it is true, 1 if false, and 2 if it is malformed
+ */
+int eval_test(int argc, char **argv)
+{
+    struct stat sb;
+    char *op;
+    long a, b;
+    int r;
+
+    if (argc > 0 && !strcmp(argv[0], "!")) {
+        r = eval_test(argc - 1, argv + 1);
+        return r == 2 ? 2 : !r;
+    }
+    switch (argc) {
+        case 0:
+            return 1;
+        case 1:
+            return argv[0][0] == '\0';
+        case 2:
+            op = argv[0];
+            if (!strcmp(op, "-n"))
+                return argv[1][0] == '\0';
+            if (!strcmp(op, "-z"))
+                return argv[1][0] != '\0';
+            if (strlen(op) == 2 && op[0] == '-' && strchr("efdrwx", op[1])) {
+                if (stat(argv[1], &sb) < 0)
+                    return 1;
+                switch (op[1]) {
+                    case 'f': return !S_ISREG(sb.st_mode);
+                    case 'd': return !S_ISDIR(sb.st_mode);
+                    case 'r': return access(argv[1], R_OK) != 0;
+                    case 'w': return access(argv[1], W_OK) != 0;
+                    case 'x': return access(argv[1], X_OK) != 0;
+                }
+                return 0;
+            }
+            break;
+        case 3:
+            op = argv[1];
+            if (!strcmp(op, "="))
+                return strcmp(argv[0], argv[2]) != 0;
+            if (!strcmp(op, "!="))
+                return strcmp(argv[0], argv[2]) == 0;
+            a = strtol(argv[0], NULL, 10);
+            b = strtol(argv[2], NULL, 10);
+            if (!strcmp(op, "-eq")) return !(a == b);
+            if (!strcmp(op, "-ne")) return !(a != b);
+            if (!strcmp(op, "-lt")) return !(a < b);
+            if (!strcmp(op, "-le")) return !(a <= b);
+            if (!strcmp(op, "-gt")) return !(a > b);
+            if (!strcmp(op, "-ge")) return !(a >= b);
+            break;
+    }
+    fprintf(stderr, "test: bad expression\n");
+    return 2;
+}
+
+
+/*****************
+ * Signal handlers
+ *****************/
+
+/* 
+ * sigchld_handler - The kernel sends a SIGCHLD to the shell whenever
+ *     a child job terminates (becomes a zombie), or stops because it
+ *     received a SIGSTOP, SIGTSTP, SIGTTIN or SIGTTOU signal. The 
+ *     handler reaps all available zombie children, but doesn't wait 
+ *     for any other currently running children to terminate.  
+ */
+    void 
+sigchld_handler(int sig) 
+{
+    int olderrno = errno;
+    int status;
+    sigset_t mask, prev;
+    pid_t pid; 
+
+    Sigemptyset(&mask);
+    Sigaddset(&mask, SIGCHLD);
+    Sigaddset(&mask, SIGINT);
+    Sigaddset(&mask, SIGTSTP);
+
+    if(verbose) 
+        printf("sigchld_handler: entering\n");
+
+    while ((pid = waitpid(-1, &status, WNOHANG|WUNTRACED|WCONTINUED)) > 0) {
+        Sigprocmask(SIG_BLOCK, &mask, &prev);
+        /* Handling children exit status */
+        if(verbose)
+            printf("sigchld_handler: Job [%d] (%d) in handler \n",
+                    pid2jid(pid), pid);
+        /* Remember how the foreground job ended, for $? */
+        if (fgpid(job_list) == pid) {
+            if (WIFEXITED(status))
+                fg_status = WEXITSTATUS(status);
+            else if (WIFSIGNALED(status)) {
+                fg_status = 128 + WTERMSIG(status);
+                /* ctrl-c stops the script as well as the job */
+                if (WTERMSIG(status) == SIGINT)
+                    interrupted = 1;
+            }
+            else if (WIFSTOPPED(status))
+                fg_status = 128 + WSTOPSIG(status);
+        }
+        if (WIFEXITED(status))  {
+            if (verbose) {
+                printf("sigchld_handler: ");
+                // fflush(stdout);
+                printf("Job [%d] (%d) terminates OK (status %d)\n",
+                        pid2jid(pid), pid, WSTOPSIG(status));
+            }
+            deletejob(job_list, pid);   /* Child terminated, remove job */
+        }
+        if (WIFSIGNALED(status))  {
+            printf("Job [%d] (%d) terminated by signal %d\n", pid2jid(pid),
+                    pid, WTERMSIG(status));
+            deletejob(job_list, pid);   /* Child terminated, remove job*/
+        }
+        if (WIFSTOPPED(status))  {
+            printf("Job [%d] (%d) stopped by signal %d\n", pid2jid(pid),
+                    pid, WSTOPSIG(status));
+            stopjob(job_list, pid);   /* Child stopped */
+        }
+        if (WIFCONTINUED(status)) { 
+            if (verbose)
+                printf("Job [%d] (%d) restarted by signal %d\n",
+                        pid2jid(pid), pid, SIGCONT);
+        }
+        // fflush(stdout);
+        Sigprocmask(SIG_SETMASK, &prev, NULL);
+    }
+
+    errno = olderrno;
+
+    if(verbose) 
+        printf("sigchld_handler: exiting\n");
+    return;
+}
+
+/* 
+ * sigint_handler - The kernel sends a SIGINT to the shell whenever the
+ *    user types ctrl-c at the keyboard.  Catch it and send it along
+ *    to the foreground job.  
+ */
+    void 
+sigint_handler(int sig) 
+{
+    pid_t pid;  /* stores the pid of fg job */
+
+    if(verbose) 
+        printf("sigint_handler: entering\n");
+    /* if job found, delete it, otherwise do nothing */
+    if ((pid = fgpid(job_list)) > 0) {
+        Kill(-pid, SIGINT);
+        if(verbose)
+            printf("sigint_handler: Job [%d] (%d) killed \n",
+                    pid2jid(pid), pid);
+    } else
+        interrupted = 1;        /* stop the script that is running */
+    if(verbose) 
+        printf("sigint_handler: exiting\n");
+    return;
+}
+
+/*
+ * sigtstp_handler - The kernel sends a SIGTSTP to the shell whenever
+ *     the user types ctrl-z at the keyboard. Catch it and suspend the
+ *     foreground job by sending it a SIGTSTP.  
+ */
+    void 
+sigtstp_handler(int sig) 
+{
+    pid_t pid;
+
+    if(verbose) 
+        printf("sigtstp_handler: entering\n");
+    /* For each process in foreground, place job in stopped state */
+    if ((pid = fgpid(job_list)) > 0) {
+        Kill(-pid, SIGTSTP);
+        if(verbose)
+            printf("sigtstp_handler: Job [%d] (%d) stopped \n",
+                    pid2jid(pid), pid);
+    }
+
+
+    if(verbose) 
+        printf("sigtstp_handler: entering\n");
+    return;
+}
+
+/*
+ * sigquit_handler - The driver program can gracefully terminate the
+ *    child shell by sending it a SIGQUIT signal.
+ */
+    void 
+sigquit_handler(int sig) 
+{
+    if(verbose) 
+        sio_puts("sigquit_handler: entering\n");
+
+    sio_error("Terminating after receipt of SIGQUIT signal\n");
+}
+
+
+
+/*********************
+ * End signal handlers
+ *********************/
+
+/***********************************************
+ * Helper routines that manipulate the job list
+ **********************************************/
+
+/* clearjob - Clear the entries in a job struct */
+void 
+clearjob(struct job_t *job) {
+    job->pid = 0;
+    job->jid = 0;
+    job->state = UNDEF;
+    job->cmdline[0] = '\0';
+}
+
+/* initjobs - Initialize the job list */
+void 
+initjobs(struct job_t *job_list) {
+    int i;
+
+    for (i = 0; i < MAXJOBS; i++)
+        clearjob(&job_list[i]);
+}
+
+/* maxjid - Returns largest allocated job ID */
+    int 
+maxjid(struct job_t *job_list) 
+{
+    int i, max=0;
+
+    for (i = 0; i < MAXJOBS; i++)
+        if (job_list[i].jid > max)
+            max = job_list[i].jid;
+    return max;
+}
+
+/* addjob - Add a job to the job list */
+    int 
+addjob(struct job_t *job_list, pid_t pid, int state, char *cmdline) 
+{
+    int i;
+
+    if (pid < 1)
+        return 0;
+
+    for (i = 0; i < MAXJOBS; i++) {
+        if (job_list[i].pid == 0) {
+            job_list[i].pid = pid;
+            job_list[i].state = state;
+            job_list[i].jid = nextjid++;
             if (nextjid > MAXJOBS)
                 nextjid = 1;
-            strcpy(job_list[i].cmdline, cmdline);
+            snprintf(job_list[i].cmdline, MAXLINE, "%s", cmdline);
             if(verbose){
                 printf("Added job [%d] %d %s\n",
                         job_list[i].jid,
@@ -883,7 +3112,7 @@ pid2jid(pid_t pid)
 listjobs(struct job_t *job_list, int output_fd) 
 {
     int i;
-    char buf[MAXLINE];
+    char buf[MAXLINE + 1];
 
     for (i = 0; i < MAXJOBS; i++) {
         memset(buf, '\0', MAXLINE);
@@ -0,0 +1,622 @@
+/*
+ * tshrec.c - Shell lab session recorder
+ *
+ * Runs a shell interactively, as runtrace would run it (on a datagram
+ * socket, with its jobs syncing through a shared-memory region), and
+ * records the session as a trace that runtrace can replay:
+ *
+ *   - each command line that the user enters, after a "DELAY <msecs>"
+ *     with the time since the last event, that is, the user's think
+ *     and typing time (the shell only ever sees whole lines),
+ *   - ctrl-c and ctrl-z, as SIGINT and SIGTSTP to the shell,
+ *   - a WAIT each time a job syncs, and a NEXT each time the shell
+ *     comes back with a prompt,
+ *   - "SIGNAL [pid | @k | all]" lines, which release synced jobs here
+ *     just as in a trace, and "#" comments, as typed.
+ *
+ * Alongside the trace, it writes the shell's output the way runtrace
+ * prints it, so that "tshrec -r" can replay the trace with runtrace,
+ * at the original speed or, with -F, as fast as possible, and compare
+ * the two outputs with the same filter as sdriver.
+ *
+ * Usage: ./tshrec [-h] [-s <shell>] -f <trace> [-o <outfile>]
+ *        ./tshrec -r [-FP] [-s <shell>] -f <trace> [-o <outfile>]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <termios.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+#include "config.h"
+#include "jobsync.h"
+
+extern char **environ;
+
+#define MAXPENDING (64*MAXBUF) /* Shell output that waits for a prompt */
+#define POLL_MSECS 10          /* How often we look for job syncs */
+#define MAXSYNCS 1024
+
+/* Same filter as sdriver: elide whitespace, and PIDs become "(PID)" */
+#define PERLPROG "while(<>){chomp; s/\\s+//g; s/\\(\\d+\\)/\\(PID\\)/g; print \"$_\"}"
+
+/* Modified by command line args */
+char *shellprog = "./tsh";
+char *tracefile = NULL;
+char *outfile = NULL;
+int replay = 0;
+int fast = 0;
+int pid_namespaces = 0;
+
+/* The shell, and the files that we record into */
+pid_t shell_pid = 0;
+int datafd[2];
+char syncenv[MAXBUF];
+FILE *tracefp, *outfp;
+
+/* The user's terminal, if we have one */
+struct termios saved_tio;
+int raw = 0;
+
+/* The line being typed */
+char line[MAXBUF];
+int linelen = 0;
+
+/* Shell output since the last prompt; runtrace prints it at NEXT */
+char pending[MAXPENDING];
+int pending_len = 0;
+
+/* PIDs of the jobs that have synced so far, for "SIGNAL @k" */
+pid_t synced[MAXSYNCS];
+int nsynced = 0;
+
+int at_prompt = 0;             /* The shell is waiting for a command */
+int num_commands = 0;
+double start, last_event;
+
+/* Temp files for the replay */
+char replayout[MAXBUF];
+char filtered[2][MAXBUF];
+
+/* Prototypes */
+void usage(void);
+void record(void);
+void start_shell(void);
+void raw_mode(void);
+void restore_mode(void);
+void key(int c);
+void enter_line(void);
+void send_line(char *text);
+void release_jobs(char *text);
+void record_event(char *text, int delay);
+void shell_output(void);
+int replay_trace(void);
+double now(void);
+void sigalrm_handler(int sig);
+void cleanup(void);
+
+int main(int argc, char **argv)
+{
+    int c;
+    static char defout[MAXBUF];
+
+    while ((c = getopt(argc, argv, "hrFPs:f:o:")) != EOF) {
+	switch (c) {
+	case 's':             /* The shell to record (default ./tsh) */
+	    shellprog = optarg;
+	    break;
+	case 'f':             /* The trace to write, or to replay */
+	    tracefile = optarg;
+	    break;
+	case 'o':             /* The recorded output (default <trace>.out) */
+	    outfile = optarg;
+	    break;
+	case 'r':             /* Replay a recording and compare */
+	    replay = 1;
+	    break;
+	case 'F':             /* Replay without the user's delays */
+	    fast = 1;
+	    break;
+	case 'P':             /* Replay in a PID namespace */
+	    pid_namespaces = 1;
+	    break;
+	case 'h':
+	default:
+	    usage();
+	}
+    }
+    if (!tracefile)
+	usage();
+    if (!outfile) {
+	snprintf(defout, MAXBUF, "%s.out", tracefile);
+	outfile = defout;
+    }
+
+    signal(SIGALRM, sigalrm_handler);
+    atexit(cleanup);
+    if (replay)
+	exit(replay_trace());
+    record();
+    exit(0);
+}
+
+/*
+ * record - Run the shell on the user's input and record the session
+ */
+void record(void)
+{
+    struct pollfd fds[2];
+    unsigned char keys[MAXBUF];
+    pid_t pid;
+    int i, n, done = 0;
+    double t;
+
+    if ((tracefp = fopen(tracefile, "w")) == NULL) {
+	perror(tracefile);
+	exit(1);
+    }
+    if ((outfp = fopen(outfile, "w")) == NULL) {
+	perror(outfile);
+	exit(1);
+    }
+    start_shell();
+
+    /* runtrace echoes comments, so they go into the output too */
+    fprintf(tracefp, "#\n# Recorded by tshrec from %s\n#\n", shellprog);
+    fprintf(outfp, "#\n# Recorded by tshrec from %s\n#\n", shellprog);
+    printf("tshrec: recording %s to %s; ctrl-d ends the session\n",
+	   shellprog, tracefile);
+    printf("%s", PROMPT);
+    fflush(stdout);
+    raw_mode();
+    start = last_event = now();
+
+    fds[0].fd = STDIN_FILENO;
+    fds[0].events = POLLIN;
+    fds[1].fd = datafd[0];
+    fds[1].events = POLLIN;
+    while (!done) {
+	if (poll(fds, 2, POLL_MSECS) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    perror("poll");
+	    exit(1);
+	}
+
+	/* Jobs that synced since we last looked */
+	while ((pid = jobsync_await(0)) != 0) {
+	    if (nsynced < MAXSYNCS)
+		synced[nsynced++] = pid;
+	    record_event("WAIT", 0);
+	}
+
+	if (fds[1].revents & (POLLIN | POLLHUP)) {
+	    if ((n = recv(datafd[0], pending + pending_len,
+			  MAXPENDING - pending_len - 1, 0)) < 0) {
+		perror("recv");
+		exit(1);
+	    }
+	    if (n == 0)        /* The shell exited */
+		break;
+	    pending[pending_len + n] = '\0';
+	    shell_output();
+	}
+
+	if (fds[0].revents & (POLLIN | POLLHUP)) {
+	    if ((n = read(STDIN_FILENO, keys, sizeof(keys))) < 0) {
+		perror("read");
+		exit(1);
+	    }
+	    if (n == 0)        /* Our input ran out: same as ctrl-d */
+		done = 1;
+	    for (i = 0; i < n && !done; i++) {
+		if (keys[i] == 0x04 && linelen == 0)
+		    done = 1;
+		else
+		    key(keys[i]);
+	    }
+	}
+    }
+    restore_mode();
+
+    /*
+     * Whatever the shell printed after its last prompt isn't in the
+     * output, since runtrace only prints it at NEXT
+     */
+    t = now() - start;
+    fprintf(tracefp, "# tshrec: %d commands in %.3f secs\n", num_commands, t);
+    fprintf(outfp, "# tshrec: %d commands in %.3f secs\n", num_commands, t);
+    fclose(tracefp);
+    fclose(outfp);
+    printf("\ntshrec: recorded %d commands to %s, output to %s\n",
+	   num_commands, tracefile, outfile);
+}
+
+/*
+ * start_shell - Start the shell with its stdin and stdout on a datagram
+ *     socket and SYNCSHM in its environment, as runtrace does, and wait
+ *     for its first prompt
+ */
+void start_shell(void)
+{
+    char *argv[] = {shellprog, NULL};
+    char buf[MAXBUF];
+    int syncshm, n;
+
+    if (socketpair(AF_LOCAL, SOCK_DGRAM, 0, datafd) < 0) {
+	perror("socketpair");
+	exit(1);
+    }
+    if ((syncshm = jobsync_create()) < 0) {
+	printf("tshrec: Job sync needs a shared-memory region\n");
+	exit(1);
+    }
+    sprintf(syncenv, "SYNCSHM=%d", syncshm);
+    if (putenv(syncenv) < 0) {
+	perror("putenv");
+	exit(1);
+    }
+
+    if ((shell_pid = fork()) < 0) {
+	perror("fork");
+	exit(1);
+    }
+    if (shell_pid == 0) {
+	close(datafd[0]);
+	dup2(datafd[1], 0);
+	dup2(datafd[1], 1);
+	execve(argv[0], argv, environ);
+	perror(argv[0]);
+	exit(1);
+    }
+    close(datafd[1]);
+
+    alarm(DRIVER_TIMEOUT);
+    bzero(buf, MAXBUF);
+    if ((n = recv(datafd[0], buf, MAXBUF - 1, 0)) < 0) {
+	perror("recv");
+	exit(1);
+    }
+    alarm(0);
+    if (strcmp(buf, PROMPT)) {
+	printf("tshrec: Expected the shell's prompt but got '%s'\n", buf);
+	exit(1);
+    }
+    at_prompt = 1;
+}
+
+/*
+ * raw_mode - Take the keys one at a time and without echo, and let
+ *     ctrl-c and ctrl-z through as keys rather than signals to us
+ */
+void raw_mode(void)
+{
+    struct termios tio;
+
+    if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &saved_tio) < 0)
+	return;
+    tio = saved_tio;
+    tio.c_lflag &= ~(ICANON | ECHO | ISIG);
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &tio) < 0) {
+	perror("tcsetattr");
+	exit(1);
+    }
+    raw = 1;
+}
+
+/*
+ * restore_mode - Give the terminal back as we found it
+ */
+void restore_mode(void)
+{
+    if (raw)
+	tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved_tio);
+    raw = 0;
+}
+
+/*
+ * key - Handle one key, with just enough line editing to type commands
+ */
+void key(int c)
+{
+    switch (c) {
+    case 0x03:                 /* ctrl-c */
+	printf("^C\n");
+	linelen = 0;
+	record_event("SIGINT", 1);
+	kill(shell_pid, SIGINT);
+	break;
+    case 0x1a:                 /* ctrl-z */
+	printf("^Z\n");
+	linelen = 0;
+	record_event("SIGTSTP", 1);
+	kill(shell_pid, SIGTSTP);
+	break;
+    case 0x7f:                 /* Backspace */
+    case '\b':
+	if (linelen > 0) {
+	    linelen--;
+	    printf("\b \b");
+	}
+	break;
+    case 0x15:                 /* ctrl-u */
+	while (linelen > 0) {
+	    linelen--;
+	    printf("\b \b");
+	}
+	break;
+    case '\r':
+    case '\n':
+	printf("\n");
+	line[linelen] = '\0';
+	linelen = 0;
+	enter_line();
+	break;
+    default:
+	if ((isprint(c) || c == '\t') && linelen < MAXBUF - 2) {
+	    line[linelen++] = c;
+	    putchar(c);
+	}
+    }
+    fflush(stdout);
+}
+
+/*
+ * enter_line - Record the line the user just entered and act on it
+ */
+void enter_line(void)
+{
+    char word[MAXBUF] = "";
+    char *p;
+
+    /* Trailing whitespace would confuse the trace's readers */
+    for (p = line + strlen(line); p > line && isspace(p[-1]); p--)
+	p[-1] = '\0';
+    sscanf(line, "%s", word);
+
+    if (word[0] == '\0')
+	;                      /* runtrace ignores blank lines */
+    else if (line[0] == '#') {
+	record_event(line, 0);
+	fprintf(outfp, "%s\n", line);
+    }
+    else if (!strcmp(word, "SIGNAL"))
+	release_jobs(line);
+    else if (!strcmp(word, "SIGINT") || !strcmp(word, "SIGTSTP")) {
+	record_event(word, 1);
+	kill(shell_pid, !strcmp(word, "SIGINT") ? SIGINT : SIGTSTP);
+	return;
+    }
+    else if (!strcmp(word, "WAIT") || !strcmp(word, "NEXT") ||
+	     !strcmp(word, "SETTLE") || !strcmp(word, "DELAY"))
+	printf("tshrec: %s is not something we can record\n", word);
+    else {
+	send_line(line);
+	return;
+    }
+
+    /* The shell didn't see the line, so it won't prompt for us */
+    if (at_prompt)
+	printf("%s", PROMPT);
+}
+
+/*
+ * send_line - Record a command and pass it on to the shell
+ */
+void send_line(char *text)
+{
+    char buf[MAXBUF + 1];
+
+    record_event(text, 1);
+    num_commands++;
+    at_prompt = 0;
+    sprintf(buf, "%s\n", text);
+    if (send(datafd[0], buf, strlen(buf), 0) < 0) {
+	perror("send");
+	exit(1);
+    }
+}
+
+/*
+ * release_jobs - Carry out "SIGNAL [pid | @k | all]", as runtrace would
+ */
+void release_jobs(char *text)
+{
+    char arg[MAXBUF] = "";
+    pid_t pid = 0;
+    int k;
+
+    sscanf(text, "%*s %s", arg);
+    if (!strcmp(arg, "all")) {
+	record_event(text, 1);
+	jobsync_release_all();
+	return;
+    }
+    if (arg[0] == '@') {
+	k = atoi(arg + 1);
+	if (k < 1 || k > nsynced) {
+	    printf("tshrec: No job %s has synced\n", arg);
+	    return;
+	}
+	pid = synced[k-1];
+    }
+    else if (arg[0])
+	pid = atoi(arg);
+    if (jobsync_release(pid) < 0) {
+	printf("tshrec: No job %s is waiting\n", arg[0] ? arg : "");
+	return;
+    }
+    record_event(text, 1);
+}
+
+/*
+ * record_event - Write a line of the trace. A line that the user
+ *     typed (delay true) comes after the time they took over it.
+ */
+void record_event(char *text, int delay)
+{
+    double t = now();
+    int msecs = (t - last_event) * 1000;
+
+    if (delay && msecs > 0)
+	fprintf(tracefp, "DELAY %d\n", msecs);
+    fprintf(tracefp, "%s\n", text);
+    fflush(tracefp);
+    last_event = t;
+}
+
+/*
+ * shell_output - Show the datagram that the shell just sent. A prompt
+ *     ends a NEXT, and the output before it goes into the recording.
+ */
+void shell_output(void)
+{
+    char *dgram = pending + pending_len;
+
+    if (strcmp(dgram, PROMPT)) {
+	fputs(dgram, stdout);
+	fflush(stdout);
+	pending_len += strlen(dgram);
+	if (pending_len > MAXPENDING - MAXBUF) {
+	    printf("tshrec: Too much output before the shell's prompt\n");
+	    exit(1);
+	}
+	return;
+    }
+
+    *dgram = '\0';
+    fputs(pending, outfp);
+    fflush(outfp);
+    pending_len = 0;
+    record_event("NEXT", 0);
+    at_prompt = 1;
+    printf("%s", PROMPT);
+    fwrite(line, 1, linelen, stdout);
+    fflush(stdout);
+}
+
+/*
+ * replay_trace - Replay a recording with runtrace and compare its
+ *     output with the recorded output. Returns 0 if they match.
+ */
+int replay_trace(void)
+{
+    char cmd[4*MAXBUF], buf[MAXBUF];
+    FILE *fp;
+    double t, recorded = -1;
+    int n, status;
+
+    if ((fp = fopen(tracefile, "r")) == NULL) {
+	perror(tracefile);
+	exit(1);
+    }
+    while (fgets(buf, MAXBUF, fp))
+	sscanf(buf, "# tshrec: %d commands in %lf secs", &n, &recorded);
+    fclose(fp);
+
+    sprintf(replayout, "/tmp/tshrec_replay.%d", getpid());
+    sprintf(filtered[0], "/tmp/tshrec_recorded.%d", getpid());
+    sprintf(filtered[1], "/tmp/tshrec_replayed.%d", getpid());
+
+    sprintf(cmd, "./runtrace %s%s-s %s -f %s > %s", fast ? "-F " : "",
+	    pid_namespaces ? "-P " : "", shellprog, tracefile, replayout);
+    t = now();
+    status = system(cmd);
+    t = now() - t;
+    if (status != 0) {
+	printf("tshrec: runtrace failed on %s\n", tracefile);
+	return 1;
+    }
+
+    sprintf(cmd, "perl -e '%s' < %s | sort > %s", PERLPROG, outfile,
+	    filtered[0]);
+    system(cmd);
+    sprintf(cmd, "perl -e '%s' < %s | sort > %s", PERLPROG, replayout,
+	    filtered[1]);
+    system(cmd);
+    sprintf(cmd, "cmp -s %s %s", filtered[0], filtered[1]);
+    if (system(cmd) != 0) {
+	printf("tshrec: Replayed output differs from the recording:\n");
+	fflush(stdout);
+	sprintf(cmd, "diff %s %s", outfile, replayout);
+	system(cmd);
+	return 1;
+    }
+
+    printf("tshrec: %s replayed in %.3f secs", tracefile, t);
+    if (recorded >= 0)
+	printf(" (recorded in %.3f secs)", recorded);
+    printf(", output matches\n");
+    return 0;
+}
+
+/*
+ * now - Return the time in secs on the monotonic clock
+ */
+double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * sigalrm_handler - The shell never came back with a prompt
+ */
+void sigalrm_handler(int sig)
+{
+    printf("tshrec: timed out waiting for the shell\n");
+    exit(1);
+}
+
+/*
+ * cleanup - Restore the terminal, let go of the shell and its jobs,
+ *     and remove our temp files
+ */
+void cleanup(void)
+{
+    restore_mode();
+    if (shell_pid > 0) {
+	send(datafd[0], "", 0, 0);    /* EOF */
+	jobsync_release_all();
+	alarm(DRIVER_TIMEOUT);
+	waitpid(shell_pid, NULL, 0);
+	alarm(0);
+    }
+    if (replay) {
+	unlink(replayout);
+	unlink(filtered[0]);
+	unlink(filtered[1]);
+    }
+}
+
+/*
+ * usage - Print help message and terminate
+ */
+void usage(void)
+{
+    printf("Usage: tshrec [-h] [-s <shell>] -f <trace> [-o <outfile>]\n");
+    printf("       tshrec -r [-FP] [-s <shell>] -f <trace> [-o <outfile>]\n");
+    printf("Records an interactive shell session as a trace for runtrace,\n");
+    printf("or replays a recording and compares the output.\n");
+    printf("Options:\n");
+    printf("  -h            Print this message\n");
+    printf("  -s <shell>    Shell program to run (default ./tsh)\n");
+    printf("  -f <trace>    Trace file to write, or with -r to replay\n");
+    printf("  -o <outfile>  Recorded output (default <trace>.out)\n");
+    printf("  -r            Replay the trace with runtrace and compare\n");
+    printf("  -F            With -r, skip the delays (as fast as possible)\n");
+    printf("  -P            With -r, run the shell in a PID namespace\n");
+    exit(1);
+}